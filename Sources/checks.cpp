@@ -0,0 +1,341 @@
+//
+//  checks.cpp
+//  ArrowAcero
+//
+#import "udf.h"
+#import "nodes.h"
+#import "sinks.h"
+#import "optimizer.h"
+#import "public_suffix.h"
+#import "sorted_merge.h"
+
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <optional>
+
+/*
+ * Behavior checks of the sketches, tries, readers and rewrites below,
+ * run by ctest. Every check returns an error naming what differed.
+ */
+
+static arrow::Status Expect(bool condition, const std::string& what) {
+    return condition ? arrow::Status::OK() : arrow::Status::Invalid("Expected ", what);
+}
+
+/*
+ * hash_approx_count_distinct driven through its kernel, so the states
+ * and their merge are under control of the check
+ */
+class ApproxCountDistinctState {
+public:
+    static arrow::Result<std::unique_ptr<ApproxCountDistinctState>> Make(int64_t numGroups) {
+        ARROW_ASSIGN_OR_RAISE(auto function, cp::GetFunctionRegistry()->GetFunction("hash_approx_count_distinct"));
+        ARROW_ASSIGN_OR_RAISE(const cp::Kernel* kernel, function->DispatchExact({arrow::int64(), arrow::uint32()}));
+
+        auto state = std::unique_ptr<ApproxCountDistinctState>(new ApproxCountDistinctState());
+        state->kernel_ = static_cast<const cp::HashAggregateKernel*>(kernel);
+
+        ApproxCountDistinctOptions options;
+        std::vector<arrow::TypeHolder> inputs = {arrow::int64(), arrow::uint32()};
+        ARROW_ASSIGN_OR_RAISE(state->state_, state->kernel_->init(&state->context_, {kernel, inputs, &options}));
+        state->context_.SetState(state->state_.get());
+        ARROW_RETURN_NOT_OK(state->kernel_->resize(&state->context_, numGroups));
+        return state;
+    }
+
+    arrow::Status Consume(const std::vector<int64_t>& values, const std::vector<uint32_t>& groups) {
+        arrow::Int64Builder valueBuilder;
+        arrow::UInt32Builder groupBuilder;
+        ARROW_RETURN_NOT_OK(valueBuilder.AppendValues(values));
+        ARROW_RETURN_NOT_OK(groupBuilder.AppendValues(groups));
+        ARROW_ASSIGN_OR_RAISE(auto valueArray, valueBuilder.Finish());
+        ARROW_ASSIGN_OR_RAISE(auto groupArray, groupBuilder.Finish());
+
+        cp::ExecBatch batch({valueArray, groupArray}, valueArray->length());
+        return kernel_->consume(&context_, cp::ExecSpan(batch));
+    }
+
+    // Merges other into this state, the groups of both are the same
+    arrow::Status Merge(ApproxCountDistinctState&& other, int64_t numGroups) {
+        std::vector<uint32_t> identity(numGroups);
+        std::iota(identity.begin(), identity.end(), 0);
+        arrow::UInt32Builder mappingBuilder;
+        ARROW_RETURN_NOT_OK(mappingBuilder.AppendValues(identity));
+        ARROW_ASSIGN_OR_RAISE(auto mapping, mappingBuilder.Finish());
+        return kernel_->merge(&context_, std::move(*other.state_), *mapping->data());
+    }
+
+    arrow::Result<std::vector<int64_t>> Finalize() {
+        arrow::Datum out;
+        ARROW_RETURN_NOT_OK(kernel_->finalize(&context_, &out));
+        auto counts = std::static_pointer_cast<arrow::Int64Array>(out.make_array());
+        return std::vector<int64_t>(counts->raw_values(), counts->raw_values() + counts->length());
+    }
+
+private:
+    ApproxCountDistinctState() : context_(cp::default_exec_context()) {}
+
+    const cp::HashAggregateKernel* kernel_ = nullptr;
+    cp::KernelContext context_;
+    std::unique_ptr<cp::KernelState> state_;
+};
+
+/* Values [first, first + count) for group */
+static void AddRange(std::vector<int64_t>* values, std::vector<uint32_t>* groups, uint32_t group, int64_t first, int64_t count) {
+    for (int64_t value = first; value < first + count; value++) {
+        values->push_back(value);
+        groups->push_back(group);
+    }
+}
+
+static arrow::Status CheckApproxCountDistinctMerge() {
+    /*
+     * Group 0 is sparse on the left and dense on the right, group 1 the
+     * other way round, group 2 sparse on both sides and dense once merged.
+     * A precision of 12 turns dense past 256 registers.
+     */
+    const int64_t numGroups = 3;
+    std::vector<int64_t> leftValues, rightValues;
+    std::vector<uint32_t> leftGroups, rightGroups;
+    AddRange(&leftValues, &leftGroups, 0, 0, 10);
+    AddRange(&rightValues, &rightGroups, 0, 1000, 5000);
+    AddRange(&leftValues, &leftGroups, 1, 0, 5000);
+    AddRange(&rightValues, &rightGroups, 1, 100000, 10);
+    AddRange(&leftValues, &leftGroups, 2, 0, 200);
+    AddRange(&rightValues, &rightGroups, 2, 200, 200);
+
+    ARROW_ASSIGN_OR_RAISE(auto left, ApproxCountDistinctState::Make(numGroups));
+    ARROW_ASSIGN_OR_RAISE(auto right, ApproxCountDistinctState::Make(numGroups));
+    ARROW_RETURN_NOT_OK(left->Consume(leftValues, leftGroups));
+    ARROW_RETURN_NOT_OK(right->Consume(rightValues, rightGroups));
+    ARROW_RETURN_NOT_OK(left->Merge(std::move(*right), numGroups));
+    ARROW_ASSIGN_OR_RAISE(std::vector<int64_t> merged, left->Finalize());
+
+    /* Registers merge by maximum, the same values in one state give the same estimates */
+    ARROW_ASSIGN_OR_RAISE(auto single, ApproxCountDistinctState::Make(numGroups));
+    ARROW_RETURN_NOT_OK(single->Consume(leftValues, leftGroups));
+    ARROW_RETURN_NOT_OK(single->Consume(rightValues, rightGroups));
+    ARROW_ASSIGN_OR_RAISE(std::vector<int64_t> expected, single->Finalize());
+
+    const int64_t exact[] = {5010, 5010, 400};
+    for (int64_t group = 0; group < numGroups; group++) {
+        std::string name = "group " + std::to_string(group);
+        ARROW_RETURN_NOT_OK(Expect(merged[group] == expected[group],
+                                   name + " merged estimate " + std::to_string(merged[group]) +
+                                   " to equal the single state estimate " + std::to_string(expected[group])));
+        ARROW_RETURN_NOT_OK(Expect(std::abs(merged[group] - exact[group]) <= exact[group] / 20,
+                                   name + " estimate " + std::to_string(merged[group]) +
+                                   " within 5% of " + std::to_string(exact[group])));
+    }
+
+    /* Few values stay sparse and are counted exactly */
+    ARROW_ASSIGN_OR_RAISE(auto small, ApproxCountDistinctState::Make(1));
+    ARROW_RETURN_NOT_OK(small->Consume({1, 2, 3, 3, 4, 5, 5, 5}, {0, 0, 0, 0, 0, 0, 0, 0}));
+    ARROW_ASSIGN_OR_RAISE(std::vector<int64_t> smallCounts, small->Finalize());
+    return Expect(smallCounts[0] == 5, "5 distinct values in a sparse sketch, got " + std::to_string(smallCounts[0]));
+}
+
+static arrow::Status ExpectDomain(const PublicSuffixTrie& trie, std::string_view host, std::string_view expected) {
+    PublicSuffixTrie::Match match = trie.RegistrableDomain(host);
+    std::string_view domain = host.substr(match.offset, match.length);
+    return Expect(domain == expected,
+                  "registrable domain of '" + std::string(host) + "' to be '" + std::string(expected) +
+                  "', got '" + std::string(domain) + "'");
+}
+
+static arrow::Status CheckPublicSuffixRules() {
+    ARROW_ASSIGN_OR_RAISE(auto trie, PublicSuffixTrie::Make("// comment\n"
+                                                             "com\n"
+                                                             "uk\n"
+                                                             "co.uk\n"
+                                                             "jp\n"
+                                                             "*.ck\n"
+                                                             "!www.ck\n"
+                                                             "*.kawasaki.jp\n"
+                                                             "!city.kawasaki.jp\n"));
+
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "example.com", "example.com"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "shop.example.co.uk", "example.co.uk"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "Shop.EXAMPLE.Co.Uk", "EXAMPLE.Co.Uk"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "co.uk", ""));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "com", ""));
+
+    /* A wildcard makes every label below it a public suffix */
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "a.b.ck", "a.b.ck"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "x.a.b.ck", "a.b.ck"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "b.ck", ""));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "foo.bar.kawasaki.jp", "foo.bar.kawasaki.jp"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "bar.kawasaki.jp", ""));
+
+    /* An exception takes its label back out of the wildcard */
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "www.ck", "www.ck"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "x.www.ck", "www.ck"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "city.kawasaki.jp", "city.kawasaki.jp"));
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "www.city.kawasaki.jp", "city.kawasaki.jp"));
+
+    ARROW_RETURN_NOT_OK(ExpectDomain(*trie, "192.168.0.1", ""));
+    return ExpectDomain(*trie, "", "");
+}
+
+/* One partition of (key, tag) rows in batches of batchSize rows, nullopt keys are null */
+template <typename BuilderType, typename ValueType>
+static arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> MakePartition(const std::vector<std::optional<ValueType>>& keys,
+                                                                            const std::vector<std::string>& tags,
+                                                                            int64_t batchSize) {
+    BuilderType keyBuilder;
+    for (const auto& key : keys) {
+        ARROW_RETURN_NOT_OK(key ? keyBuilder.Append(*key) : keyBuilder.AppendNull());
+    }
+    arrow::StringBuilder tagBuilder;
+    ARROW_RETURN_NOT_OK(tagBuilder.AppendValues(tags));
+
+    std::vector<std::shared_ptr<arrow::Array>> columns(2);
+    ARROW_RETURN_NOT_OK(keyBuilder.Finish(&columns[0]));
+    ARROW_RETURN_NOT_OK(tagBuilder.Finish(&columns[1]));
+
+    auto schema = arrow::schema({arrow::field("key", columns[0]->type()), arrow::field("tag", arrow::utf8())});
+    auto table = arrow::Table::Make(schema, columns);
+
+    arrow::TableBatchReader reader(*table);
+    reader.set_chunksize(batchSize);
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    while (true) {
+        std::shared_ptr<arrow::RecordBatch> batch;
+        ARROW_RETURN_NOT_OK(reader.ReadNext(&batch));
+        if (!batch) {
+            break;
+        }
+        batches.push_back(std::move(batch));
+    }
+    return arrow::RecordBatchReader::Make(batches, schema);
+}
+
+static arrow::Status ExpectMergedTags(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                      cp::SortOrder order,
+                                      const std::vector<std::string>& expected) {
+    ARROW_ASSIGN_OR_RAISE(auto merge, SortedMergeReader::Make(std::move(partitions), {cp::SortKey("key", order)}, 3));
+    ARROW_ASSIGN_OR_RAISE(auto merged, merge->ToTable());
+
+    std::vector<std::string> tags;
+    for (const auto& chunk : merged->GetColumnByName("tag")->chunks()) {
+        auto strings = std::static_pointer_cast<arrow::StringArray>(chunk);
+        for (int64_t i = 0; i < strings->length(); i++) {
+            tags.push_back(strings->GetString(i));
+        }
+    }
+
+    std::string got;
+    for (const auto& tag : tags) {
+        got += tag + " ";
+    }
+    return Expect(tags == expected, "merged rows in order, got " + got);
+}
+
+static arrow::Status CheckSortedMergeTiesAndNulls() {
+    /* Equal keys come from the earlier partition first, nulls last */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> ascending(2);
+    ARROW_ASSIGN_OR_RAISE(ascending[0], (MakePartition<arrow::Int64Builder, int64_t>({1, 2, 2, std::nullopt}, {"a1", "a2", "a3", "anull"}, 3)));
+    ARROW_ASSIGN_OR_RAISE(ascending[1], (MakePartition<arrow::Int64Builder, int64_t>({2, 2, 3, std::nullopt}, {"b2", "b3", "b4", "bnull"}, 2)));
+    ARROW_RETURN_NOT_OK(ExpectMergedTags(std::move(ascending), cp::SortOrder::Ascending,
+                                         {"a1", "a2", "a3", "b2", "b3", "b4", "anull", "bnull"}));
+
+    /* Descending keeps both rules */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> descending(2);
+    ARROW_ASSIGN_OR_RAISE(descending[0], (MakePartition<arrow::Int64Builder, int64_t>({2, 2, 1, std::nullopt}, {"a1", "a2", "a3", "anull"}, 3)));
+    ARROW_ASSIGN_OR_RAISE(descending[1], (MakePartition<arrow::Int64Builder, int64_t>({3, 2, std::nullopt}, {"b1", "b2", "bnull"}, 1)));
+    ARROW_RETURN_NOT_OK(ExpectMergedTags(std::move(descending), cp::SortOrder::Descending,
+                                         {"b1", "a1", "a2", "b2", "a3", "anull", "bnull"}));
+
+    /* NaNs sort after every number */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> floating(2);
+    ARROW_ASSIGN_OR_RAISE(floating[0], (MakePartition<arrow::DoubleBuilder, double>({0.5, std::nan("")}, {"a1", "anan"}, 2)));
+    ARROW_ASSIGN_OR_RAISE(floating[1], (MakePartition<arrow::DoubleBuilder, double>({-1.5, 1.5}, {"b1", "b2"}, 2)));
+    return ExpectMergedTags(std::move(floating), cp::SortOrder::Ascending, {"b1", "a1", "b2", "anan"});
+}
+
+static std::shared_ptr<arrow::Table> MakeOptimizerTable() {
+    arrow::Int64Builder builder;
+    for (int64_t i = 0; i < 100; i++) {
+        ARROW_CHECK_OK(builder.Append(i));
+    }
+    std::shared_ptr<arrow::Array> values = builder.Finish().ValueOrDie();
+    return arrow::Table::Make(arrow::schema({arrow::field("value", arrow::int64())}), {values});
+}
+
+static bool SingleSource(const ac::Declaration& declaration) {
+    if (declaration.inputs.size() != 1) {
+        return false;
+    }
+    const auto* input = std::get_if<ac::Declaration>(&declaration.inputs[0]);
+    return input != nullptr && input->factory_name == "table_source";
+}
+
+/* The optimized declaration gives the same rows as the original */
+static arrow::Status ExpectSameRows(const ac::Declaration& declaration, const ac::Declaration& optimized) {
+    ARROW_ASSIGN_OR_RAISE(auto expected, ac::DeclarationToTable(declaration, /*use_threads=*/false));
+    ARROW_ASSIGN_OR_RAISE(auto got, ac::DeclarationToTable(optimized, /*use_threads=*/false));
+    return Expect(got->Equals(*expected), "optimized rows\n" + got->ToString() + "to equal\n" + expected->ToString());
+}
+
+static arrow::Status CheckFuseProjectsAndFilters() {
+    ac::Declaration source = TableSourceNode(MakeOptimizerTable());
+
+    /* Two projects become one */
+    ac::Declaration inner{"project", {source}, ac::ProjectNodeOptions({cp::field_ref("value"),
+                                                                       cp::call("add", {cp::field_ref("value"), cp::literal(int64_t(1))})},
+                                                                      {"value", "next"})};
+    ac::Declaration outer{"project", {inner}, ac::ProjectNodeOptions({cp::call("multiply", {cp::field_ref("next"), cp::literal(int64_t(2))})},
+                                                                     {"doubled"})};
+    OptimizerStats projectStats;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration fusedProjects, OptimizeDeclaration(outer, &projectStats));
+    ARROW_RETURN_NOT_OK(Expect(projectStats.fused_projects == 1, "one fused project, got " + projectStats.ToString()));
+    ARROW_RETURN_NOT_OK(Expect(fusedProjects.factory_name == "project" && SingleSource(fusedProjects),
+                               "a single project over the source"));
+    ARROW_RETURN_NOT_OK(ExpectSameRows(outer, fusedProjects));
+
+    /* A computed column used twice stays in its own project */
+    ac::Declaration twice{"project", {inner}, ac::ProjectNodeOptions({cp::call("multiply", {cp::field_ref("next"), cp::field_ref("next")})},
+                                                                     {"squared"})};
+    OptimizerStats twiceStats;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration keptProjects, OptimizeDeclaration(twice, &twiceStats));
+    ARROW_RETURN_NOT_OK(Expect(twiceStats.fused_projects == 0, "no fused project, got " + twiceStats.ToString()));
+    ARROW_RETURN_NOT_OK(ExpectSameRows(twice, keptProjects));
+
+    /* Two filters become one on their conjunction */
+    ac::Declaration filter1{"filter", {source}, ac::FilterNodeOptions(cp::greater_equal(cp::field_ref("value"), cp::literal(int64_t(10))))};
+    ac::Declaration filter2{"filter", {filter1}, ac::FilterNodeOptions(cp::less(cp::field_ref("value"), cp::literal(int64_t(20))))};
+    OptimizerStats filterStats;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration fusedFilters, OptimizeDeclaration(filter2, &filterStats));
+    ARROW_RETURN_NOT_OK(Expect(filterStats.fused_filters == 1, "one fused filter, got " + filterStats.ToString()));
+    ARROW_RETURN_NOT_OK(Expect(fusedFilters.factory_name == "filter" && SingleSource(fusedFilters),
+                               "a single filter over the source"));
+    return ExpectSameRows(filter2, fusedFilters);
+}
+
+int main(int argc, char** argv) {
+    arrow::dataset::internal::Initialize();
+    arrow::Status st = RegisterCustomFunctions();
+    if (!st.ok()) {
+        std::cerr << st << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::function<arrow::Status()>>> checks = {
+        {"approx_count_distinct sparse and dense merge", CheckApproxCountDistinctMerge},
+        {"public suffix wildcards and exceptions", CheckPublicSuffixRules},
+        {"sorted merge ties and nulls", CheckSortedMergeTiesAndNulls},
+        {"fused projects and filters", CheckFuseProjectsAndFilters},
+    };
+
+    int failed = 0;
+    for (const auto& [name, check] : checks) {
+        st = check();
+        std::cout << (st.ok() ? "OK   " : "FAIL ") << name << std::endl;
+        if (!st.ok()) {
+            std::cout << "     " << st << std::endl;
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
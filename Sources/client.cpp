@@ -5,6 +5,7 @@
 #include <string>
 
 #include <chrono>
+#include <sstream>
 
 #include <arrow/api.h>
 
@@ -13,6 +14,7 @@
 #include <arrow/dataset/api.h>
 #include <arrow/dataset/plan.h>
 #include <arrow/flight/client.h>
+#include <arrow/util/value_parsing.h>
 
 #include <boost/url.hpp>
 
@@ -20,8 +22,45 @@
 #import "sinks.h"
 #import "sample.h"
 #import "udf.h"
+#import "flight_ipc.h"
 
-arrow::Status RunMain() {
+/*
+ * --compression=none|lz4|zstd --threshold=<bytes> --dictionary=<column>,...
+ * --ticket=<source>;<column>=<value>;columns=<column>,...
+ */
+arrow::Result<StreamIpcOptions> ParseClientOptions(int argc, char** argv, std::string* ticket) {
+    StreamIpcOptions options;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.rfind("--compression=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.compression, ParseStreamCompression(argument.substr(14)));
+        } else if (argument.rfind("--threshold=", 0) == 0) {
+            std::string threshold = argument.substr(12);
+            if (!arrow::internal::ParseValue<arrow::Int64Type>(threshold.data(), threshold.size(), &options.compression_threshold) ||
+                options.compression_threshold < 0) {
+                return arrow::Status::Invalid("--threshold needs a byte count, got '", threshold, "'");
+            }
+        } else if (argument.rfind("--ticket=", 0) == 0) {
+            *ticket = argument.substr(9);
+        } else if (argument.rfind("--dictionary=", 0) == 0) {
+            std::stringstream columns(argument.substr(13));
+            std::string column;
+            while (std::getline(columns, column, ',')) {
+                options.dictionary_columns.push_back(column);
+            }
+        } else {
+            return arrow::Status::Invalid("Unknown argument ", argument);
+        }
+    }
+    
+    return options;
+}
+
+arrow::Status RunMain(int argc, char** argv) {
+    std::string ticket;
+    ARROW_ASSIGN_OR_RAISE(StreamIpcOptions ipcOptions, ParseClientOptions(argc, argv, &ticket));
+    
     arrow::flight::Location location;
     ARROW_ASSIGN_OR_RAISE(location,
                           arrow::flight::Location::ForGrpcTcp("localhost", 4500));
@@ -35,9 +74,18 @@ arrow::Status RunMain() {
     
     ARROW_ASSIGN_OR_RAISE(std::unique_ptr<arrow::flight::FlightInfo> flight_info, flightListing->Next());
     
-    /* Read total */
+    /* Read total, compressed buffers and dictionary deltas are decoded by the reader */
+    arrow::flight::FlightCallOptions callOptions;
+    AddStreamIpcHeaders(ipcOptions, &callOptions);
+    std::cout << "Requesting " << ipcOptions.ToString() << std::endl;
+    
+    arrow::flight::Ticket flightTicket = flight_info->endpoints()[0].ticket;
+    if (!ticket.empty()) {
+        flightTicket.ticket = ticket;
+    }
+    
     std::unique_ptr<arrow::flight::FlightStreamReader> stream;
-    ARROW_ASSIGN_OR_RAISE(stream, client->DoGet(flight_info->endpoints()[0].ticket));
+    ARROW_ASSIGN_OR_RAISE(stream, client->DoGet(callOptions, flightTicket));
     std::shared_ptr<arrow::Table> table;
     
     ARROW_ASSIGN_OR_RAISE(table, stream->ToTable());
@@ -47,9 +95,9 @@ arrow::Status RunMain() {
     return arrow::Status::OK();
 }
 
-int main() {
+int main(int argc, char** argv) {
     arrow::dataset::internal::Initialize();
-    arrow::Status st = RunMain();
+    arrow::Status st = RunMain(argc, argv);
     if (!st.ok()) {
         std::cerr << st << std::endl;
         return 1;
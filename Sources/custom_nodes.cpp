@@ -0,0 +1,1176 @@
+//
+//  custom_nodes.cpp
+//  ArrowAcero
+//
+#import "custom_nodes.h"
+#import "nodes.h"
+#import "lookup.h"
+
+#include <cmath>
+#include <numeric>
+
+#include <arrow/acero/query_context.h>
+#include <arrow/compute/row/grouper.h>
+#include <arrow/util/hashing.h>
+#include <arrow/visit_data_inline.h>
+
+class WindowCombineNode : public ac::ExecNode, public ac::TracedNode {
+public:
+    WindowCombineNode(ac::ExecPlan* plan,
+                      std::vector<ac::ExecNode*> inputs,
+                      std::shared_ptr<arrow::Schema> output_schema,
+                      std::shared_ptr<arrow::Schema> window_schema,
+                      WindowCombineNodeOptions options,
+                      int pane_index,
+                      int64_t slide_ticks) :
+        ac::ExecNode(plan, std::move(inputs), {"input"}, std::move(output_schema)),
+        ac::TracedNode(this),
+        window_schema_(std::move(window_schema)),
+        options_(std::move(options)),
+        pane_index_(pane_index),
+        slide_ticks_(slide_ticks) {}
+    
+    static arrow::Result<ac::ExecNode*> Make(ac::ExecPlan* plan,
+                                             std::vector<ac::ExecNode*> inputs,
+                                             const ac::ExecNodeOptions& options) {
+        ARROW_RETURN_NOT_OK(ac::ValidateExecNodeInputs(plan, inputs, 1, "WindowCombineNode"));
+        const auto& window_options = arrow::internal::checked_cast<const WindowCombineNodeOptions&>(options);
+        
+        const std::shared_ptr<arrow::Schema>& input_schema = inputs[0]->output_schema();
+        int pane_index = input_schema->GetFieldIndex(window_options.paneColumn);
+        if (pane_index < 0) {
+            return arrow::Status::Invalid("Pane column ", window_options.paneColumn, " not found");
+        }
+        
+        const auto& pane_type = input_schema->field(pane_index)->type();
+        if (pane_type->id() != arrow::Type::TIMESTAMP) {
+            return arrow::Status::TypeError("Pane column must be a timestamp, got ", pane_type->ToString());
+        }
+        
+        int64_t nanos_per_tick = 1;
+        switch (arrow::internal::checked_cast<const arrow::TimestampType&>(*pane_type).unit()) {
+            case arrow::TimeUnit::SECOND: nanos_per_tick = 1000000000; break;
+            case arrow::TimeUnit::MILLI: nanos_per_tick = 1000000; break;
+            case arrow::TimeUnit::MICRO: nanos_per_tick = 1000; break;
+            case arrow::TimeUnit::NANO: nanos_per_tick = 1; break;
+        }
+        if (window_options.slide.count() <= 0 || window_options.slide.count() % nanos_per_tick != 0) {
+            return arrow::Status::Invalid("Window slide is not a multiple of the timestamp unit");
+        }
+        if (window_options.panes <= 0) {
+            return arrow::Status::Invalid("Window must span at least one pane");
+        }
+        
+        ARROW_ASSIGN_OR_RAISE(auto window_schema,
+                              input_schema->SetField(pane_index, arrow::field(window_options.windowColumn, pane_type)));
+        
+        ARROW_ASSIGN_OR_RAISE(auto empty, arrow::Table::MakeEmpty(window_schema));
+        ARROW_ASSIGN_OR_RAISE(auto output_schema, ac::DeclarationToSchema(MergeDeclaration(window_options, empty)));
+        
+        return plan->EmplaceNode<WindowCombineNode>(plan, std::move(inputs), std::move(output_schema),
+                                                    std::move(window_schema), window_options, pane_index,
+                                                    window_options.slide.count() / nanos_per_tick);
+    }
+    
+    const char* kind_name() const override { return "WindowCombineNode"; }
+    
+    arrow::Status InputReceived(ac::ExecNode* input, cp::ExecBatch batch) override {
+        NoteInputReceived(batch);
+        std::vector<std::shared_ptr<arrow::Table>> windows;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ARROW_RETURN_NOT_OK(AddPanes(batch));
+            if (options_.ordered) {
+                ARROW_RETURN_NOT_OK(TakeWindows(/*finished=*/false, &windows));
+            }
+        }
+        for (auto& window : windows) {
+            ARROW_RETURN_NOT_OK(EmitWindow(std::move(window)));
+        }
+        if (input_counter_.Increment()) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status InputFinished(ac::ExecNode* input, int total_batches) override {
+        if (input_counter_.SetTotal(total_batches)) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status StartProducing() override {
+        NoteStartProducing(ToStringExtra());
+        return arrow::Status::OK();
+    }
+    
+    void PauseProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->PauseProducing(this, counter);
+    }
+    
+    void ResumeProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->ResumeProducing(this, counter);
+    }
+    
+protected:
+    arrow::Status StopProducingImpl() override { return arrow::Status::OK(); }
+    
+private:
+    static ac::Declaration MergeDeclaration(const WindowCombineNodeOptions& options,
+                                            std::shared_ptr<arrow::Table> table) {
+        std::vector<arrow::FieldRef> keys(options.keys.begin(), options.keys.end());
+        keys.push_back(options.windowColumn);
+        
+        return ac::Declaration{
+            "aggregate", {TableSourceNode(std::move(table))}, ac::AggregateNodeOptions{options.merges, keys}};
+    }
+    
+    arrow::Status AddPanes(const cp::ExecBatch& batch) {
+        ARROW_ASSIGN_OR_RAISE(auto record_batch, batch.ToRecordBatch(inputs_[0]->output_schema()));
+        const arrow::Datum& pane = batch.values[pane_index_];
+        
+        if (pane.is_scalar()) {
+            if (!pane.scalar()->is_valid) {
+                return arrow::Status::OK();
+            }
+            int64_t value = arrow::internal::checked_cast<const arrow::TimestampScalar&>(*pane.scalar()).value;
+            return AddPane(value, std::move(record_batch));
+        }
+        
+        /*
+         * Split the batch by pane, rows without a timestamp belong to no window
+         */
+        const arrow::ArrayData& pane_data = *pane.array();
+        const int64_t* values = pane_data.GetValues<int64_t>(1);
+        std::map<int64_t, std::vector<int32_t>> pane_rows;
+        for (int64_t i = 0; i < pane_data.length; i++) {
+            if (pane_data.IsValid(i)) {
+                pane_rows[values[i]].push_back(static_cast<int32_t>(i));
+            }
+        }
+        
+        if (pane_rows.size() == 1 && pane_data.GetNullCount() == 0) {
+            return AddPane(pane_rows.begin()->first, std::move(record_batch));
+        }
+        
+        for (const auto& [value, rows] : pane_rows) {
+            arrow::Int32Builder indices_builder;
+            ARROW_RETURN_NOT_OK(indices_builder.AppendValues(rows));
+            ARROW_ASSIGN_OR_RAISE(auto indices, indices_builder.Finish());
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(record_batch, indices));
+            ARROW_RETURN_NOT_OK(AddPane(value, taken.record_batch()));
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status AddPane(int64_t pane, std::shared_ptr<arrow::RecordBatch> batch) {
+        if (options_.ordered && next_window_ && pane < *next_window_ + (options_.panes - 1) * slide_ticks_) {
+            return arrow::Status::Invalid("Window input is not ordered by time, pane ", pane,
+                                          " arrived after its windows were emitted");
+        }
+        panes_[pane].push_back(std::move(batch));
+        max_pane_ = std::max(max_pane_, pane);
+        return arrow::Status::OK();
+    }
+    
+    /*
+     * Takes the complete windows in time order. While streaming, a window
+     * is complete once a pane after its last pane has been seen.
+     */
+    arrow::Status TakeWindows(bool finished, std::vector<std::shared_ptr<arrow::Table>>* windows) {
+        if (panes_.empty()) {
+            return arrow::Status::OK();
+        }
+        const int64_t span = (options_.panes - 1) * slide_ticks_;
+        if (!next_window_) {
+            next_window_ = panes_.begin()->first - span;
+        }
+        
+        while (!panes_.empty()) {
+            int64_t window = *next_window_;
+            int64_t first_pane = panes_.begin()->first;
+            
+            // Skip gaps without any data
+            if (first_pane > window + span) {
+                next_window_ = first_pane - span;
+                continue;
+            }
+            if (!finished && window + span >= max_pane_) {
+                break;
+            }
+            
+            ARROW_ASSIGN_OR_RAISE(auto table, WindowTable(window));
+            windows->push_back(std::move(table));
+            next_window_ = window + slide_ticks_;
+            panes_.erase(panes_.begin(), panes_.lower_bound(*next_window_));
+        }
+        return arrow::Status::OK();
+    }
+    
+    // Rows of the panes of window, the pane column set to the window start
+    arrow::Result<std::shared_ptr<arrow::Table>> WindowTable(int64_t window) {
+        auto window_start = arrow::TimestampScalar(window, window_schema_->field(pane_index_)->type());
+        
+        std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+        auto end = panes_.lower_bound(window + options_.panes * slide_ticks_);
+        for (auto pane = panes_.lower_bound(window); pane != end; ++pane) {
+            for (const auto& batch : pane->second) {
+                ARROW_ASSIGN_OR_RAISE(auto column, arrow::MakeArrayFromScalar(window_start, batch->num_rows()));
+                ARROW_ASSIGN_OR_RAISE(auto window_batch,
+                                      batch->SetColumn(pane_index_, window_schema_->field(pane_index_), column));
+                batches.push_back(std::move(window_batch));
+            }
+        }
+        
+        return arrow::Table::FromRecordBatches(window_schema_, batches);
+    }
+    
+    /* Merges and emits a window without holding the lock, other inputs keep adding panes meanwhile */
+    arrow::Status EmitWindow(std::shared_ptr<arrow::Table> table) {
+        ARROW_ASSIGN_OR_RAISE(auto merged, ac::DeclarationToExecBatches(MergeDeclaration(options_, std::move(table)),
+                                                                        /*use_threads=*/false));
+        for (auto& batch : merged.batches) {
+            ARROW_RETURN_NOT_OK(output_->InputReceived(this, std::move(batch)));
+            batches_emitted_++;
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Finish() {
+        std::vector<std::shared_ptr<arrow::Table>> windows;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ARROW_RETURN_NOT_OK(TakeWindows(/*finished=*/true, &windows));
+        }
+        for (auto& window : windows) {
+            ARROW_RETURN_NOT_OK(EmitWindow(std::move(window)));
+        }
+        return output_->InputFinished(this, batches_emitted_.load());
+    }
+    
+    std::shared_ptr<arrow::Schema> window_schema_;
+    WindowCombineNodeOptions options_;
+    int pane_index_;
+    int64_t slide_ticks_;
+    
+    std::mutex mutex_;
+    std::map<int64_t, std::vector<std::shared_ptr<arrow::RecordBatch>>> panes_;
+    std::optional<int64_t> next_window_;
+    int64_t max_pane_ = std::numeric_limits<int64_t>::min();
+    std::atomic<int> batches_emitted_{0};
+    ac::AtomicCounter input_counter_;
+};
+
+static bool IsNaN(const arrow::Scalar& scalar) {
+    switch (scalar.type->id()) {
+        case arrow::Type::FLOAT:
+            return std::isnan(arrow::internal::checked_cast<const arrow::FloatScalar&>(scalar).value);
+        case arrow::Type::DOUBLE:
+            return std::isnan(arrow::internal::checked_cast<const arrow::DoubleScalar&>(scalar).value);
+        default:
+            return false;
+    }
+}
+
+/*
+ * The current top k rows of every partition, each in selection order
+ */
+class TopKState {
+public:
+    explicit TopKState(const TopKNodeOptions& options) : options_(options) {}
+    
+    arrow::Status Add(const std::shared_ptr<arrow::RecordBatch>& batch) {
+        if (options_.partitionKeys.empty()) {
+            tops_.resize(1);
+            return Merge(0, batch);
+        }
+        
+        std::vector<arrow::Datum> keys;
+        std::vector<arrow::TypeHolder> key_types;
+        for (const auto& key : options_.partitionKeys) {
+            keys.push_back(batch->GetColumnByName(key));
+            key_types.push_back(keys.back().type());
+        }
+        if (!grouper_) {
+            ARROW_ASSIGN_OR_RAISE(grouper_, cp::Grouper::Make(key_types));
+        }
+        
+        cp::ExecBatch key_batch(std::move(keys), batch->num_rows());
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum ids, grouper_->Consume(cp::ExecSpan(key_batch)));
+        
+        uint32_t num_groups = grouper_->num_groups();
+        tops_.resize(num_groups);
+        ARROW_ASSIGN_OR_RAISE(auto groupings, cp::Grouper::MakeGroupings(*ids.array_as<arrow::UInt32Array>(), num_groups));
+        
+        for (uint32_t group = 0; group < num_groups; group++) {
+            std::shared_ptr<arrow::Array> rows = groupings->value_slice(group);
+            if (rows->length() == 0) {
+                continue;
+            }
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(batch, rows));
+            ARROW_RETURN_NOT_OK(Merge(group, taken.record_batch()));
+        }
+        return arrow::Status::OK();
+    }
+    
+    /* The candidates of all partitions */
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches() const {
+        std::vector<std::shared_ptr<arrow::RecordBatch>> result;
+        for (const auto& top : tops_) {
+            if (top) {
+                result.push_back(top);
+            }
+        }
+        return result;
+    }
+    
+private:
+    arrow::Status Merge(uint32_t group, std::shared_ptr<arrow::RecordBatch> batch) {
+        std::shared_ptr<arrow::RecordBatch>& top = tops_[group];
+        
+        /*
+         * Once k rows are kept, only rows beyond the current k-th value
+         * can enter, which drops most of the input with one comparison.
+         * Nulls and NaNs are selected last, while the top still holds
+         * some every valid row can replace them.
+         */
+        if (top && top->num_rows() >= options_.k) {
+            std::shared_ptr<arrow::Array> column = top->GetColumnByName(options_.sortColumn);
+            ARROW_ASSIGN_OR_RAISE(auto kth, column->GetScalar(top->num_rows() - 1));
+            if (column->null_count() == 0 && !IsNaN(*kth)) {
+                const char* compare = options_.order == cp::SortOrder::Descending ? "greater" : "less";
+                ARROW_ASSIGN_OR_RAISE(arrow::Datum mask, cp::CallFunction(compare, {batch->GetColumnByName(options_.sortColumn), kth}));
+                ARROW_ASSIGN_OR_RAISE(arrow::Datum filtered, cp::Filter(batch, mask));
+                batch = filtered.record_batch();
+                if (batch->num_rows() == 0) {
+                    return arrow::Status::OK();
+                }
+            }
+        }
+        
+        std::vector<std::shared_ptr<arrow::RecordBatch>> candidates = {batch};
+        if (top) {
+            candidates.push_back(top);
+        }
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(batch->schema(), candidates));
+        
+        cp::SelectKOptions select_options(options_.k, {cp::SortKey(options_.sortColumn, options_.order)});
+        ARROW_ASSIGN_OR_RAISE(auto indices, cp::SelectKUnstable(table, select_options));
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum selected, cp::Take(table, indices));
+        ARROW_ASSIGN_OR_RAISE(top, selected.table()->CombineChunksToBatch());
+        
+        return arrow::Status::OK();
+    }
+    
+    const TopKNodeOptions& options_;
+    std::unique_ptr<cp::Grouper> grouper_;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> tops_;
+};
+
+class TopKNode : public ac::ExecNode, public ac::TracedNode {
+public:
+    TopKNode(ac::ExecPlan* plan,
+             std::vector<ac::ExecNode*> inputs,
+             TopKNodeOptions options) :
+        ac::ExecNode(plan, inputs, {"input"}, inputs[0]->output_schema()),
+        ac::TracedNode(this),
+        options_(std::move(options)) {}
+    
+    static arrow::Result<ac::ExecNode*> Make(ac::ExecPlan* plan,
+                                             std::vector<ac::ExecNode*> inputs,
+                                             const ac::ExecNodeOptions& options) {
+        ARROW_RETURN_NOT_OK(ac::ValidateExecNodeInputs(plan, inputs, 1, "TopKNode"));
+        const auto& topk_options = arrow::internal::checked_cast<const TopKNodeOptions&>(options);
+        
+        if (topk_options.k <= 0) {
+            return arrow::Status::Invalid("TopKNode needs k > 0, got ", topk_options.k);
+        }
+        const std::shared_ptr<arrow::Schema>& input_schema = inputs[0]->output_schema();
+        for (const auto& column : topk_options.partitionKeys) {
+            if (input_schema->GetFieldIndex(column) < 0) {
+                return arrow::Status::Invalid("Partition key ", column, " not found");
+            }
+        }
+        if (input_schema->GetFieldIndex(topk_options.sortColumn) < 0) {
+            return arrow::Status::Invalid("Sort column ", topk_options.sortColumn, " not found");
+        }
+        
+        return plan->EmplaceNode<TopKNode>(plan, std::move(inputs), topk_options);
+    }
+    
+    const char* kind_name() const override { return "TopKNode"; }
+    
+    arrow::Status InputReceived(ac::ExecNode* input, cp::ExecBatch batch) override {
+        NoteInputReceived(batch);
+        
+        ARROW_ASSIGN_OR_RAISE(auto record_batch, batch.ToRecordBatch(inputs_[0]->output_schema()));
+        ARROW_ASSIGN_OR_RAISE(TopKState* state, ThreadState());
+        ARROW_RETURN_NOT_OK(state->Add(record_batch));
+        
+        if (input_counter_.Increment()) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status InputFinished(ac::ExecNode* input, int total_batches) override {
+        if (input_counter_.SetTotal(total_batches)) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status StartProducing() override {
+        NoteStartProducing(ToStringExtra());
+        return arrow::Status::OK();
+    }
+    
+    void PauseProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->PauseProducing(this, counter);
+    }
+    
+    void ResumeProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->ResumeProducing(this, counter);
+    }
+    
+protected:
+    arrow::Status StopProducingImpl() override { return arrow::Status::OK(); }
+    
+    std::string ToStringExtra(int indent = 0) const override {
+        return "k=" + std::to_string(options_.k) + ", column=" + options_.sortColumn;
+    }
+    
+private:
+    /* Every thread gets its own state, batches of one thread never race */
+    arrow::Result<TopKState*> ThreadState() {
+        size_t index = thread_indexer_();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (states_.size() <= index) {
+            states_.resize(index + 1);
+        }
+        if (!states_[index]) {
+            states_[index] = std::make_unique<TopKState>(options_);
+        }
+        return states_[index].get();
+    }
+    
+    /*
+     * Merges the candidates of all threads and emits them sorted,
+     * by partition first
+     */
+    arrow::Status Finish() {
+        TopKState merged(options_);
+        for (const auto& state : states_) {
+            if (!state) {
+                continue;
+            }
+            for (const auto& batch : state->batches()) {
+                ARROW_RETURN_NOT_OK(merged.Add(batch));
+            }
+        }
+        
+        std::vector<std::shared_ptr<arrow::RecordBatch>> batches = merged.batches();
+        if (batches.empty()) {
+            return output_->InputFinished(this, 0);
+        }
+        
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(output_schema_, batches));
+        
+        std::vector<cp::SortKey> sort_keys;
+        for (const auto& key : options_.partitionKeys) {
+            sort_keys.emplace_back(key);
+        }
+        sort_keys.emplace_back(options_.sortColumn, options_.order);
+        
+        ARROW_ASSIGN_OR_RAISE(auto indices, cp::SortIndices(table, cp::SortOptions(sort_keys)));
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum sorted, cp::Take(table, indices));
+        ARROW_ASSIGN_OR_RAISE(auto result, sorted.table()->CombineChunksToBatch());
+        
+        ARROW_RETURN_NOT_OK(output_->InputReceived(this, cp::ExecBatch(*result)));
+        return output_->InputFinished(this, 1);
+    }
+    
+    TopKNodeOptions options_;
+    
+    ac::ThreadIndexer thread_indexer_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<TopKState>> states_;
+    ac::AtomicCounter input_counter_;
+};
+
+/* Splits nested and / and_kleene calls, a row passes if every part is true */
+static void FlattenConjunction(const cp::Expression& expression, std::vector<cp::Expression>* conjuncts) {
+    const cp::Expression::Call* call = expression.call();
+    if (call != nullptr && (call->function_name == "and_kleene" || call->function_name == "and")) {
+        for (const auto& argument : call->arguments) {
+            FlattenConjunction(argument, conjuncts);
+        }
+        return;
+    }
+    conjuncts->push_back(expression);
+}
+
+class AdaptiveFilterNode : public ac::MapNode {
+public:
+    struct Conjunct {
+        cp::Expression expression;
+        // Input columns the expression references
+        std::vector<int> columns;
+    };
+    
+    AdaptiveFilterNode(ac::ExecPlan* plan,
+                       std::vector<ac::ExecNode*> inputs,
+                       std::vector<Conjunct> conjuncts,
+                       int sampleEvery,
+                       int64_t sampleRows) :
+        ac::MapNode(plan, inputs, inputs[0]->output_schema()),
+        conjuncts_(std::move(conjuncts)),
+        sample_every_(sampleEvery),
+        sample_rows_(sampleRows),
+        stats_(conjuncts_.size()) {
+        for (size_t i = 0; i < conjuncts_.size(); i++) {
+            order_.push_back(i);
+        }
+        for (const auto& field : output_schema_->fields()) {
+            null_columns_.emplace_back(arrow::MakeNullScalar(field->type()));
+        }
+    }
+    
+    static arrow::Result<ac::ExecNode*> Make(ac::ExecPlan* plan,
+                                             std::vector<ac::ExecNode*> inputs,
+                                             const ac::ExecNodeOptions& options) {
+        ARROW_RETURN_NOT_OK(ac::ValidateExecNodeInputs(plan, inputs, 1, "AdaptiveFilterNode"));
+        const auto& filter_options = arrow::internal::checked_cast<const AdaptiveFilterNodeOptions&>(options);
+        
+        if (filter_options.sampleEvery <= 0 || filter_options.sampleRows <= 0) {
+            return arrow::Status::Invalid("AdaptiveFilterNode needs sampleEvery > 0 and sampleRows > 0");
+        }
+        
+        std::vector<cp::Expression> flattened;
+        for (const auto& conjunct : filter_options.conjuncts) {
+            FlattenConjunction(conjunct, &flattened);
+        }
+        if (flattened.empty()) {
+            return arrow::Status::Invalid("AdaptiveFilterNode needs at least one conjunct");
+        }
+        
+        const std::shared_ptr<arrow::Schema>& input_schema = inputs[0]->output_schema();
+        std::vector<Conjunct> conjuncts;
+        for (const auto& expression : flattened) {
+            Conjunct conjunct;
+            ARROW_ASSIGN_OR_RAISE(conjunct.expression, expression.Bind(*input_schema, plan->query_context()->exec_context()));
+            if (conjunct.expression.type()->id() != arrow::Type::BOOL) {
+                return arrow::Status::TypeError("Filter conjunct ", expression.ToString(), " is not boolean");
+            }
+            for (const auto& ref : cp::FieldsInExpression(conjunct.expression)) {
+                ARROW_ASSIGN_OR_RAISE(arrow::FieldPath path, ref.FindOne(*input_schema));
+                conjunct.columns.push_back(path[0]);
+            }
+            std::sort(conjunct.columns.begin(), conjunct.columns.end());
+            conjunct.columns.erase(std::unique(conjunct.columns.begin(), conjunct.columns.end()), conjunct.columns.end());
+            conjuncts.push_back(std::move(conjunct));
+        }
+        
+        return plan->EmplaceNode<AdaptiveFilterNode>(plan, std::move(inputs), std::move(conjuncts),
+                                                     filter_options.sampleEvery, filter_options.sampleRows);
+    }
+    
+    const char* kind_name() const override { return "AdaptiveFilterNode"; }
+    
+protected:
+    std::string ToStringExtra(int indent = 0) const override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string conjuncts;
+        for (size_t i : order_) {
+            conjuncts += (conjuncts.empty() ? "" : ", ") + conjuncts_[i].expression.ToString();
+        }
+        return "conjuncts=[" + conjuncts + "]";
+    }
+    
+    arrow::Result<cp::ExecBatch> ProcessBatch(cp::ExecBatch batch) override {
+        if (batches_.fetch_add(1) % sample_every_ == 0) {
+            ARROW_RETURN_NOT_OK(Sample(batch));
+        }
+        
+        std::vector<size_t> order;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            order = order_;
+        }
+        
+        cp::ExecContext* ctx = plan()->query_context()->exec_context();
+        
+        // Rows of the batch that passed so far, all rows while null
+        std::shared_ptr<arrow::Array> selection;
+        int64_t selected = batch.length;
+        
+        for (size_t i : order) {
+            if (selected == 0) {
+                break;
+            }
+            ARROW_ASSIGN_OR_RAISE(cp::ExecBatch input, Gather(batch, conjuncts_[i].columns, selection, selected));
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum mask, cp::ExecuteScalarExpression(conjuncts_[i].expression, input, ctx));
+            
+            if (mask.is_scalar()) {
+                const auto& passed = arrow::internal::checked_cast<const arrow::BooleanScalar&>(*mask.scalar());
+                if (!passed.is_valid || !passed.value) {
+                    selected = 0;
+                }
+                continue;
+            }
+            
+            if (selection) {
+                ARROW_ASSIGN_OR_RAISE(arrow::Datum filtered, cp::Filter(selection, mask, cp::FilterOptions::Defaults(), ctx));
+                selection = filtered.make_array();
+            } else {
+                ARROW_ASSIGN_OR_RAISE(arrow::Datum indices, cp::CallFunction("indices_nonzero", {mask}, ctx));
+                selection = indices.make_array();
+            }
+            selected = selection->length();
+        }
+        
+        if (selected == 0) {
+            return batch.Slice(0, 0);
+        }
+        if (!selection) {
+            return batch;
+        }
+        
+        /* All columns are gathered once, for the rows that passed every conjunct */
+        std::vector<int> columns(batch.num_values());
+        std::iota(columns.begin(), columns.end(), 0);
+        ARROW_ASSIGN_OR_RAISE(cp::ExecBatch output, Gather(batch, columns, selection, selected));
+        output.guarantee = batch.guarantee;
+        return output;
+    }
+    
+private:
+    struct ConjunctStats {
+        double cost_per_row = 0;
+        double pass_rate = 1;
+        bool sampled = false;
+    };
+    
+    /* Columns not in `columns` are replaced by null scalars */
+    arrow::Result<cp::ExecBatch> Gather(const cp::ExecBatch& batch,
+                                        const std::vector<int>& columns,
+                                        const std::shared_ptr<arrow::Array>& selection,
+                                        int64_t length) {
+        std::vector<arrow::Datum> values = null_columns_;
+        for (int column : columns) {
+            if (!selection || batch[column].is_scalar()) {
+                values[column] = batch[column];
+            } else {
+                ARROW_ASSIGN_OR_RAISE(values[column], cp::Take(batch[column], selection, cp::TakeOptions::NoBoundsCheck(),
+                                                               plan()->query_context()->exec_context()));
+            }
+        }
+        return cp::ExecBatch(std::move(values), length);
+    }
+    
+    /*
+     * Measures every conjunct on the leading rows of the batch and orders
+     * them by cost per removed row, cheap and selective conjuncts first
+     */
+    arrow::Status Sample(const cp::ExecBatch& batch) {
+        cp::ExecBatch sample = batch.Slice(0, std::min(batch.length, sample_rows_));
+        if (sample.length == 0) {
+            return arrow::Status::OK();
+        }
+        
+        std::vector<ConjunctStats> measured(conjuncts_.size());
+        for (size_t i = 0; i < conjuncts_.size(); i++) {
+            auto start = std::chrono::steady_clock::now();
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum mask, cp::ExecuteScalarExpression(conjuncts_[i].expression, sample,
+                                                                                  plan()->query_context()->exec_context()));
+            auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            
+            int64_t passed;
+            if (mask.is_scalar()) {
+                const auto& scalar = arrow::internal::checked_cast<const arrow::BooleanScalar&>(*mask.scalar());
+                passed = scalar.is_valid && scalar.value ? sample.length : 0;
+            } else {
+                passed = arrow::BooleanArray(mask.array()).true_count();
+            }
+            
+            measured[i].cost_per_row = static_cast<double>(nanos) / sample.length;
+            measured[i].pass_rate = static_cast<double>(passed) / sample.length;
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < conjuncts_.size(); i++) {
+            ConjunctStats& stats = stats_[i];
+            // Smooth over samples so one odd batch does not flip the order
+            double weight = stats.sampled ? 0.5 : 1.0;
+            stats.cost_per_row += weight * (measured[i].cost_per_row - stats.cost_per_row);
+            stats.pass_rate += weight * (measured[i].pass_rate - stats.pass_rate);
+            stats.sampled = true;
+        }
+        
+        auto rank = [this](size_t i) {
+            return stats_[i].cost_per_row / std::max(1.0 - stats_[i].pass_rate, 1e-3);
+        };
+        std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b) { return rank(a) < rank(b); });
+        return arrow::Status::OK();
+    }
+    
+    std::vector<Conjunct> conjuncts_;
+    int sample_every_;
+    int64_t sample_rows_;
+    std::vector<arrow::Datum> null_columns_;
+    
+    std::atomic<int64_t> batches_{0};
+    mutable std::mutex mutex_;
+    std::vector<ConjunctStats> stats_;
+    std::vector<size_t> order_;
+};
+
+class LookupJoinNode : public ac::MapNode {
+public:
+    LookupJoinNode(ac::ExecPlan* plan,
+                   std::vector<ac::ExecNode*> inputs,
+                   std::shared_ptr<arrow::Schema> output_schema,
+                   std::shared_ptr<const LookupTable> table,
+                   int keyIndex,
+                   std::vector<std::shared_ptr<arrow::Array>> values) :
+        ac::MapNode(plan, inputs, std::move(output_schema)),
+        table_(std::move(table)),
+        key_index_(keyIndex),
+        values_(std::move(values)) {}
+    
+    static arrow::Result<ac::ExecNode*> Make(ac::ExecPlan* plan,
+                                             std::vector<ac::ExecNode*> inputs,
+                                             const ac::ExecNodeOptions& options) {
+        ARROW_RETURN_NOT_OK(ac::ValidateExecNodeInputs(plan, inputs, 1, "LookupJoinNode"));
+        const auto& join_options = arrow::internal::checked_cast<const LookupJoinNodeOptions&>(options);
+        
+        if (!join_options.table) {
+            return arrow::Status::Invalid("LookupJoinNode needs a lookup table");
+        }
+        
+        const std::shared_ptr<arrow::Schema>& input_schema = inputs[0]->output_schema();
+        ARROW_ASSIGN_OR_RAISE(arrow::FieldPath key_path, arrow::FieldRef(join_options.keyColumn).FindOne(*input_schema));
+        
+        std::vector<std::string> value_columns = join_options.valueColumns;
+        if (value_columns.empty()) {
+            for (const auto& field : join_options.table->schema()->fields()) {
+                if (field->name() != join_options.table->key_column()) {
+                    value_columns.push_back(field->name());
+                }
+            }
+        }
+        
+        arrow::FieldVector fields = input_schema->fields();
+        std::vector<std::shared_ptr<arrow::Array>> values;
+        for (const auto& column : value_columns) {
+            ARROW_ASSIGN_OR_RAISE(auto array, join_options.table->column(column));
+            std::string name = join_options.prefix + column;
+            if (input_schema->GetFieldIndex(name) >= 0) {
+                return arrow::Status::Invalid("Lookup column '", name, "' is already in the input, use a prefix");
+            }
+            fields.push_back(arrow::field(name, array->type()));
+            values.push_back(std::move(array));
+        }
+        
+        return plan->EmplaceNode<LookupJoinNode>(plan, std::move(inputs), arrow::schema(std::move(fields)),
+                                                 join_options.table, key_path[0], std::move(values));
+    }
+    
+    const char* kind_name() const override { return "LookupJoinNode"; }
+    
+protected:
+    std::string ToStringExtra(int indent = 0) const override {
+        return "key=" + output_schema_->field(key_index_)->name() + " lookup_rows=" + std::to_string(table_->num_rows());
+    }
+    
+    arrow::Result<cp::ExecBatch> ProcessBatch(cp::ExecBatch batch) override {
+        cp::ExecContext* ctx = plan()->query_context()->exec_context();
+        
+        std::shared_ptr<arrow::Array> keys;
+        if (batch[key_index_].is_scalar()) {
+            ARROW_ASSIGN_OR_RAISE(keys, arrow::MakeArrayFromScalar(*batch[key_index_].scalar(), batch.length, ctx->memory_pool()));
+        } else {
+            keys = batch[key_index_].make_array();
+        }
+        
+        /* The table is read only, batches of all threads probe it without locking */
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Array> rows, table_->Probe(*keys, ctx->memory_pool()));
+        
+        for (const auto& values : values_) {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(values, rows, cp::TakeOptions::NoBoundsCheck(), ctx));
+            batch.values.push_back(std::move(taken));
+        }
+        return batch;
+    }
+    
+private:
+    std::shared_ptr<const LookupTable> table_;
+    int key_index_;
+    std::vector<std::shared_ptr<arrow::Array>> values_;
+};
+
+static uint64_t MixSampleHash(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Uniform in [0, 1) from the top 53 bits */
+static double SampleHashToUnit(uint64_t hash) {
+    return static_cast<double>(hash >> 11) * 0x1.0p-53;
+}
+
+/* Folds the hash of every value of column into hashes, equal values hash equally in every batch */
+static arrow::Status CombineKeyHashes(const arrow::Datum& column, int64_t length, std::vector<uint64_t>* hashes) {
+    std::shared_ptr<arrow::Array> array;
+    if (column.is_scalar()) {
+        ARROW_ASSIGN_OR_RAISE(array, arrow::MakeArrayFromScalar(*column.scalar(), length));
+    } else {
+        array = column.make_array();
+    }
+    if (array->type_id() == arrow::Type::DICTIONARY) {
+        const auto& type = arrow::internal::checked_cast<const arrow::DictionaryType&>(*array->type());
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum decoded, cp::Cast(array, type.value_type()));
+        array = decoded.make_array();
+    }
+    
+    int64_t i = 0;
+    auto combine = [&](uint64_t hash) {
+        (*hashes)[i] = MixSampleHash((*hashes)[i] ^ hash);
+        i++;
+    };
+    auto visit_string = [&](std::string_view value) {
+        combine(arrow::internal::ComputeStringHash<0>(value.data(), static_cast<int64_t>(value.size())));
+    };
+    auto visit_null = [&]() { combine(0); };
+    
+    const arrow::ArraySpan span(*array->data());
+    switch (array->type_id()) {
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            arrow::VisitArraySpanInline<arrow::StringType>(span, visit_string, visit_null);
+            return arrow::Status::OK();
+        case arrow::Type::LARGE_STRING:
+        case arrow::Type::LARGE_BINARY:
+            arrow::VisitArraySpanInline<arrow::LargeStringType>(span, visit_string, visit_null);
+            return arrow::Status::OK();
+        case arrow::Type::STRING_VIEW:
+        case arrow::Type::BINARY_VIEW:
+            arrow::VisitArraySpanInline<arrow::StringViewType>(span, visit_string, visit_null);
+            return arrow::Status::OK();
+        default:
+            break;
+    }
+    
+    int bit_width = array->type()->byte_width() * 8;
+    if (!arrow::is_fixed_width(array->type_id()) || bit_width <= 0 || array->type_id() == arrow::Type::BOOL) {
+        return arrow::Status::NotImplemented("Hash sampling on ", array->type()->ToString(), " keys");
+    }
+    int byte_width = bit_width / 8;
+    const uint8_t* values = span.buffers[1].data + span.offset * byte_width;
+    for (int64_t row = 0; row < span.length; row++) {
+        if (span.IsNull(row)) {
+            visit_null();
+        } else {
+            combine(arrow::internal::ComputeStringHash<0>(values + row * byte_width, byte_width));
+        }
+    }
+    return arrow::Status::OK();
+}
+
+/* The rows of batch at indices, scalars stay scalars */
+static arrow::Result<cp::ExecBatch> TakeRows(const cp::ExecBatch& batch,
+                                             const std::shared_ptr<arrow::Array>& indices,
+                                             cp::ExecContext* ctx) {
+    std::vector<arrow::Datum> values;
+    values.reserve(batch.num_values());
+    for (const auto& value : batch.values) {
+        if (value.is_scalar()) {
+            values.push_back(value);
+        } else {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(value, indices, cp::TakeOptions::NoBoundsCheck(), ctx));
+            values.push_back(std::move(taken));
+        }
+    }
+    return cp::ExecBatch(std::move(values), indices->length());
+}
+
+/*
+ * Bernoulli and hash sampling, batch by batch. Bernoulli draws the gaps
+ * between kept rows from a geometric distribution instead of a number
+ * per row.
+ */
+class RowSampleNode : public ac::MapNode {
+public:
+    RowSampleNode(ac::ExecPlan* plan,
+                  std::vector<ac::ExecNode*> inputs,
+                  SampleNodeOptions options,
+                  std::vector<int> keys) :
+        ac::MapNode(plan, inputs, inputs[0]->output_schema()),
+        options_(std::move(options)),
+        keys_(std::move(keys)) {}
+    
+    const char* kind_name() const override { return "RowSampleNode"; }
+    
+protected:
+    std::string ToStringExtra(int indent = 0) const override {
+        return std::string(options_.method == SampleMethod::HASH ? "hash" : "bernoulli") +
+            " fraction=" + std::to_string(options_.fraction);
+    }
+    
+    arrow::Result<cp::ExecBatch> ProcessBatch(cp::ExecBatch batch) override {
+        if (options_.fraction >= 1.0) {
+            return batch;
+        }
+        
+        arrow::Int64Builder indices;
+        
+        if (options_.method == SampleMethod::HASH) {
+            std::vector<uint64_t> hashes(batch.length, options_.seed);
+            for (int key : keys_) {
+                ARROW_RETURN_NOT_OK(CombineKeyHashes(batch[key], batch.length, &hashes));
+            }
+            for (int64_t row = 0; row < batch.length; row++) {
+                if (SampleHashToUnit(hashes[row]) < options_.fraction) {
+                    ARROW_RETURN_NOT_OK(indices.Append(row));
+                }
+            }
+        } else {
+            std::mt19937_64 rng(MixSampleHash(options_.seed ^ MixSampleHash(batches_.fetch_add(1))));
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            const double log_miss = std::log1p(-options_.fraction);
+            
+            auto gap = [&]() {
+                return static_cast<int64_t>(std::floor(std::log(1.0 - uniform(rng)) / log_miss));
+            };
+            for (int64_t row = gap(); row < batch.length; row += 1 + gap()) {
+                ARROW_RETURN_NOT_OK(indices.Append(row));
+            }
+        }
+        
+        ARROW_ASSIGN_OR_RAISE(auto selected, indices.Finish());
+        if (selected->length() == batch.length) {
+            return batch;
+        }
+        return TakeRows(batch, selected, plan()->query_context()->exec_context());
+    }
+    
+private:
+    SampleNodeOptions options_;
+    std::vector<int> keys_;
+    std::atomic<uint64_t> batches_{0};
+};
+
+/*
+ * Reservoir sampling with Algorithm L: after the reservoir is full the
+ * next replaced row is drawn directly, so only O(k log(n/k)) rows are
+ * ever copied. Kept rows are taken out of their batch right away and
+ * compacted into one batch now and then, input batches are not held.
+ */
+class ReservoirSampleNode : public ac::ExecNode, public ac::TracedNode {
+public:
+    ReservoirSampleNode(ac::ExecPlan* plan,
+                        std::vector<ac::ExecNode*> inputs,
+                        SampleNodeOptions options) :
+        ac::ExecNode(plan, inputs, {"input"}, inputs[0]->output_schema()),
+        ac::TracedNode(this),
+        options_(std::move(options)),
+        rng_(MixSampleHash(options_.seed)) {}
+    
+    const char* kind_name() const override { return "ReservoirSampleNode"; }
+    
+    arrow::Status InputReceived(ac::ExecNode* input, cp::ExecBatch batch) override {
+        NoteInputReceived(batch);
+        ARROW_RETURN_NOT_OK(Add(batch));
+        
+        if (input_counter_.Increment()) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status InputFinished(ac::ExecNode* input, int total_batches) override {
+        if (input_counter_.SetTotal(total_batches)) {
+            return Finish();
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status StartProducing() override {
+        NoteStartProducing(ToStringExtra());
+        return arrow::Status::OK();
+    }
+    
+    void PauseProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->PauseProducing(this, counter);
+    }
+    
+    void ResumeProducing(ac::ExecNode* output, int32_t counter) override {
+        inputs_[0]->ResumeProducing(this, counter);
+    }
+    
+protected:
+    arrow::Status StopProducingImpl() override { return arrow::Status::OK(); }
+    
+    std::string ToStringExtra(int indent = 0) const override {
+        return "reservoir=" + std::to_string(options_.reservoirSize);
+    }
+    
+private:
+    static constexpr size_t kMaxParts = 64;
+    
+    double Uniform() {
+        // (0, 1], log() of it is finite
+        return 1.0 - std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
+    }
+    
+    void AdvanceNext() {
+        w_ *= std::exp(std::log(Uniform()) / options_.reservoirSize);
+        next_ += 1 + static_cast<int64_t>(std::floor(std::log(Uniform()) / std::log1p(-w_)));
+    }
+    
+    arrow::Status Add(const cp::ExecBatch& batch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const int64_t k = options_.reservoirSize;
+        
+        arrow::Int64Builder rows;
+        std::vector<int64_t> targets;
+        
+        int64_t row = 0;
+        for (; row < batch.length && seen_ + row < k; row++) {
+            ARROW_RETURN_NOT_OK(rows.Append(row));
+            targets.push_back(seen_ + row);
+        }
+        if (seen_ + row == k && next_ < k) {
+            w_ = 1.0;
+            next_ = k - 1;
+            AdvanceNext();
+        }
+        while (next_ >= k && next_ < seen_ + batch.length) {
+            ARROW_RETURN_NOT_OK(rows.Append(next_ - seen_));
+            targets.push_back(static_cast<int64_t>(rng_() % static_cast<uint64_t>(k)));
+            AdvanceNext();
+        }
+        seen_ += batch.length;
+        
+        if (targets.empty()) {
+            return arrow::Status::OK();
+        }
+        
+        ARROW_ASSIGN_OR_RAISE(auto indices, rows.Finish());
+        ARROW_ASSIGN_OR_RAISE(cp::ExecBatch taken, TakeRows(batch, indices, plan()->query_context()->exec_context()));
+        ARROW_ASSIGN_OR_RAISE(auto part, taken.ToRecordBatch(output_schema_));
+        
+        slots_.resize(std::max<size_t>(slots_.size(), std::min<int64_t>(k, seen_)));
+        int part_index = static_cast<int>(parts_.size());
+        for (size_t i = 0; i < targets.size(); i++) {
+            slots_[targets[i]] = {part_index, static_cast<int64_t>(i)};
+        }
+        parts_.push_back(std::move(part));
+        
+        if (parts_.size() > kMaxParts) {
+            ARROW_RETURN_NOT_OK(Compact());
+        }
+        return arrow::Status::OK();
+    }
+    
+    /* Gathers the current reservoir into a single part */
+    arrow::Status Compact() {
+        std::vector<int64_t> part_starts;
+        int64_t start = 0;
+        for (const auto& part : parts_) {
+            part_starts.push_back(start);
+            start += part->num_rows();
+        }
+        
+        arrow::Int64Builder indices;
+        ARROW_RETURN_NOT_OK(indices.Reserve(slots_.size()));
+        for (const auto& slot : slots_) {
+            indices.UnsafeAppend(part_starts[slot.first] + slot.second);
+        }
+        ARROW_ASSIGN_OR_RAISE(auto index_array, indices.Finish());
+        
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(output_schema_, parts_));
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(table, index_array));
+        ARROW_ASSIGN_OR_RAISE(auto compacted, taken.table()->CombineChunksToBatch());
+        
+        parts_ = {std::move(compacted)};
+        for (size_t i = 0; i < slots_.size(); i++) {
+            slots_[i] = {0, static_cast<int64_t>(i)};
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Finish() {
+        std::shared_ptr<arrow::RecordBatch> sample;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (slots_.empty()) {
+                return output_->InputFinished(this, 0);
+            }
+            ARROW_RETURN_NOT_OK(Compact());
+            sample = parts_[0];
+        }
+        
+        ARROW_RETURN_NOT_OK(output_->InputReceived(this, cp::ExecBatch(*sample)));
+        return output_->InputFinished(this, 1);
+    }
+    
+    SampleNodeOptions options_;
+    
+    std::mutex mutex_;
+    std::mt19937_64 rng_;
+    // Rows received so far
+    int64_t seen_ = 0;
+    // Next row (counted over all batches) that replaces a reservoir row
+    int64_t next_ = 0;
+    double w_ = 1.0;
+    // Reservoir rows as (part, row in part)
+    std::vector<std::pair<int, int64_t>> slots_;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> parts_;
+    ac::AtomicCounter input_counter_;
+};
+
+static arrow::Result<ac::ExecNode*> MakeSampleNode(ac::ExecPlan* plan,
+                                                   std::vector<ac::ExecNode*> inputs,
+                                                   const ac::ExecNodeOptions& options) {
+    ARROW_RETURN_NOT_OK(ac::ValidateExecNodeInputs(plan, inputs, 1, "SampleNode"));
+    const auto& sample_options = arrow::internal::checked_cast<const SampleNodeOptions&>(options);
+    
+    if (sample_options.method == SampleMethod::RESERVOIR) {
+        if (sample_options.reservoirSize <= 0) {
+            return arrow::Status::Invalid("Reservoir sampling needs reservoirSize > 0");
+        }
+        return plan->EmplaceNode<ReservoirSampleNode>(plan, std::move(inputs), sample_options);
+    }
+    
+    if (!(sample_options.fraction > 0.0 && sample_options.fraction <= 1.0)) {
+        return arrow::Status::Invalid("Sample fraction must be in (0, 1], got ", sample_options.fraction);
+    }
+    
+    std::vector<int> keys;
+    if (sample_options.method == SampleMethod::HASH) {
+        if (sample_options.keys.empty()) {
+            return arrow::Status::Invalid("Hash sampling needs at least one key");
+        }
+        for (const auto& key : sample_options.keys) {
+            ARROW_ASSIGN_OR_RAISE(arrow::FieldPath path, arrow::FieldRef(key).FindOne(*inputs[0]->output_schema()));
+            keys.push_back(path[0]);
+        }
+    }
+    return plan->EmplaceNode<RowSampleNode>(plan, std::move(inputs), sample_options, std::move(keys));
+}
+
+arrow::Status RegisterCustomNodes() {
+    ac::ExecFactoryRegistry* registry = ac::default_exec_factory_registry();
+    
+    ARROW_RETURN_NOT_OK(registry->AddFactory("window_combine", WindowCombineNode::Make));
+    ARROW_RETURN_NOT_OK(registry->AddFactory("topk", TopKNode::Make));
+    ARROW_RETURN_NOT_OK(registry->AddFactory("adaptive_filter", AdaptiveFilterNode::Make));
+    ARROW_RETURN_NOT_OK(registry->AddFactory("lookup_join", LookupJoinNode::Make));
+    ARROW_RETURN_NOT_OK(registry->AddFactory("sample", MakeSampleNode));
+    
+    return arrow::Status::OK();
+}
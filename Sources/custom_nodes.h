@@ -0,0 +1,162 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <optional>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/acero/map_node.h>
+#include <arrow/acero/util.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Combines per pane partial aggregates into sliding windows of
+ * `panes` consecutive panes. With ordered input a window is emitted as
+ * soon as a pane after its last pane arrives.
+ */
+class WindowCombineNodeOptions : public ac::ExecNodeOptions {
+public:
+    WindowCombineNodeOptions(std::vector<std::string> _keys,
+                             std::string _paneColumn,
+                             std::string _windowColumn,
+                             std::chrono::nanoseconds _slide,
+                             int _panes,
+                             std::vector<cp::Aggregate> _merges,
+                             bool _ordered) :
+        keys(std::move(_keys)),
+        paneColumn(std::move(_paneColumn)),
+        windowColumn(std::move(_windowColumn)),
+        slide(_slide),
+        panes(_panes),
+        merges(std::move(_merges)),
+        ordered(_ordered) {}
+    
+    std::vector<std::string> keys;
+    std::string paneColumn;
+    std::string windowColumn;
+    std::chrono::nanoseconds slide;
+    int panes;
+    // Aggregates that merge the partial columns of several panes
+    std::vector<cp::Aggregate> merges;
+    bool ordered;
+};
+
+/*
+ * Keeps the k rows with the largest (or smallest) values of sortColumn,
+ * per combination of partitionKeys if given. Every thread keeps its own
+ * candidates, they are merged when the input is finished.
+ */
+class TopKNodeOptions : public ac::ExecNodeOptions {
+public:
+    TopKNodeOptions(std::string _sortColumn,
+                    int64_t _k,
+                    cp::SortOrder _order = cp::SortOrder::Descending,
+                    std::vector<std::string> _partitionKeys = {}) :
+        sortColumn(std::move(_sortColumn)),
+        k(_k),
+        order(_order),
+        partitionKeys(std::move(_partitionKeys)) {}
+    
+    std::string sortColumn;
+    int64_t k;
+    cp::SortOrder order;
+    std::vector<std::string> partitionKeys;
+};
+
+/*
+ * Filter on the conjunction of `conjuncts`, evaluated in the order of
+ * their measured cost per row and selectivity. Each conjunct only sees
+ * the rows that passed the ones before it and only the columns it
+ * references; the remaining columns are gathered once at the end.
+ */
+class AdaptiveFilterNodeOptions : public ac::ExecNodeOptions {
+public:
+    AdaptiveFilterNodeOptions(std::vector<cp::Expression> _conjuncts,
+                              int _sampleEvery = 16,
+                              int64_t _sampleRows = 1024) :
+        conjuncts(std::move(_conjuncts)),
+        sampleEvery(_sampleEvery),
+        sampleRows(_sampleRows) {}
+    
+    std::vector<cp::Expression> conjuncts;
+    // Every sampleEvery-th batch measures all conjuncts again and reorders them
+    int sampleEvery;
+    // Leading rows of a sampled batch the conjuncts are measured on
+    int64_t sampleRows;
+};
+
+enum class SampleMethod {
+    // Every row independently with probability fraction
+    BERNOULLI,
+    // A uniform sample of exactly reservoirSize rows, emitted at the end
+    RESERVOIR,
+    // Rows whose keys hash below fraction, all rows of a key or none
+    HASH
+};
+
+/*
+ * Samples the input. HASH is deterministic for a seed: the same keys are
+ * kept in every plan, so per key aggregates of the sample are exact.
+ */
+class SampleNodeOptions : public ac::ExecNodeOptions {
+public:
+    SampleNodeOptions(SampleMethod _method,
+                      double _fraction,
+                      int64_t _reservoirSize = 0,
+                      std::vector<std::string> _keys = {},
+                      uint64_t _seed = 42) :
+        method(_method),
+        fraction(_fraction),
+        reservoirSize(_reservoirSize),
+        keys(std::move(_keys)),
+        seed(_seed) {}
+    
+    SampleMethod method;
+    // BERNOULLI and HASH
+    double fraction;
+    // RESERVOIR
+    int64_t reservoirSize;
+    // HASH
+    std::vector<std::string> keys;
+    uint64_t seed;
+};
+
+class LookupTable;
+
+/*
+ * Left join of the input with a prebuilt LookupTable on keyColumn. Adds
+ * valueColumns of the lookup table, prefixed with prefix, null where the
+ * key is not found. Batches probe the shared table in parallel.
+ */
+class LookupJoinNodeOptions : public ac::ExecNodeOptions {
+public:
+    LookupJoinNodeOptions(std::shared_ptr<const LookupTable> _table,
+                          std::string _keyColumn,
+                          std::vector<std::string> _valueColumns,
+                          std::string _prefix = "") :
+        table(std::move(_table)),
+        keyColumn(std::move(_keyColumn)),
+        valueColumns(std::move(_valueColumns)),
+        prefix(std::move(_prefix)) {}
+    
+    std::shared_ptr<const LookupTable> table;
+    std::string keyColumn;
+    // Empty adds every column except the lookup key
+    std::vector<std::string> valueColumns;
+    std::string prefix;
+};
+
+arrow::Status RegisterCustomNodes();
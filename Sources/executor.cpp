@@ -0,0 +1,286 @@
+//
+//  executor.cpp
+//  ArrowAcero
+//
+#import "executor.h"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+static arrow::Result<int> ParseCount(const std::string& name, const std::string& value, int minimum = 0) {
+    char* end = nullptr;
+    long count = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || count < minimum || count > std::numeric_limits<int>::max()) {
+        return arrow::Status::Invalid("Invalid value for ", name, ": '", value, "'");
+    }
+    return static_cast<int>(count);
+}
+
+static arrow::Result<PinningMode> ParsePinning(const std::string& value) {
+    if (value == "none") {
+        return PinningMode::NONE;
+    }
+    if (value == "core") {
+        return PinningMode::CORE;
+    }
+    if (value == "numa") {
+        return PinningMode::NUMA;
+    }
+    return arrow::Status::Invalid("Invalid pinning mode '", value, "', expected none, core or numa");
+}
+
+static arrow::Status SetOption(ExecutorOptions* options, const std::string& name, const std::string& value) {
+    if (name == "cpu-threads") {
+        ARROW_ASSIGN_OR_RAISE(options->cpu_threads, ParseCount(name, value));
+    } else if (name == "io-threads") {
+        ARROW_ASSIGN_OR_RAISE(options->io_threads, ParseCount(name, value));
+    } else if (name == "plan-threads") {
+        ARROW_ASSIGN_OR_RAISE(options->plan_threads, ParseCount(name, value));
+    } else if (name == "pinning") {
+        ARROW_ASSIGN_OR_RAISE(options->pinning, ParsePinning(value));
+    } else if (name == "numa-node") {
+        // -1 is no node
+        ARROW_ASSIGN_OR_RAISE(options->numa_node, ParseCount(name, value, -1));
+    } else {
+        return arrow::Status::Invalid("Unknown option --", name);
+    }
+    return arrow::Status::OK();
+}
+
+arrow::Result<ExecutorOptions> ParseExecutorOptions(int argc, char** argv) {
+    ExecutorOptions options;
+
+    const std::vector<std::pair<const char*, std::string>> environment = {
+        {"ACERO_CPU_THREADS", "cpu-threads"},
+        {"ACERO_IO_THREADS", "io-threads"},
+        {"ACERO_PLAN_THREADS", "plan-threads"},
+        {"ACERO_PINNING", "pinning"},
+        {"ACERO_NUMA_NODE", "numa-node"}
+    };
+    for (const auto& variable : environment) {
+        if (const char* value = std::getenv(variable.first)) {
+            ARROW_RETURN_NOT_OK(SetOption(&options, variable.second, value));
+        }
+    }
+
+    /* Command line wins over the environment */
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.rfind("--", 0) != 0) {
+            continue;
+        }
+        auto separator = argument.find('=');
+        if (separator == std::string::npos) {
+            return arrow::Status::Invalid("Expected --name=value, got '", argument, "'");
+        }
+        ARROW_RETURN_NOT_OK(SetOption(&options, argument.substr(2, separator - 2), argument.substr(separator + 1)));
+    }
+
+    return options;
+}
+
+std::string ExecutorOptions::ToString() const {
+    std::stringstream ss;
+    ss << "cpu_threads=" << cpu_threads
+       << " io_threads=" << io_threads
+       << " plan_threads=" << plan_threads
+       << " pinning=" << (pinning == PinningMode::CORE ? "core" : pinning == PinningMode::NUMA ? "numa" : "none")
+       << " numa_node=" << numa_node;
+    return ss.str();
+}
+
+/*
+ * "0-15,32-47" as found in /sys/devices/system/node/nodeN/cpulist
+ */
+static std::vector<int> ParseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        if (range.empty() || !std::isdigit(static_cast<unsigned char>(range[0]))) {
+            continue;
+        }
+        auto dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/*
+ * Cores per NUMA node. Without NUMA information all cores form one node.
+ */
+static std::vector<std::vector<int>> NumaTopology() {
+    std::vector<std::vector<int>> nodes;
+#ifdef __linux__
+    for (int node = 0; ; node++) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file) {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus = ParseCpuList(list);
+        if (!cpus.empty()) {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < static_cast<int>(cpus.size()); cpu++) {
+            cpus[cpu] = cpu;
+        }
+        nodes.push_back(std::move(cpus));
+    }
+    return nodes;
+}
+
+/*
+ * The cores every worker may run on
+ */
+static arrow::Result<std::vector<std::vector<int>>> WorkerCpuSets(int threads, const ExecutorOptions& options) {
+    std::vector<std::vector<int>> nodes = NumaTopology();
+
+    if (options.numa_node >= static_cast<int>(nodes.size())) {
+        return arrow::Status::Invalid("NUMA node ", options.numa_node, " does not exist, found ", nodes.size());
+    }
+    if (options.numa_node >= 0) {
+        nodes = {nodes[options.numa_node]};
+    }
+
+    std::vector<std::vector<int>> cpuSets(threads);
+    if (options.pinning == PinningMode::CORE) {
+        /* Consecutive workers share a node, so small pools stay on one socket */
+        std::vector<int> cpus;
+        for (const auto& node : nodes) {
+            cpus.insert(cpus.end(), node.begin(), node.end());
+        }
+        for (int i = 0; i < threads; i++) {
+            cpuSets[i] = {cpus[i % cpus.size()]};
+        }
+    } else {
+        /* Workers are split into one contiguous block per node */
+        for (int i = 0; i < threads; i++) {
+            cpuSets[i] = nodes[static_cast<size_t>(i) * nodes.size() / threads];
+        }
+    }
+    return cpuSets;
+}
+
+static arrow::Status PinCurrentThread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (error != 0) {
+        return arrow::Status::IOError("pthread_setaffinity_np failed: ", std::strerror(error));
+    }
+    return arrow::Status::OK();
+#else
+    return arrow::Status::NotImplemented("Thread pinning is only supported on Linux");
+#endif
+}
+
+/*
+ * Arrow does not expose its worker threads, so one task per worker is
+ * submitted and every task waits until all workers hold one. Each task
+ * then runs on a different worker and pins the thread it runs on.
+ */
+static arrow::Status PinWorkers(arrow::internal::ThreadPool* pool, const ExecutorOptions& options) {
+    if (options.pinning == PinningMode::NONE) {
+        return arrow::Status::OK();
+    }
+
+    int threads = pool->GetCapacity();
+    ARROW_ASSIGN_OR_RAISE(auto cpuSets, WorkerCpuSets(threads, options));
+
+    struct PinState {
+        std::mutex mutex;
+        std::condition_variable cv;
+        int arrived = 0;
+        int finished = 0;
+        // Set when pinning is given up, waiting tasks return without pinning
+        bool cancelled = false;
+        arrow::Status status;
+    };
+    auto state = std::make_shared<PinState>();
+    
+    /* Tasks that already wait must not hold their worker forever */
+    auto cancel = [&state]() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cancelled = true;
+        state->cv.notify_all();
+    };
+
+    for (int i = 0; i < threads; i++) {
+        arrow::Status spawned = pool->Spawn([state, threads, cpus = cpuSets[i]]() {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->arrived++;
+            state->cv.notify_all();
+            state->cv.wait(lock, [&] { return state->arrived == threads || state->cancelled; });
+            if (state->cancelled) {
+                return;
+            }
+            lock.unlock();
+
+            arrow::Status status = PinCurrentThread(cpus);
+
+            lock.lock();
+            state->status &= status;
+            state->finished++;
+            state->cv.notify_all();
+        });
+        if (!spawned.ok()) {
+            cancel();
+            return spawned;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    if (!state->cv.wait_for(lock, std::chrono::seconds(10), [&] { return state->finished == threads; })) {
+        lock.unlock();
+        cancel();
+        return arrow::Status::Invalid("Timed out pinning ", threads, " workers, the pool is busy");
+    }
+    return state->status;
+}
+
+arrow::Status ConfigureExecutors(const ExecutorOptions& options) {
+    if (options.cpu_threads > 0) {
+        ARROW_RETURN_NOT_OK(arrow::SetCpuThreadPoolCapacity(options.cpu_threads));
+    }
+    if (options.io_threads > 0) {
+        ARROW_RETURN_NOT_OK(arrow::io::SetIOThreadPoolCapacity(options.io_threads));
+    }
+
+    /* I/O threads mostly wait, so only the CPU pool is pinned */
+    return PinWorkers(arrow::internal::GetCpuThreadPool(), options);
+}
+
+arrow::Result<std::shared_ptr<arrow::internal::ThreadPool>> MakePlanExecutor(int threads,
+                                                                            const ExecutorOptions& options) {
+    if (threads <= 0) {
+        return arrow::Status::Invalid("A plan executor needs at least one thread");
+    }
+    ARROW_ASSIGN_OR_RAISE(auto pool, arrow::internal::ThreadPool::Make(threads));
+    ARROW_RETURN_NOT_OK(PinWorkers(pool.get(), options));
+    return pool;
+}
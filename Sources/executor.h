@@ -0,0 +1,63 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/io/interfaces.h>
+#include <arrow/util/thread_pool.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+enum class PinningMode {
+    NONE,
+    // Every worker is bound to a single core, filling one NUMA node first
+    CORE,
+    // Every worker is bound to all cores of one NUMA node
+    NUMA
+};
+
+/*
+ * Sizing and placement of the thread pools. Values are taken from the
+ * environment (ACERO_CPU_THREADS, ACERO_IO_THREADS, ACERO_PLAN_THREADS,
+ * ACERO_PINNING, ACERO_NUMA_NODE) and can be overridden on the command
+ * line (--cpu-threads=8 --io-threads=16 --plan-threads=4
+ * --pinning=none|core|numa --numa-node=0). A thread count of 0 keeps
+ * Arrow's default.
+ */
+struct ExecutorOptions {
+    int cpu_threads = 0;
+    int io_threads = 0;
+    // Thread budget of plans that run on their own executor, 0 uses the global CPU pool
+    int plan_threads = 0;
+
+    PinningMode pinning = PinningMode::NONE;
+    // Restricts pinned workers to one NUMA node, -1 spreads them over all nodes
+    int numa_node = -1;
+
+    std::string ToString() const;
+};
+
+arrow::Result<ExecutorOptions> ParseExecutorOptions(int argc, char** argv);
+
+/*
+ * Resizes the global CPU and I/O pools and pins their workers
+ */
+arrow::Status ConfigureExecutors(const ExecutorOptions& options);
+
+/*
+ * A bounded executor for a single plan, pinned like the global pools.
+ * Pass it as QueryOptions::custom_cpu_executor and keep it alive until
+ * the plan has finished.
+ */
+arrow::Result<std::shared_ptr<arrow::internal::ThreadPool>> MakePlanExecutor(int threads,
+                                                                            const ExecutorOptions& options);
@@ -0,0 +1,296 @@
+//
+//  flight_ipc.cpp
+//  ArrowAcero
+//
+#import "flight_ipc.h"
+
+#include <deque>
+#include <map>
+#include <optional>
+#include <sstream>
+
+#include <arrow/array/builder_dict.h>
+
+static const char* kCompressionHeader = "x-arrow-compression";
+static const char* kThresholdHeader = "x-arrow-compression-threshold";
+static const char* kDictionaryHeader = "x-arrow-dictionary";
+
+arrow::Result<arrow::Compression::type> ParseStreamCompression(const std::string& name) {
+    if (name == "none" || name.empty()) {
+        return arrow::Compression::UNCOMPRESSED;
+    }
+    if (name == "lz4") {
+        return arrow::Compression::LZ4_FRAME;
+    }
+    if (name == "zstd") {
+        return arrow::Compression::ZSTD;
+    }
+    return arrow::Status::Invalid("Unsupported stream compression '", name, "', expected none, lz4 or zstd");
+}
+
+static std::string CompressionName(arrow::Compression::type compression) {
+    switch (compression) {
+        case arrow::Compression::LZ4_FRAME: return "lz4";
+        case arrow::Compression::ZSTD: return "zstd";
+        default: return "none";
+    }
+}
+
+std::string StreamIpcOptions::ToString() const {
+    std::stringstream ss;
+    ss << "compression=" << CompressionName(compression)
+       << " threshold=" << compression_threshold
+       << " dictionary=";
+    for (size_t i = 0; i < dictionary_columns.size(); i++) {
+        ss << (i > 0 ? "," : "") << dictionary_columns[i];
+    }
+    return ss.str();
+}
+
+arrow::Result<StreamIpcOptions> ParseStreamIpcHeaders(const arrow::flight::CallHeaders& headers) {
+    StreamIpcOptions options;
+
+    auto compression = headers.find(kCompressionHeader);
+    if (compression != headers.end()) {
+        ARROW_ASSIGN_OR_RAISE(options.compression, ParseStreamCompression(std::string(compression->second)));
+    }
+
+    auto threshold = headers.find(kThresholdHeader);
+    if (threshold != headers.end()) {
+        std::string value(threshold->second);
+        char* end = nullptr;
+        options.compression_threshold = std::strtoll(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0' || options.compression_threshold < 0) {
+            return arrow::Status::Invalid("Invalid ", kThresholdHeader, " '", value, "'");
+        }
+    }
+
+    auto dictionary = headers.find(kDictionaryHeader);
+    if (dictionary != headers.end()) {
+        std::stringstream ss{std::string(dictionary->second)};
+        std::string column;
+        while (std::getline(ss, column, ',')) {
+            if (!column.empty()) {
+                options.dictionary_columns.push_back(column);
+            }
+        }
+    }
+
+    return options;
+}
+
+void AddStreamIpcHeaders(const StreamIpcOptions& options, arrow::flight::FlightCallOptions* callOptions) {
+    callOptions->headers.emplace_back(kCompressionHeader, CompressionName(options.compression));
+    callOptions->headers.emplace_back(kThresholdHeader, std::to_string(options.compression_threshold));
+
+    if (!options.dictionary_columns.empty()) {
+        std::string columns;
+        for (const auto& column : options.dictionary_columns) {
+            columns += (columns.empty() ? "" : ",") + column;
+        }
+        callOptions->headers.emplace_back(kDictionaryHeader, columns);
+    }
+}
+
+/*
+ * Dictionary of one column; values keep their index for the lifetime
+ * of the stream, only the values added since the last call are returned
+ */
+class GrowingDictionary {
+public:
+    GrowingDictionary() : memo_(arrow::default_memory_pool(), arrow::utf8()) {}
+
+    arrow::Result<std::shared_ptr<arrow::Array>> Encode(const arrow::StringArray& values) {
+        arrow::Int32Builder indices;
+        ARROW_RETURN_NOT_OK(indices.Reserve(values.length()));
+
+        for (int64_t i = 0; i < values.length(); i++) {
+            if (values.IsNull(i)) {
+                indices.UnsafeAppendNull();
+                continue;
+            }
+            int32_t index;
+            ARROW_RETURN_NOT_OK(memo_.GetOrInsert<arrow::StringType>(values.GetView(i), &index));
+            indices.UnsafeAppend(index);
+        }
+        return indices.Finish();
+    }
+
+    // Values added since the previous call
+    arrow::Result<std::shared_ptr<arrow::Array>> TakeAdded() {
+        std::shared_ptr<arrow::ArrayData> added;
+        ARROW_RETURN_NOT_OK(memo_.GetArrayData(sent_, &added));
+        sent_ = memo_.size();
+        taken_ = true;
+        return arrow::MakeArray(added);
+    }
+
+    bool taken() const { return taken_; }
+
+private:
+    arrow::internal::DictionaryMemoTable memo_;
+    int32_t sent_ = 0;
+    bool taken_ = false;
+};
+
+/*
+ * Writes the IPC messages of a negotiated DoGet. Every message is
+ * compressed only if its body reaches the threshold, dictionary columns
+ * are followed by a delta with the values they added. Columns that were
+ * dictionary encoded by the source send their dictionary whenever it
+ * differs from the one sent before.
+ */
+class NegotiatedBatchStream : public arrow::flight::FlightDataStream {
+public:
+    NegotiatedBatchStream(std::shared_ptr<arrow::RecordBatchReader> reader,
+                          std::shared_ptr<arrow::Schema> schema,
+                          std::shared_ptr<arrow::Schema> wire_schema,
+                          std::vector<int> columns,
+                          arrow::ipc::IpcWriteOptions raw_options,
+                          std::optional<arrow::ipc::IpcWriteOptions> compressed_options,
+                          int64_t threshold) :
+        reader_(std::move(reader)),
+        schema_(std::move(schema)),
+        wire_schema_(std::move(wire_schema)),
+        mapper_(*schema_),
+        columns_(std::move(columns)),
+        dictionaries_(columns_.size()),
+        raw_options_(std::move(raw_options)),
+        compressed_options_(std::move(compressed_options)),
+        threshold_(threshold) {}
+
+    std::shared_ptr<arrow::Schema> schema() override { return schema_; }
+
+    arrow::Result<arrow::flight::FlightPayload> GetSchemaPayload() override {
+        arrow::flight::FlightPayload payload;
+        ARROW_RETURN_NOT_OK(arrow::ipc::GetSchemaPayload(*schema_, raw_options_, mapper_, &payload.ipc_message));
+        return payload;
+    }
+
+    arrow::Result<arrow::flight::FlightPayload> Next() override {
+        if (payloads_.empty()) {
+            ARROW_RETURN_NOT_OK(ReadBatch());
+        }
+        if (payloads_.empty()) {
+            // No metadata ends the stream
+            return arrow::flight::FlightPayload();
+        }
+        arrow::flight::FlightPayload payload = std::move(payloads_.front());
+        payloads_.pop_front();
+        return payload;
+    }
+
+    arrow::Status Close() override { return reader_->Close(); }
+
+private:
+    /* The body is serialized without copying, serializing it again compressed is cheap */
+    template <typename Serialize>
+    arrow::Status AddPayload(Serialize serialize) {
+        arrow::flight::FlightPayload payload;
+        ARROW_RETURN_NOT_OK(serialize(raw_options_, &payload.ipc_message));
+        if (compressed_options_ && payload.ipc_message.body_length >= threshold_) {
+            payload = arrow::flight::FlightPayload();
+            ARROW_RETURN_NOT_OK(serialize(*compressed_options_, &payload.ipc_message));
+        }
+        payloads_.push_back(std::move(payload));
+        return arrow::Status::OK();
+    }
+
+    arrow::Status ReadBatch() {
+        std::shared_ptr<arrow::RecordBatch> input;
+        ARROW_RETURN_NOT_OK(reader_->ReadNext(&input));
+        if (!input) {
+            return arrow::Status::OK();
+        }
+
+        ARROW_ASSIGN_OR_RAISE(arrow::ipc::DictionaryVector source_dictionaries,
+                              arrow::ipc::CollectDictionaries(*input, mapper_));
+        for (const auto& [id, dictionary] : source_dictionaries) {
+            auto& sent = sent_dictionaries_[id];
+            if (sent && (sent == dictionary || sent->Equals(*dictionary))) {
+                continue;
+            }
+            /* A dictionary that is not a delta replaces the one the client has */
+            ARROW_RETURN_NOT_OK(AddPayload([&, id = id, dictionary = dictionary](const arrow::ipc::IpcWriteOptions& options,
+                                                                                arrow::ipc::IpcPayload* out) {
+                return arrow::ipc::GetDictionaryPayload(id, false, dictionary, options, out);
+            }));
+            sent = dictionary;
+        }
+
+        std::vector<std::shared_ptr<arrow::Array>> arrays = input->columns();
+        for (size_t i = 0; i < columns_.size(); i++) {
+            const auto& values = static_cast<const arrow::StringArray&>(*arrays[columns_[i]]);
+            ARROW_ASSIGN_OR_RAISE(auto indices, dictionaries_[i].Encode(values));
+
+            bool is_delta = dictionaries_[i].taken();
+            ARROW_ASSIGN_OR_RAISE(auto added, dictionaries_[i].TakeAdded());
+            ARROW_ASSIGN_OR_RAISE(int64_t id, mapper_.GetFieldId({columns_[i]}));
+            if (!is_delta || added->length() > 0) {
+                ARROW_RETURN_NOT_OK(AddPayload([&](const arrow::ipc::IpcWriteOptions& options, arrow::ipc::IpcPayload* out) {
+                    return arrow::ipc::GetDictionaryPayload(id, is_delta, added, options, out);
+                }));
+            }
+
+            /*
+             * A dictionary column is written as its indices alone, so the
+             * batch carries the plain indices under wire_schema_, the
+             * dictionary went out in its own messages
+             */
+            arrays[columns_[i]] = std::move(indices);
+        }
+
+        auto batch = arrow::RecordBatch::Make(wire_schema_, input->num_rows(), std::move(arrays));
+        return AddPayload([&](const arrow::ipc::IpcWriteOptions& options, arrow::ipc::IpcPayload* out) {
+            return arrow::ipc::GetRecordBatchPayload(*batch, options, out);
+        });
+    }
+
+    std::shared_ptr<arrow::RecordBatchReader> reader_;
+    std::shared_ptr<arrow::Schema> schema_;
+    // schema_ with the index type for the columns encoded here
+    std::shared_ptr<arrow::Schema> wire_schema_;
+    arrow::ipc::DictionaryFieldMapper mapper_;
+    std::vector<int> columns_;
+    std::vector<GrowingDictionary> dictionaries_;
+    // Last dictionary sent for each source dictionary field, by id
+    std::map<int64_t, std::shared_ptr<arrow::Array>> sent_dictionaries_;
+    arrow::ipc::IpcWriteOptions raw_options_;
+    std::optional<arrow::ipc::IpcWriteOptions> compressed_options_;
+    int64_t threshold_;
+    std::deque<arrow::flight::FlightPayload> payloads_;
+};
+
+arrow::Result<std::unique_ptr<arrow::flight::FlightDataStream>> MakeNegotiatedStream(std::shared_ptr<arrow::RecordBatchReader> reader,
+                                                                                    const StreamIpcOptions& options) {
+    std::shared_ptr<arrow::Schema> schema = reader->schema();
+    std::shared_ptr<arrow::Schema> wire_schema = schema;
+    std::vector<int> indices;
+    for (const auto& column : options.dictionary_columns) {
+        int index = schema->GetFieldIndex(column);
+        if (index < 0) {
+            return arrow::Status::KeyError("No column '", column, "' to dictionary encode");
+        }
+        if (schema->field(index)->type()->id() != arrow::Type::STRING) {
+            return arrow::Status::TypeError("Only utf8 columns can be dictionary encoded, '", column, "' is ",
+                                            schema->field(index)->type()->ToString());
+        }
+        ARROW_ASSIGN_OR_RAISE(schema, schema->SetField(index, schema->field(index)->WithType(arrow::dictionary(arrow::int32(), arrow::utf8()))));
+        ARROW_ASSIGN_OR_RAISE(wire_schema, wire_schema->SetField(index, wire_schema->field(index)->WithType(arrow::int32())));
+        indices.push_back(index);
+    }
+
+    auto raw_options = arrow::ipc::IpcWriteOptions::Defaults();
+
+    std::optional<arrow::ipc::IpcWriteOptions> compressed_options;
+    if (options.compression != arrow::Compression::UNCOMPRESSED) {
+        compressed_options = raw_options;
+        ARROW_ASSIGN_OR_RAISE(compressed_options->codec, arrow::util::Codec::Create(options.compression));
+        // Buffers that do not get smaller are sent as they are
+        compressed_options->min_space_savings = 0.0;
+    }
+
+    return std::make_unique<NegotiatedBatchStream>(std::move(reader), std::move(schema), std::move(wire_schema), std::move(indices),
+                                                   std::move(raw_options), std::move(compressed_options),
+                                                   options.compression_threshold);
+}
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/flight/api.h>
+#include <arrow/ipc/api.h>
+#include <arrow/util/compression.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * IPC settings a client asks for with call headers:
+ *   x-arrow-compression: none | lz4 | zstd
+ *   x-arrow-compression-threshold: <bytes>
+ *   x-arrow-dictionary: <column>,<column>
+ */
+struct StreamIpcOptions {
+    arrow::Compression::type compression = arrow::Compression::UNCOMPRESSED;
+    // Messages with a smaller body are sent uncompressed
+    int64_t compression_threshold = 4096;
+    // String columns sent dictionary encoded, with deltas as new values show up
+    std::vector<std::string> dictionary_columns;
+
+    std::string ToString() const;
+};
+
+arrow::Result<StreamIpcOptions> ParseStreamIpcHeaders(const arrow::flight::CallHeaders& headers);
+void AddStreamIpcHeaders(const StreamIpcOptions& options, arrow::flight::FlightCallOptions* callOptions);
+
+arrow::Result<arrow::Compression::type> ParseStreamCompression(const std::string& name);
+
+/*
+ * Stream of the batches of reader as negotiated: messages whose body
+ * reaches the threshold are compressed, and `dictionary_columns` are sent
+ * dictionary encoded against one dictionary per column that only grows,
+ * with a delta of the values each batch added
+ */
+arrow::Result<std::unique_ptr<arrow::flight::FlightDataStream>> MakeNegotiatedStream(std::shared_ptr<arrow::RecordBatchReader> reader,
+                                                                                    const StreamIpcOptions& options);
@@ -0,0 +1,170 @@
+//
+//  flight_server.cpp
+//  ArrowAcero
+//
+#import "flight_server.h"
+#import "sample.h"
+#import "flight_ipc.h"
+#import "metrics.h"
+#import "custom_nodes.h"
+#import "lookup.h"
+#import "prepared.h"
+
+#include <sstream>
+
+const std::string kMetricsCommand = "METRICS";
+
+/* Joins the rows of source with the lookup table of the request */
+static ac::Declaration LookupJoinDeclaration(ac::Declaration source,
+                                             std::shared_ptr<const LookupTable> table,
+                                             const SharedScanRequest& request) {
+    return ac::Declaration{"lookup_join", {std::move(source)}, LookupJoinNodeOptions(std::move(table), request.lookup_column, {})};
+}
+
+SampleFlightServer::SampleFlightServer() :
+    SampleFlightServer([](const std::string& source) { return CreateRecordBatchReader(); }, false) {}
+
+SampleFlightServer::SampleFlightServer(BatchReaderFactory factory, bool logRequests, SharedScanOptions scanOptions) :
+    scans_(std::move(factory), scanOptions),
+    log_requests_(logRequests) {}
+
+arrow::Status SampleFlightServer::AddLookupTable(const std::string& name, const std::string& path) {
+    if (name.empty() || name.find(':') != std::string::npos || name.find(';') != std::string::npos) {
+        return arrow::Status::Invalid("Lookup table name '", name, "' must be non-empty without ':' or ';'");
+    }
+    if (path.find("://") != std::string::npos) {
+        return arrow::Status::Invalid("Lookup table '", name, "' must be a local file, got URI ", path);
+    }
+    lookup_tables_[name] = path;
+    return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<const LookupTable>> SampleFlightServer::FindLookupTable(const SharedScanRequest& request) {
+    auto path = lookup_tables_.find(request.lookup_table);
+    if (path == lookup_tables_.end()) {
+        return arrow::Status::KeyError("No lookup table '", request.lookup_table, "' on this server");
+    }
+    return LookupTableCache::Global()->Get(path->second, request.lookup_key);
+}
+
+arrow::Result<std::shared_ptr<PreparedPlan>> SampleFlightServer::PrepareLookupJoin(const SharedScanRequest& request,
+                                                                                 std::shared_ptr<const LookupTable> table,
+                                                                                 const std::shared_ptr<arrow::Schema>& schema) {
+    /* The plan holds the table, so its address stays unique while the plan is kept */
+    std::stringstream key;
+    key << table.get() << ';' << request.lookup_column << ';' << schema->ToString();
+    
+    std::lock_guard<std::mutex> lock(prepared_mutex_);
+    auto found = prepared_.find(key.str());
+    if (found != prepared_.end()) {
+        return found->second;
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<PreparedPlan> plan,
+                          PreparedPlan::Prepare(LookupJoinDeclaration(PlaceholderSourceNode(schema), std::move(table), request), {}));
+    if (prepared_.size() >= kMaxPreparedPlans) {
+        prepared_.erase(prepared_.begin());
+    }
+    prepared_.emplace(key.str(), plan);
+    return plan;
+}
+
+arrow::Status SampleFlightServer::ListFlights(const arrow::flight::ServerCallContext& context,
+                                              const arrow::flight::Criteria* criteria,
+                                              std::unique_ptr<arrow::flight::FlightListing>* listings) {
+    
+    std::vector<arrow::flight::FlightInfo> flights;
+    
+    ARROW_ASSIGN_OR_RAISE(auto flight, MakeFlightInfo("SAMPLE CMD"));
+    flights.push_back(flight);
+    
+    ARROW_ASSIGN_OR_RAISE(auto metrics, MakeFlightInfo(kMetricsCommand));
+    flights.push_back(metrics);
+    
+    *listings = std::unique_ptr<arrow::flight::FlightListing>(new arrow::flight::SimpleFlightListing(flights));
+    
+    return arrow::Status::OK();
+}
+
+arrow::Status SampleFlightServer::GetFlightInfo(const arrow::flight::ServerCallContext&,
+                                                const arrow::flight::FlightDescriptor& descriptor,
+                                                std::unique_ptr<arrow::flight::FlightInfo>* info) {
+    
+    ARROW_ASSIGN_OR_RAISE(auto flight_info, MakeFlightInfo(descriptor.cmd));
+    
+    *info = std::unique_ptr<arrow::flight::FlightInfo>(new arrow::flight::FlightInfo(std::move(flight_info)));
+    
+    return arrow::Status::OK();
+}
+
+arrow::Status SampleFlightServer::DoGet(const arrow::flight::ServerCallContext& context,
+                                        const arrow::flight::Ticket& request,
+                                        std::unique_ptr<arrow::flight::FlightDataStream>* stream) {
+    
+    /*
+     * Compression and dictionary encoding as requested by the client
+     */
+    ARROW_ASSIGN_OR_RAISE(StreamIpcOptions ipcOptions, ParseStreamIpcHeaders(context.incoming_headers()));
+    
+    if (log_requests_) {
+        std::cout << "DoGet " << context.peer() << ": " << ipcOptions.ToString() << std::endl;
+    }
+    
+    /*
+     * A snapshot of the kernel metrics of this server
+     */
+    if (request.ticket == kMetricsCommand) {
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Table> metrics, MetricsRegistry::Global()->SnapshotTable());
+        auto reader = std::make_shared<arrow::TableBatchReader>(metrics);
+        ARROW_ASSIGN_OR_RAISE(*stream, MakeNegotiatedStream(reader, ipcOptions));
+        return arrow::Status::OK();
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(SharedScanRequest scanRequest, SharedScanRequest::Parse(request.ticket));
+    
+    /* The lookup table is resolved first, an unknown one never attaches to a scan */
+    std::shared_ptr<const LookupTable> lookupTable;
+    if (!scanRequest.lookup_table.empty()) {
+        ARROW_ASSIGN_OR_RAISE(lookupTable, FindLookupTable(scanRequest));
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::RecordBatchReader> reader, scans_.Open(scanRequest));
+    
+    /* The join is planned once per table and schema, the request only binds its reader */
+    if (lookupTable) {
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<PreparedPlan> plan, PrepareLookupJoin(scanRequest, std::move(lookupTable), reader->schema()));
+        ac::Declaration source{"record_batch_reader_source", ac::RecordBatchReaderSourceNodeOptions(reader)};
+        ARROW_ASSIGN_OR_RAISE(ac::Declaration lookup, plan->Bind({}, std::move(source)));
+        ARROW_ASSIGN_OR_RAISE(reader, ac::DeclarationToReader(std::move(lookup)));
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(*stream, MakeNegotiatedStream(reader, ipcOptions));
+    
+    return arrow::Status::OK();
+}
+
+arrow::Result<arrow::flight::FlightInfo> SampleFlightServer::MakeFlightInfo(const std::string& command) {
+    std::shared_ptr<arrow::Schema> schema = MetricsRegistry::SnapshotSchema();
+    if (command != kMetricsCommand) {
+        ARROW_ASSIGN_OR_RAISE(SharedScanRequest scanRequest, SharedScanRequest::Parse(command));
+        ARROW_ASSIGN_OR_RAISE(schema, scanRequest.OutputSchema(CreateSampleSchema()));
+        
+        if (!scanRequest.lookup_table.empty()) {
+            ARROW_ASSIGN_OR_RAISE(std::shared_ptr<const LookupTable> lookupTable, FindLookupTable(scanRequest));
+            ARROW_ASSIGN_OR_RAISE(std::shared_ptr<PreparedPlan> plan, PrepareLookupJoin(scanRequest, std::move(lookupTable), schema));
+            schema = plan->output_schema();
+        }
+    }
+                    
+    arrow::flight::FlightEndpoint endpoint;
+    endpoint.ticket.ticket = command;
+    arrow::flight::Location location;
+    
+    ARROW_ASSIGN_OR_RAISE(location,
+                          arrow::flight::Location::ForGrpcTcp("localhost", port()));
+    endpoint.locations.push_back(location);
+            
+    auto descriptor = arrow::flight::FlightDescriptor::Path({command});
+
+    return arrow::flight::FlightInfo::Make(*schema, descriptor, {endpoint}, 0, 0);
+}
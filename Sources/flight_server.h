@@ -0,0 +1,89 @@
+//
+//  flight_server.h
+//  ArrowAcero
+//
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/flight/server.h>
+
+#import "shared_scan.h"
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+class LookupTable;
+class PreparedPlan;
+
+// Ticket for a snapshot of the kernel metrics of the server
+extern const std::string kMetricsCommand;
+
+class SampleFlightServer : public arrow::flight::FlightServerBase {
+public:
+    /*
+     * Every source is served from the sample data, concurrent requests
+     * for the same source share one scan
+     */
+    SampleFlightServer();
+    
+    /*
+     * Sources read from factory instead, e.g. a fixed set of batches for
+     * a load test. logRequests prints one line per DoGet, scanOptions set
+     * the coalescing window and whether requests share scans.
+     */
+    SampleFlightServer(BatchReaderFactory factory, bool logRequests, SharedScanOptions scanOptions = {});
+    
+    /*
+     * Lets tickets join with the lookup file at path as
+     * "lookup=<column>:<lookup key>:<name>". Clients can only name the
+     * tables added here, never a path or URI. Call before Init.
+     */
+    arrow::Status AddLookupTable(const std::string& name, const std::string& path);
+    
+    arrow::Status ListFlights(const arrow::flight::ServerCallContext& context,
+                              const arrow::flight::Criteria* criteria,
+                              std::unique_ptr<arrow::flight::FlightListing>* listings) override;
+    
+    arrow::Status GetFlightInfo(const arrow::flight::ServerCallContext&,
+                                const arrow::flight::FlightDescriptor& descriptor,
+                                std::unique_ptr<arrow::flight::FlightInfo>* info) override;
+    
+    arrow::Status DoGet(const arrow::flight::ServerCallContext& context,
+                        const arrow::flight::Ticket& request,
+                        std::unique_ptr<arrow::flight::FlightDataStream>* stream) override;
+    
+    SharedScanStats scan_stats() { return scans_.stats(); }
+    
+private:
+    arrow::Result<arrow::flight::FlightInfo> MakeFlightInfo(const std::string& command);
+    
+    // The table of request.lookup_table, KeyError if the server has none by that name
+    arrow::Result<std::shared_ptr<const LookupTable>> FindLookupTable(const SharedScanRequest& request);
+    
+    // Lookup join of table over batches of schema, prepared by the first request that needs it
+    arrow::Result<std::shared_ptr<PreparedPlan>> PrepareLookupJoin(const SharedScanRequest& request,
+                                                                   std::shared_ptr<const LookupTable> table,
+                                                                   const std::shared_ptr<arrow::Schema>& schema);
+    
+    // Prepared lookup joins kept, one of them is dropped to make room for another
+    static constexpr size_t kMaxPreparedPlans = 64;
+    
+    SharedScanRegistry scans_;
+    bool log_requests_ = false;
+    // Lookup files by the name tickets use
+    std::map<std::string, std::string> lookup_tables_;
+    std::mutex prepared_mutex_;
+    // By table, join column and input schema
+    std::map<std::string, std::shared_ptr<PreparedPlan>> prepared_;
+};
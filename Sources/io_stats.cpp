@@ -0,0 +1,165 @@
+//
+//  io_stats.cpp
+//  ArrowAcero
+//
+#import "io_stats.h"
+
+#include <sstream>
+
+std::string IOStats::ToString() const {
+    std::stringstream ss;
+    ss << "files_opened=" << files_opened.load()
+       << " read_requests=" << read_requests.load()
+       << " bytes_read=" << bytes_read.load()
+       << " wait_time=" << wait_nanos.load() / 1000000 << "ms";
+    return ss.str();
+}
+
+/*
+ * Forwards to the wrapped file and counts every read
+ */
+class CountingRandomAccessFile : public arrow::io::RandomAccessFile {
+public:
+    CountingRandomAccessFile(std::shared_ptr<arrow::io::RandomAccessFile> base, std::shared_ptr<IOStats> stats) :
+        base_(std::move(base)), stats_(std::move(stats)) {}
+
+    arrow::Status Close() override { return base_->Close(); }
+    bool closed() const override { return base_->closed(); }
+    arrow::Result<int64_t> Tell() const override { return base_->Tell(); }
+    arrow::Status Seek(int64_t position) override { return base_->Seek(position); }
+    arrow::Result<int64_t> GetSize() override { return base_->GetSize(); }
+    bool supports_zero_copy() const override { return base_->supports_zero_copy(); }
+    const arrow::io::IOContext& io_context() const override { return base_->io_context(); }
+
+    arrow::Result<int64_t> Read(int64_t nbytes, void* out) override {
+        auto start = std::chrono::steady_clock::now();
+        ARROW_ASSIGN_OR_RAISE(int64_t bytes, base_->Read(nbytes, out));
+        Count(bytes, start);
+        return bytes;
+    }
+
+    arrow::Result<std::shared_ptr<arrow::Buffer>> Read(int64_t nbytes) override {
+        auto start = std::chrono::steady_clock::now();
+        ARROW_ASSIGN_OR_RAISE(auto buffer, base_->Read(nbytes));
+        Count(buffer->size(), start);
+        return buffer;
+    }
+
+    arrow::Result<int64_t> ReadAt(int64_t position, int64_t nbytes, void* out) override {
+        auto start = std::chrono::steady_clock::now();
+        ARROW_ASSIGN_OR_RAISE(int64_t bytes, base_->ReadAt(position, nbytes, out));
+        Count(bytes, start);
+        return bytes;
+    }
+
+    arrow::Result<std::shared_ptr<arrow::Buffer>> ReadAt(int64_t position, int64_t nbytes) override {
+        auto start = std::chrono::steady_clock::now();
+        ARROW_ASSIGN_OR_RAISE(auto buffer, base_->ReadAt(position, nbytes));
+        Count(buffer->size(), start);
+        return buffer;
+    }
+
+    /* Pre-buffered and coalesced Parquet reads arrive here */
+    arrow::Future<std::shared_ptr<arrow::Buffer>> ReadAsync(const arrow::io::IOContext& context,
+                                                            int64_t position,
+                                                            int64_t nbytes) override {
+        auto start = std::chrono::steady_clock::now();
+        auto stats = stats_;
+        return base_->ReadAsync(context, position, nbytes).Then([stats, start](const std::shared_ptr<arrow::Buffer>& buffer) {
+            Count(stats.get(), buffer->size(), start);
+            return buffer;
+        });
+    }
+
+    arrow::Status WillNeed(const std::vector<arrow::io::ReadRange>& ranges) override {
+        return base_->WillNeed(ranges);
+    }
+
+private:
+    static void Count(IOStats* stats, int64_t bytes, std::chrono::steady_clock::time_point start) {
+        auto waited = std::chrono::steady_clock::now() - start;
+        stats->read_requests++;
+        stats->bytes_read += bytes;
+        stats->wait_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count();
+    }
+
+    void Count(int64_t bytes, std::chrono::steady_clock::time_point start) {
+        Count(stats_.get(), bytes, start);
+    }
+
+    std::shared_ptr<arrow::io::RandomAccessFile> base_;
+    std::shared_ptr<IOStats> stats_;
+};
+
+CountingFileSystem::CountingFileSystem(std::shared_ptr<arrow::fs::FileSystem> base, std::shared_ptr<IOStats> stats) :
+    arrow::fs::FileSystem(base->io_context()), base_(std::move(base)), stats_(std::move(stats)) {}
+
+bool CountingFileSystem::Equals(const arrow::fs::FileSystem& other) const {
+    if (other.type_name() != type_name()) {
+        return false;
+    }
+    return base_->Equals(*static_cast<const CountingFileSystem&>(other).base_);
+}
+
+arrow::Result<arrow::fs::FileInfo> CountingFileSystem::GetFileInfo(const std::string& path) {
+    return base_->GetFileInfo(path);
+}
+
+arrow::Result<arrow::fs::FileInfoVector> CountingFileSystem::GetFileInfo(const arrow::fs::FileSelector& select) {
+    return base_->GetFileInfo(select);
+}
+
+arrow::Status CountingFileSystem::CreateDir(const std::string& path, bool recursive) {
+    return base_->CreateDir(path, recursive);
+}
+
+arrow::Status CountingFileSystem::DeleteDir(const std::string& path) {
+    return base_->DeleteDir(path);
+}
+
+arrow::Status CountingFileSystem::DeleteDirContents(const std::string& path, bool missing_dir_ok) {
+    return base_->DeleteDirContents(path, missing_dir_ok);
+}
+
+arrow::Status CountingFileSystem::DeleteRootDirContents() {
+    return base_->DeleteRootDirContents();
+}
+
+arrow::Status CountingFileSystem::DeleteFile(const std::string& path) {
+    return base_->DeleteFile(path);
+}
+
+arrow::Status CountingFileSystem::Move(const std::string& src, const std::string& dest) {
+    return base_->Move(src, dest);
+}
+
+arrow::Status CountingFileSystem::CopyFile(const std::string& src, const std::string& dest) {
+    return base_->CopyFile(src, dest);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::InputStream>> CountingFileSystem::OpenInputStream(const std::string& path) {
+    /* Parquet scans open random access files, streams are not counted */
+    return base_->OpenInputStream(path);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::RandomAccessFile>> CountingFileSystem::OpenInputFile(const std::string& path) {
+    ARROW_ASSIGN_OR_RAISE(auto file, base_->OpenInputFile(path));
+    stats_->files_opened++;
+    return std::make_shared<CountingRandomAccessFile>(std::move(file), stats_);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::RandomAccessFile>> CountingFileSystem::OpenInputFile(const arrow::fs::FileInfo& info) {
+    ARROW_ASSIGN_OR_RAISE(auto file, base_->OpenInputFile(info));
+    stats_->files_opened++;
+    return std::make_shared<CountingRandomAccessFile>(std::move(file), stats_);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::OutputStream>> CountingFileSystem::OpenOutputStream(const std::string& path,
+                                                                                             const std::shared_ptr<const arrow::KeyValueMetadata>& metadata) {
+    return base_->OpenOutputStream(path, metadata);
+}
+
+arrow::Result<std::shared_ptr<arrow::io::OutputStream>> CountingFileSystem::OpenAppendStream(const std::string& path,
+                                                                                             const std::shared_ptr<const arrow::KeyValueMetadata>& metadata) {
+    return base_->OpenAppendStream(path, metadata);
+}
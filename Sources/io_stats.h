@@ -0,0 +1,69 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <atomic>
+#include <chrono>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/filesystem/api.h>
+#include <arrow/io/api.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * I/O done by one scan. Wait time is the time callers spent in
+ * synchronous reads plus the time asynchronous reads took to complete,
+ * so with readahead it can exceed the wall clock time.
+ */
+struct IOStats {
+    std::atomic<int64_t> files_opened{0};
+    std::atomic<int64_t> read_requests{0};
+    std::atomic<int64_t> bytes_read{0};
+    std::atomic<int64_t> wait_nanos{0};
+
+    std::string ToString() const;
+};
+
+/*
+ * Wraps a filesystem so every file opened for reading counts into `stats`
+ */
+class CountingFileSystem : public arrow::fs::FileSystem {
+public:
+    CountingFileSystem(std::shared_ptr<arrow::fs::FileSystem> base, std::shared_ptr<IOStats> stats);
+
+    std::string type_name() const override { return "counting"; }
+    bool Equals(const arrow::fs::FileSystem& other) const override;
+
+    arrow::Result<arrow::fs::FileInfo> GetFileInfo(const std::string& path) override;
+    arrow::Result<arrow::fs::FileInfoVector> GetFileInfo(const arrow::fs::FileSelector& select) override;
+
+    arrow::Status CreateDir(const std::string& path, bool recursive) override;
+    arrow::Status DeleteDir(const std::string& path) override;
+    arrow::Status DeleteDirContents(const std::string& path, bool missing_dir_ok) override;
+    arrow::Status DeleteRootDirContents() override;
+    arrow::Status DeleteFile(const std::string& path) override;
+    arrow::Status Move(const std::string& src, const std::string& dest) override;
+    arrow::Status CopyFile(const std::string& src, const std::string& dest) override;
+
+    arrow::Result<std::shared_ptr<arrow::io::InputStream>> OpenInputStream(const std::string& path) override;
+    arrow::Result<std::shared_ptr<arrow::io::RandomAccessFile>> OpenInputFile(const std::string& path) override;
+    arrow::Result<std::shared_ptr<arrow::io::RandomAccessFile>> OpenInputFile(const arrow::fs::FileInfo& info) override;
+
+    arrow::Result<std::shared_ptr<arrow::io::OutputStream>> OpenOutputStream(const std::string& path,
+                                                                             const std::shared_ptr<const arrow::KeyValueMetadata>& metadata) override;
+    arrow::Result<std::shared_ptr<arrow::io::OutputStream>> OpenAppendStream(const std::string& path,
+                                                                             const std::shared_ptr<const arrow::KeyValueMetadata>& metadata) override;
+
+private:
+    std::shared_ptr<arrow::fs::FileSystem> base_;
+    std::shared_ptr<IOStats> stats_;
+};
@@ -0,0 +1,497 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/flight/client.h>
+#include <arrow/util/byte_size.h>
+#include <arrow/util/value_parsing.h>
+
+#import "sample.h"
+#import "udf.h"
+#import "flight_ipc.h"
+#import "flight_server.h"
+#import "custom_nodes.h"
+
+/*
+ * Load test of the Flight server. --clients concurrent clients, each with
+ * its own connection, run --requests DoGet calls through the ticket mix
+ * and every call is timed to its first batch and to the end of the
+ * stream. Without --connect the server is started in-process.
+ *
+ *   --connect=<host>:<port>    a running server instead of an in-process one
+ *   --clients=<n>              concurrent clients (default 8)
+ *   --requests=<n>             measured requests per client (default 50)
+ *   --warmup=<n>               unmeasured requests per client first (default 2)
+ *   --ticket=<ticket>          repeat for a mix, a repeated ticket weighs more
+ *   --batches=<n>              batches per stream of the in-process server (default 100)
+ *   --coalesce-ms=<n>          scan coalescing window of the in-process server (default 20)
+ *   --share=on|off             whether requests of the in-process server share scans (default on)
+ *   --lookup-table=<name>=<path>  lookup file the in-process server joins tickets with, repeatable
+ *   --report=<path>            JSON report (default loadtest-report.json)
+ *   --compression= --threshold= --dictionary=   IPC options as for the client
+ */
+struct LoadTestOptions {
+    std::string connect;
+    int clients = 8;
+    int requests = 50;
+    int warmup = 2;
+    std::vector<std::string> tickets;
+    int batches = 100;
+    SharedScanOptions scan;
+    std::vector<std::pair<std::string, std::string>> lookup_tables;
+    std::string report = "loadtest-report.json";
+    StreamIpcOptions ipc;
+};
+
+// One DoGet as the client saw it
+struct RequestTiming {
+    size_t ticket = 0;
+    bool ok = true;
+    double first_batch_ms = 0;
+    double stream_ms = 0;
+    int64_t rows = 0;
+    // Size of the decoded batches
+    int64_t bytes = 0;
+};
+
+struct LatencySummary {
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+/* Releases every waiting thread once it was counted down count times */
+class Countdown {
+public:
+    explicit Countdown(int count) : count_(count) {}
+
+    void CountDown() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--count_ == 0) {
+            released_.notify_all();
+        }
+    }
+
+    void Wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        released_.wait(lock, [this] { return count_ <= 0; });
+    }
+
+    void ArriveAndWait() {
+        CountDown();
+        Wait();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable released_;
+    int count_;
+};
+
+/* Invalid instead of an exception for a value that is not an integer */
+template <typename ArrowType>
+static arrow::Result<typename ArrowType::c_type> ParseInteger(const std::string& text, const std::string& flag) {
+    typename ArrowType::c_type value;
+    if (!arrow::internal::ParseValue<ArrowType>(text.data(), text.size(), &value)) {
+        return arrow::Status::Invalid(flag, " needs an integer, got '", text, "'");
+    }
+    return value;
+}
+
+arrow::Result<LoadTestOptions> ParseLoadTestOptions(int argc, char** argv) {
+    LoadTestOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.rfind("--connect=", 0) == 0) {
+            options.connect = argument.substr(10);
+        } else if (argument.rfind("--clients=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.clients, ParseInteger<arrow::Int32Type>(argument.substr(10), "--clients"));
+        } else if (argument.rfind("--requests=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.requests, ParseInteger<arrow::Int32Type>(argument.substr(11), "--requests"));
+        } else if (argument.rfind("--warmup=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.warmup, ParseInteger<arrow::Int32Type>(argument.substr(9), "--warmup"));
+        } else if (argument.rfind("--ticket=", 0) == 0) {
+            options.tickets.push_back(argument.substr(9));
+        } else if (argument.rfind("--batches=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.batches, ParseInteger<arrow::Int32Type>(argument.substr(10), "--batches"));
+        } else if (argument.rfind("--coalesce-ms=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(int64_t coalesceMs, ParseInteger<arrow::Int64Type>(argument.substr(14), "--coalesce-ms"));
+            options.scan.coalesce_window = std::chrono::milliseconds(coalesceMs);
+        } else if (argument.rfind("--share=", 0) == 0) {
+            std::string share = argument.substr(8);
+            if (share != "on" && share != "off") {
+                return arrow::Status::Invalid("--share needs on or off, got ", share);
+            }
+            options.scan.share = share == "on";
+        } else if (argument.rfind("--lookup-table=", 0) == 0) {
+            size_t separator = argument.find('=', 15);
+            if (separator == std::string::npos) {
+                return arrow::Status::Invalid("Expected --lookup-table=<name>=<path>, got ", argument);
+            }
+            options.lookup_tables.emplace_back(argument.substr(15, separator - 15), argument.substr(separator + 1));
+        } else if (argument.rfind("--report=", 0) == 0) {
+            options.report = argument.substr(9);
+        } else if (argument.rfind("--compression=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.ipc.compression, ParseStreamCompression(argument.substr(14)));
+        } else if (argument.rfind("--threshold=", 0) == 0) {
+            ARROW_ASSIGN_OR_RAISE(options.ipc.compression_threshold, ParseInteger<arrow::Int64Type>(argument.substr(12), "--threshold"));
+        } else if (argument.rfind("--dictionary=", 0) == 0) {
+            std::stringstream columns(argument.substr(13));
+            std::string column;
+            while (std::getline(columns, column, ',')) {
+                options.ipc.dictionary_columns.push_back(column);
+            }
+        } else {
+            return arrow::Status::Invalid("Unknown argument ", argument);
+        }
+    }
+
+    if (options.clients < 1 || options.requests < 1 || options.warmup < 0 || options.batches < 1) {
+        return arrow::Status::Invalid("Clients, requests and batches must be at least 1, warmup not negative");
+    }
+    if (options.scan.coalesce_window.count() < 0) {
+        return arrow::Status::Invalid("The coalescing window must not be negative");
+    }
+    if (options.tickets.empty()) {
+        options.tickets.push_back("SAMPLE CMD");
+    }
+
+    return options;
+}
+
+static arrow::Result<RequestTiming> TimeRequest(arrow::flight::FlightClient* client,
+                                                const arrow::flight::FlightCallOptions& callOptions,
+                                                const std::string& ticket) {
+    RequestTiming timing;
+    auto startTime = std::chrono::steady_clock::now();
+
+    arrow::flight::Ticket flightTicket;
+    flightTicket.ticket = ticket;
+
+    std::unique_ptr<arrow::flight::FlightStreamReader> stream;
+    ARROW_ASSIGN_OR_RAISE(stream, client->DoGet(callOptions, flightTicket));
+
+    bool first = true;
+    while (true) {
+        ARROW_ASSIGN_OR_RAISE(arrow::flight::FlightStreamChunk chunk, stream->Next());
+        if (first) {
+            timing.first_batch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+            first = false;
+        }
+        if (!chunk.data) {
+            break;
+        }
+        timing.rows += chunk.data->num_rows();
+        timing.bytes += arrow::util::TotalBufferSize(*chunk.data);
+    }
+
+    timing.stream_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    return timing;
+}
+
+/* Nearest rank percentiles */
+static LatencySummary Summarize(std::vector<double> values) {
+    LatencySummary summary;
+    if (values.empty()) {
+        return summary;
+    }
+    std::sort(values.begin(), values.end());
+
+    auto percentile = [&](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+        return values[std::clamp<size_t>(rank, 1, values.size()) - 1];
+    };
+    summary.p50 = percentile(0.50);
+    summary.p95 = percentile(0.95);
+    summary.p99 = percentile(0.99);
+    summary.max = values.back();
+    return summary;
+}
+
+static std::string JsonString(const std::string& value) {
+    std::stringstream ss;
+    ss << '"';
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            ss << '\\' << c;
+        } else if (c < 0x20) {
+            ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        } else {
+            ss << c;
+        }
+    }
+    ss << '"';
+    return ss.str();
+}
+
+static std::string JsonLatency(const LatencySummary& summary) {
+    std::stringstream ss;
+    ss << "{\"p50\": " << summary.p50 << ", \"p95\": " << summary.p95
+       << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << "}";
+    return ss.str();
+}
+
+static void AddTimings(const std::vector<RequestTiming>& timings,
+                       std::vector<double>* firstBatch,
+                       std::vector<double>* stream) {
+    for (const auto& timing : timings) {
+        if (timing.ok) {
+            firstBatch->push_back(timing.first_batch_ms);
+            stream->push_back(timing.stream_ms);
+        }
+    }
+}
+
+/*
+ * Sources of the in-process server are read from the same batches over
+ * and over, so the run measures Flight and not the sample data
+ */
+static arrow::Result<std::unique_ptr<SampleFlightServer>> StartInProcessServer(const LoadTestOptions& loadOptions, int* port) {
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    for (int i = 0; i < loadOptions.batches; i++) {
+        ARROW_ASSIGN_OR_RAISE(auto batch, CreateSampleBatch());
+        batches.push_back(batch);
+    }
+
+    auto server = std::make_unique<SampleFlightServer>([batches](const std::string& source) {
+        return arrow::RecordBatchReader::Make(batches, CreateSampleSchema());
+    }, false, loadOptions.scan);
+    for (const auto& [name, path] : loadOptions.lookup_tables) {
+        ARROW_RETURN_NOT_OK(server->AddLookupTable(name, path));
+    }
+
+    ARROW_ASSIGN_OR_RAISE(arrow::flight::Location location, arrow::flight::Location::ForGrpcTcp("localhost", 0));
+    arrow::flight::FlightServerOptions options(location);
+    ARROW_RETURN_NOT_OK(server->Init(options));
+
+    *port = server->port();
+    return server;
+}
+
+arrow::Status RunMain(int argc, char** argv) {
+    ARROW_ASSIGN_OR_RAISE(LoadTestOptions options, ParseLoadTestOptions(argc, argv));
+
+    std::unique_ptr<SampleFlightServer> server;
+    std::string host = "localhost";
+    int port = 0;
+    if (options.connect.empty()) {
+        ARROW_RETURN_NOT_OK(RegisterCustomFunctions());
+        ARROW_RETURN_NOT_OK(RegisterCustomNodes());
+        ARROW_ASSIGN_OR_RAISE(server, StartInProcessServer(options, &port));
+        std::cout << "In-process server on localhost:" << port << ", coalescing window: "
+                  << options.scan.coalesce_window.count() << "ms, shared scans: " << (options.scan.share ? "on" : "off") << std::endl;
+    } else {
+        size_t colon = options.connect.rfind(':');
+        if (colon == std::string::npos) {
+            return arrow::Status::Invalid("--connect needs <host>:<port>, got ", options.connect);
+        }
+        host = options.connect.substr(0, colon);
+        ARROW_ASSIGN_OR_RAISE(port, ParseInteger<arrow::Int32Type>(options.connect.substr(colon + 1), "--connect port"));
+    }
+
+    ARROW_ASSIGN_OR_RAISE(arrow::flight::Location location, arrow::flight::Location::ForGrpcTcp(host, port));
+
+    arrow::flight::FlightCallOptions callOptions;
+    AddStreamIpcHeaders(options.ipc, &callOptions);
+
+    std::cout << "Clients: " << options.clients << ", requests per client: " << options.requests
+              << ", tickets: " << options.tickets.size() << ", " << options.ipc.ToString() << std::endl;
+
+    /*
+     * Clients connect and warm up first, the measured requests of all
+     * clients start together
+     */
+    std::vector<std::vector<RequestTiming>> timings(options.clients);
+    std::mutex errorMutex;
+    std::string firstError;
+    Countdown ready(options.clients + 1);
+    Countdown start(1);
+
+    std::vector<std::thread> clients;
+    for (int c = 0; c < options.clients; c++) {
+        clients.emplace_back([&, c]() {
+            auto fail = [&](const arrow::Status& status) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (firstError.empty()) {
+                    firstError = status.ToString();
+                }
+            };
+
+            auto connected = arrow::flight::FlightClient::Connect(location);
+            std::unique_ptr<arrow::flight::FlightClient> client;
+            if (connected.ok()) {
+                client = std::move(connected).ValueOrDie();
+                for (int i = 0; i < options.warmup; i++) {
+                    auto warmup = TimeRequest(client.get(), callOptions, options.tickets[(c + i) % options.tickets.size()]);
+                    if (!warmup.ok()) {
+                        fail(warmup.status());
+                    }
+                }
+            } else {
+                fail(connected.status());
+            }
+
+            ready.CountDown();
+            start.Wait();
+
+            for (int i = 0; i < options.requests; i++) {
+                size_t ticket = (c + i) % options.tickets.size();
+                RequestTiming timing;
+                if (client) {
+                    auto timed = TimeRequest(client.get(), callOptions, options.tickets[ticket]);
+                    if (timed.ok()) {
+                        timing = *timed;
+                    } else {
+                        timing.ok = false;
+                        fail(timed.status());
+                    }
+                } else {
+                    timing.ok = false;
+                }
+                timing.ticket = ticket;
+                timings[c].push_back(timing);
+            }
+        });
+    }
+
+    ready.ArriveAndWait();
+    auto startTime = std::chrono::steady_clock::now();
+    start.CountDown();
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    if (server) {
+        ARROW_RETURN_NOT_OK(server->Shutdown());
+        ARROW_RETURN_NOT_OK(server->Wait());
+    }
+
+    /*
+     * Totals over the run and latencies per distinct ticket, a ticket
+     * repeated in the mix is reported once
+     */
+    std::vector<std::string> distinctTickets;
+    std::vector<size_t> distinctIndex;
+    for (const auto& ticket : options.tickets) {
+        auto found = std::find(distinctTickets.begin(), distinctTickets.end(), ticket);
+        distinctIndex.push_back(found - distinctTickets.begin());
+        if (found == distinctTickets.end()) {
+            distinctTickets.push_back(ticket);
+        }
+    }
+
+    int64_t requests = 0;
+    int64_t errors = 0;
+    int64_t rows = 0;
+    int64_t bytes = 0;
+    std::vector<double> firstBatch;
+    std::vector<double> stream;
+    std::vector<std::vector<RequestTiming>> byTicket(distinctTickets.size());
+    for (const auto& clientTimings : timings) {
+        AddTimings(clientTimings, &firstBatch, &stream);
+        for (const auto& timing : clientTimings) {
+            requests++;
+            errors += timing.ok ? 0 : 1;
+            rows += timing.rows;
+            bytes += timing.bytes;
+            byTicket[distinctIndex[timing.ticket]].push_back(timing);
+        }
+    }
+
+    LatencySummary firstBatchSummary = Summarize(firstBatch);
+    LatencySummary streamSummary = Summarize(stream);
+    double rowsPerSecond = rows / seconds;
+    double megabytesPerSecond = bytes / seconds / (1024 * 1024);
+
+    std::cout << "Requests: " << requests << ", errors: " << errors << ", duration: " << static_cast<int64_t>(seconds * 1000) << "ms" << std::endl;
+    std::cout << "Throughput: " << static_cast<int64_t>(rowsPerSecond) << " rows/s, " << megabytesPerSecond << " MB/s" << std::endl;
+    std::cout << "First batch ms: p50=" << firstBatchSummary.p50 << " p95=" << firstBatchSummary.p95
+              << " p99=" << firstBatchSummary.p99 << " max=" << firstBatchSummary.max << std::endl;
+    std::cout << "Stream ms: p50=" << streamSummary.p50 << " p95=" << streamSummary.p95
+              << " p99=" << streamSummary.p99 << " max=" << streamSummary.max << std::endl;
+    if (!firstError.empty()) {
+        std::cout << "First error: " << firstError << std::endl;
+    }
+
+    std::stringstream report;
+    report << "{\n"
+           << "  \"server\": " << JsonString(server ? "in-process" : options.connect) << ",\n"
+           << "  \"clients\": " << options.clients << ",\n"
+           << "  \"requests_per_client\": " << options.requests << ",\n"
+           << "  \"warmup_per_client\": " << options.warmup << ",\n"
+           << "  \"ipc\": " << JsonString(options.ipc.ToString()) << ",\n";
+    if (server) {
+        report << "  \"coalesce_window_ms\": " << options.scan.coalesce_window.count() << ",\n"
+               << "  \"share_scans\": " << (options.scan.share ? "true" : "false") << ",\n";
+    } else {
+        /* Settings of a running server are not known here */
+        report << "  \"coalesce_window_ms\": null,\n"
+               << "  \"share_scans\": null,\n";
+    }
+    report << "  \"requests\": " << requests << ",\n"
+           << "  \"errors\": " << errors << ",\n"
+           << "  \"first_error\": " << JsonString(firstError) << ",\n"
+           << "  \"duration_s\": " << seconds << ",\n"
+           << "  \"rows\": " << rows << ",\n"
+           << "  \"bytes\": " << bytes << ",\n"
+           << "  \"rows_per_s\": " << rowsPerSecond << ",\n"
+           << "  \"mb_per_s\": " << megabytesPerSecond << ",\n"
+           << "  \"first_batch_ms\": " << JsonLatency(firstBatchSummary) << ",\n"
+           << "  \"stream_ms\": " << JsonLatency(streamSummary) << ",\n"
+           << "  \"tickets\": [";
+    for (size_t t = 0; t < distinctTickets.size(); t++) {
+        std::vector<double> ticketFirstBatch;
+        std::vector<double> ticketStream;
+        AddTimings(byTicket[t], &ticketFirstBatch, &ticketStream);
+        int64_t ticketErrors = std::count_if(byTicket[t].begin(), byTicket[t].end(),
+                                             [](const RequestTiming& timing) { return !timing.ok; });
+
+        report << (t == 0 ? "\n" : ",\n")
+               << "    {\"ticket\": " << JsonString(distinctTickets[t])
+               << ", \"weight\": " << std::count(options.tickets.begin(), options.tickets.end(), distinctTickets[t])
+               << ", \"requests\": " << byTicket[t].size()
+               << ", \"errors\": " << ticketErrors
+               << ", \"first_batch_ms\": " << JsonLatency(Summarize(ticketFirstBatch))
+               << ", \"stream_ms\": " << JsonLatency(Summarize(ticketStream)) << "}";
+    }
+    report << "\n  ]\n}\n";
+
+    std::ofstream reportFile(options.report);
+    reportFile << report.str();
+    if (!reportFile) {
+        return arrow::Status::IOError("Could not write report to ", options.report);
+    }
+    std::cout << "Report written to " << options.report << std::endl;
+
+    return arrow::Status::OK();
+}
+
+int main(int argc, char** argv) {
+    arrow::dataset::internal::Initialize();
+    arrow::Status st = RunMain(argc, argv);
+    if (!st.ok()) {
+        std::cerr << st << std::endl;
+        return 1;
+    }
+    return 0;
+}
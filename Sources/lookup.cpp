@@ -0,0 +1,209 @@
+//
+//  lookup.cpp
+//  ArrowAcero
+//
+#import "lookup.h"
+
+#include <sstream>
+
+#include <arrow/visit_data_inline.h>
+
+/* Calls valid(std::string_view) and null() for each value of a string array */
+template <typename Valid, typename Null> static arrow::Status VisitStrings(const arrow::ArraySpan& span, Valid&& valid, Null&& null) {
+    switch (span.type->id()) {
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            arrow::VisitArraySpanInline<arrow::StringType>(span, valid, null);
+            return arrow::Status::OK();
+        case arrow::Type::LARGE_STRING:
+        case arrow::Type::LARGE_BINARY:
+            arrow::VisitArraySpanInline<arrow::LargeStringType>(span, valid, null);
+            return arrow::Status::OK();
+        case arrow::Type::STRING_VIEW:
+        case arrow::Type::BINARY_VIEW:
+            arrow::VisitArraySpanInline<arrow::StringViewType>(span, valid, null);
+            return arrow::Status::OK();
+        default:
+            return arrow::Status::TypeError("Lookup keys must be strings, got ", span.type->ToString());
+    }
+}
+
+/* Dictionary encoded keys are looked up by their values */
+static arrow::Result<std::shared_ptr<arrow::Array>> DecodeKeys(const std::shared_ptr<arrow::Array>& keys) {
+    if (keys->type_id() != arrow::Type::DICTIONARY) {
+        return keys;
+    }
+    const auto& type = arrow::internal::checked_cast<const arrow::DictionaryType&>(*keys->type());
+    ARROW_ASSIGN_OR_RAISE(arrow::Datum decoded, cp::Cast(keys, type.value_type()));
+    return decoded.make_array();
+}
+
+arrow::Result<std::shared_ptr<LookupTable>> LookupTable::Make(const std::shared_ptr<arrow::Table>& table,
+                                                              const std::string& keyColumn) {
+    std::shared_ptr<LookupTable> lookup(new LookupTable());
+    lookup->key_column_ = keyColumn;
+    ARROW_ASSIGN_OR_RAISE(lookup->rows_, table->CombineChunksToBatch());
+
+    std::shared_ptr<arrow::Array> keys = lookup->rows_->GetColumnByName(keyColumn);
+    if (!keys) {
+        return arrow::Status::KeyError("No key column '", keyColumn, "' in lookup table");
+    }
+    ARROW_ASSIGN_OR_RAISE(keys, DecodeKeys(keys));
+    ARROW_ASSIGN_OR_RAISE(lookup->rows_, lookup->rows_->SetColumn(lookup->rows_->schema()->GetFieldIndex(keyColumn),
+                                                                  arrow::field(keyColumn, keys->type()), keys));
+
+    lookup->index_.reserve(keys->length());
+
+    int64_t row = 0;
+    ARROW_RETURN_NOT_OK(VisitStrings(*keys->data(),
+                                     [&](std::string_view key) {
+                                         if (!lookup->index_.emplace(key, row).second) {
+                                             lookup->duplicate_keys_++;
+                                         }
+                                         row++;
+                                     },
+                                     [&]() { row++; }));
+
+    return lookup;
+}
+
+int64_t LookupTable::Find(std::string_view key) const {
+    auto found = index_.find(key);
+    return found == index_.end() ? -1 : found->second;
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> LookupTable::Probe(const arrow::Array& keys, arrow::MemoryPool* pool) const {
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Array> values, DecodeKeys(arrow::MakeArray(keys.data())));
+
+    arrow::Int64Builder rows(pool);
+    ARROW_RETURN_NOT_OK(rows.Reserve(values->length()));
+
+    ARROW_RETURN_NOT_OK(VisitStrings(*values->data(),
+                                     [&](std::string_view key) {
+                                         int64_t row = Find(key);
+                                         if (row < 0) {
+                                             rows.UnsafeAppendNull();
+                                         } else {
+                                             rows.UnsafeAppend(row);
+                                         }
+                                     },
+                                     [&]() { rows.UnsafeAppendNull(); }));
+
+    return rows.Finish();
+}
+
+arrow::Result<std::shared_ptr<arrow::Array>> LookupTable::column(const std::string& name) const {
+    std::shared_ptr<arrow::Array> array = rows_->GetColumnByName(name);
+    if (!array) {
+        return arrow::Status::KeyError("No column '", name, "' in lookup table");
+    }
+    return array;
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ReadLookupFile(const std::string& path) {
+    std::string file_path;
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
+                          arrow::fs::FileSystemFromUriOrPath(path, &file_path));
+
+    std::shared_ptr<arrow::dataset::FileFormat> format;
+    std::string extension = file_path.substr(std::min(file_path.rfind('.'), file_path.size()));
+    if (extension == ".arrow" || extension == ".ipc" || extension == ".feather") {
+        format = std::make_shared<arrow::dataset::IpcFileFormat>();
+    } else {
+        format = std::make_shared<arrow::dataset::ParquetFileFormat>();
+    }
+
+    ARROW_ASSIGN_OR_RAISE(auto factory, arrow::dataset::FileSystemDatasetFactory::Make(filesystem, {file_path}, format, {}));
+    ARROW_ASSIGN_OR_RAISE(auto dataset, factory->Finish());
+
+    ARROW_ASSIGN_OR_RAISE(auto scanner_builder, dataset->NewScan());
+    ARROW_RETURN_NOT_OK(scanner_builder->UseThreads(true));
+    ARROW_ASSIGN_OR_RAISE(auto scanner, scanner_builder->Finish());
+
+    return scanner->ToTable();
+}
+
+std::string LookupCacheStats::ToString() const {
+    std::stringstream ss;
+    ss << "builds=" << builds << " hits=" << hits << " evictions=" << evictions << " build_ms=" << build_ms;
+    return ss.str();
+}
+
+LookupTableCache* LookupTableCache::Global() {
+    static LookupTableCache cache;
+    return &cache;
+}
+
+arrow::Result<std::shared_ptr<const LookupTable>> LookupTableCache::Get(const std::string& path, const std::string& keyColumn) {
+    std::pair<std::string, std::string> key{path, keyColumn};
+    std::shared_ptr<Entry> entry;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& slot = entries_[key];
+        if (!slot) {
+            slot = std::make_shared<Entry>();
+        }
+        slot->last_use = ++uses_;
+        entry = slot;
+        
+        /* Plans still holding a dropped table keep it alive until they finish */
+        if (entries_.size() > capacity_) {
+            auto oldest = std::min_element(entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+                return a.second->last_use < b.second->last_use;
+            });
+            entries_.erase(oldest);
+            stats_.evictions++;
+        }
+    }
+
+    /* Only requests for the same table wait here while it is built */
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (entry->table) {
+        std::lock_guard<std::mutex> stats_lock(mutex_);
+        stats_.hits++;
+        return entry->table;
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto built = [&]() -> arrow::Result<std::shared_ptr<LookupTable>> {
+        ARROW_ASSIGN_OR_RAISE(auto table, ReadLookupFile(path));
+        return LookupTable::Make(table, keyColumn);
+    }();
+    if (!built.ok()) {
+        /* The next request tries again instead of finding an empty entry */
+        std::lock_guard<std::mutex> erase_lock(mutex_);
+        auto failed = entries_.find(key);
+        if (failed != entries_.end() && failed->second == entry) {
+            entries_.erase(failed);
+        }
+        return built.status();
+    }
+    std::shared_ptr<LookupTable> lookup = std::move(built).ValueOrDie();
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+
+    entry->table = std::move(lookup);
+    {
+        std::lock_guard<std::mutex> stats_lock(mutex_);
+        stats_.builds++;
+        stats_.build_ms += duration.count();
+    }
+    return entry->table;
+}
+
+void LookupTableCache::Invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto entry = entries_.begin(); entry != entries_.end();) {
+        if (entry->first.first == path) {
+            entry = entries_.erase(entry);
+        } else {
+            entry++;
+        }
+    }
+}
+
+LookupCacheStats LookupTableCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
@@ -0,0 +1,112 @@
+//
+//  lookup.h
+//  ArrowAcero
+//
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Build side of a lookup join: the rows of a lookup file in one batch and
+ * a hash table from the values of its string key column to their row.
+ * Nothing changes once it is built, so any number of plans and threads
+ * probe it at the same time.
+ */
+class LookupTable {
+public:
+    static arrow::Result<std::shared_ptr<LookupTable>> Make(const std::shared_ptr<arrow::Table>& table,
+                                                            const std::string& keyColumn);
+
+    const std::shared_ptr<arrow::Schema>& schema() const { return rows_->schema(); }
+    const std::string& key_column() const { return key_column_; }
+    int64_t num_rows() const { return rows_->num_rows(); }
+    // Keys that appear more than once, only their first row is found
+    int64_t duplicate_keys() const { return duplicate_keys_; }
+
+    // Row of key, -1 if it is not in the table
+    int64_t Find(std::string_view key) const;
+
+    // Rows of the string values in keys, null where a key is null or not found
+    arrow::Result<std::shared_ptr<arrow::Array>> Probe(const arrow::Array& keys, arrow::MemoryPool* pool) const;
+
+    arrow::Result<std::shared_ptr<arrow::Array>> column(const std::string& name) const;
+
+private:
+    LookupTable() = default;
+
+    std::string key_column_;
+    std::shared_ptr<arrow::RecordBatch> rows_;
+    // Views into the key column of rows_
+    std::unordered_map<std::string_view, int64_t> index_;
+    int64_t duplicate_keys_ = 0;
+};
+
+/* Reads a Parquet or IPC (.arrow, .ipc, .feather) file or URI into a table */
+arrow::Result<std::shared_ptr<arrow::Table>> ReadLookupFile(const std::string& path);
+
+struct LookupCacheStats {
+    int64_t builds = 0;
+    int64_t hits = 0;
+    // Tables dropped to stay within the capacity of the cache
+    int64_t evictions = 0;
+    // Time spent reading lookup files and building their tables
+    int64_t build_ms = 0;
+
+    std::string ToString() const;
+};
+
+/*
+ * Lookup tables by file and key column, built on first use and shared by
+ * every plan and Flight request of the process afterwards. Concurrent
+ * first requests wait for one build instead of building it twice. At
+ * most capacity tables are kept, the least recently used one is dropped
+ * first, and a failed build is not kept.
+ */
+class LookupTableCache {
+public:
+    static constexpr size_t kDefaultCapacity = 16;
+
+    explicit LookupTableCache(size_t capacity = kDefaultCapacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+
+    static LookupTableCache* Global();
+
+    arrow::Result<std::shared_ptr<const LookupTable>> Get(const std::string& path, const std::string& keyColumn);
+
+    // Drops the tables of path, e.g. after the file was replaced
+    void Invalidate(const std::string& path);
+
+    LookupCacheStats stats();
+
+private:
+    struct Entry {
+        std::mutex mutex;
+        std::shared_ptr<const LookupTable> table;
+        // Value of uses_ at the last Get, the smallest one is dropped first
+        uint64_t last_use = 0;
+    };
+
+    size_t capacity_;
+    std::mutex mutex_;
+    uint64_t uses_ = 0;
+    // By path, then key column
+    std::map<std::pair<std::string, std::string>, std::shared_ptr<Entry>> entries_;
+    LookupCacheStats stats_;
+};
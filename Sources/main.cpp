@@ -19,13 +19,31 @@
 #import "sinks.h"
 #import "sample.h"
 #import "udf.h"
+#import "custom_nodes.h"
+#import "prepared.h"
+#import "executor.h"
+#import "io_stats.h"
+#import "optimizer.h"
+#import "metrics.h"
+#import "lookup.h"
+#import "state.h"
 
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
 
 
-arrow::Status RunMain() {
-    RegisterCustomFunctions();
+arrow::Status RunMain(const ExecutorOptions& executorOptions) {
+    ARROW_RETURN_NOT_OK(RegisterCustomFunctions());
+    ARROW_RETURN_NOT_OK(RegisterCustomNodes());
+    
+    /*
+     * With a plan thread budget the plans below run on their own pool,
+     * otherwise (nullptr) on the global CPU pool
+     */
+    std::shared_ptr<arrow::internal::ThreadPool> planExecutor;
+    if (executorOptions.plan_threads > 0) {
+        ARROW_ASSIGN_OR_RAISE(planExecutor, MakePlanExecutor(executorOptions.plan_threads, executorOptions));
+    }
     
     /*
      * Calculate the quantile
@@ -41,10 +59,22 @@ arrow::Status RunMain() {
     ac::Declaration sourceNode = RecordBatchSourceNode(reader);
     
     // ARROW_ASSIGN_OR_RAISE(ac::Declaration sourceNode, OpenDatasetNode("file:///Users/herold/Desktop/test/parquet"));
-    ac::Declaration calcQuantileNode = CalcQuantileNode(sourceNode, 0.995);
+    
+    /*
+     * Counts per group are spilled to disk above the threshold, small
+     * here so the sample data already spills
+     */
+    SpillOptions spillOptions;
+    spillOptions.memory_threshold = 16 * 1024;
+    spillOptions.num_partitions = 8;
+    
+    SpillStats spillStats;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration calcQuantileNode, CalcQuantileNode(sourceNode, 0.995, spillOptions, &spillStats));
     
     std::shared_ptr<arrow::Table> table;
-    ARROW_ASSIGN_OR_RAISE(table, ExecutePlanToTable(calcQuantileNode));
+    ARROW_ASSIGN_OR_RAISE(table, ExecutePlanToTable(calcQuantileNode, planExecutor.get()));
+    
+    std::cout << "Spilled group counts: " << spillStats.ToString() << std::endl;
     
     std::shared_ptr<arrow::DoubleScalar> quantile;
     ARROW_ASSIGN_OR_RAISE(quantile, TableToDoubleScalar(table));
@@ -59,6 +89,52 @@ arrow::Status RunMain() {
     startTime = std::chrono::high_resolution_clock::now();
     /* Measure timing */
     
+    /*
+     * The same quantile from the counts of 10% of the groups, with its interval
+     */
+    std::shared_ptr<arrow::RecordBatchReader> sampleReader;
+    ARROW_ASSIGN_OR_RAISE(sampleReader, CreateRecordBatchReader());
+    
+    std::shared_ptr<arrow::Table> sampledCounts;
+    ARROW_ASSIGN_OR_RAISE(sampledCounts, ExecutePlanToTable(SampledGroupCountNode(RecordBatchSourceNode(sampleReader), 0.1),
+                                                            planExecutor.get()));
+    
+    ARROW_ASSIGN_OR_RAISE(QuantileEstimate estimate, EstimateQuantile(sampledCounts, "Count(value)", 0.995));
+    std::cout << "Estimated quantile: " << estimate.ToString() << " (exact " << quantile->value << ")" << std::endl;
+    
+    /* Measure timing */
+    endTime = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    std::cout << "-- Execution duration: " << duration.count() << "ms\n";
+    startTime = std::chrono::high_resolution_clock::now();
+    /* Measure timing */
+    
+    /*
+     * The same quantile from per group counts kept between runs, only
+     * partitions that were not merged before are counted
+     */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> appendedPartitions;
+    ARROW_ASSIGN_OR_RAISE(appendedPartitions, CreatePartitionReaders(4, 3));
+    
+    std::vector<GroupCountPartition> countPartitions;
+    for (size_t i = 0; i < appendedPartitions.size(); i++) {
+        countPartitions.push_back({"partition-" + std::to_string(i), RecordBatchSourceNode(appendedPartitions[i])});
+    }
+    
+    GroupCountState countState;
+    ARROW_ASSIGN_OR_RAISE(countState, UpdateGroupCountState("file:///tmp/acero-group-counts.arrow", std::move(countPartitions), "group", 0.995));
+    
+    std::cout << "Quantile from the kept counts: " << countState.threshold
+              << " over " << countState.merged_partitions.size() << " partitions, "
+              << countState.excluded->length() << " groups excluded" << std::endl;
+    
+    /* Measure timing */
+    endTime = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    std::cout << "-- Execution duration: " << duration.count() << "ms\n";
+    startTime = std::chrono::high_resolution_clock::now();
+    /* Measure timing */
+    
     /*
      * Filter values with count larger than 10
      */
@@ -68,17 +144,26 @@ arrow::Status RunMain() {
     ARROW_ASSIGN_OR_RAISE(reader2, CreateRecordBatchReader());
     
     ac::Declaration sourceNode2 = RecordBatchSourceNode(reader2);
-    ac::Declaration valuesLargerThanNode = AggregateValuesGreaterEqualThanNode(sourceNode2, "group", quantile->value);
+    SpillStats spillStats2;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration valuesLargerThanNode,
+                          AggregateValuesGreaterEqualThanNode(sourceNode2, "group", quantile->value, spillOptions, &spillStats2));
     
     std::shared_ptr<arrow::Table> table2;
-    ARROW_ASSIGN_OR_RAISE(table2, ExecutePlanToTable(valuesLargerThanNode));
+    ARROW_ASSIGN_OR_RAISE(table2, ExecutePlanToTable(valuesLargerThanNode, planExecutor.get()));
     
     std::shared_ptr<arrow::ChunkedArray> array;
     ARROW_ASSIGN_OR_RAISE(array, TableToArray(table2));
     
+    std::cout << "Spilled group counts: " << spillStats2.ToString() << std::endl;
     std::cout << "Excluded groups: " << std::endl;
     std::cout << array->ToString() << std::endl;
     
+    std::shared_ptr<arrow::Table> topGroups;
+    ARROW_ASSIGN_OR_RAISE(topGroups, ExecutePlanToTable(TopKNode(TableSourceNode(table2), "count", 3), planExecutor.get()));
+    
+    std::cout << "Top excluded groups: " << std::endl;
+    std::cout << topGroups->ToString() << std::endl;
+    
     /* Measure timing */
     endTime = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -91,14 +176,32 @@ arrow::Status RunMain() {
      */
     std::cout << "Filtering orginal list by value set..." << std::endl;
     
+    /*
+     * Prepared once, bound to the sample source below and to the cached rows
+     * when writing the dataset
+     */
+    std::shared_ptr<PreparedPlan> valueSetPlan;
+    ARROW_ASSIGN_OR_RAISE(valueSetPlan, PreparedPlan::Prepare(FilterNotInValueSet(PlaceholderSourceNode(CreateSampleSchema()),
+                                                                                  "group",
+                                                                                  ValueSetParameter("excluded")),
+                                                              {{"excluded", array}}));
+    
     std::shared_ptr<arrow::RecordBatchReader> reader3;
     ARROW_ASSIGN_OR_RAISE(reader3, CreateRecordBatchReader());
     
     ac::Declaration sourceNode3 = RecordBatchSourceNode(reader3);
-    ac::Declaration valueSetFilter = FilterNotInValueSet(sourceNode3, "group", array);
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration valueSetFilter, valueSetPlan->Bind({{"excluded", array}}, sourceNode3));
+    
+    /*
+     * The filtered rows are cached once and mapped whenever they are read again
+     */
+    std::string filteredCache = "file:///tmp/acero-filtered.arrow";
+    ARROW_RETURN_NOT_OK(ExecutePlanToIpcCache(valueSetFilter, filteredCache));
+    
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration filteredNode3, OpenIpcCacheNode(filteredCache));
     
     std::shared_ptr<arrow::Table> table3;
-    ARROW_ASSIGN_OR_RAISE(table3, ExecutePlanToTable(valueSetFilter));
+    ARROW_ASSIGN_OR_RAISE(table3, ExecutePlanToTable(filteredNode3, planExecutor.get()));
     
     std::cout << "Final results" << std::endl;
     std::cout << table3->ToString() << std::endl;
@@ -114,10 +217,13 @@ arrow::Status RunMain() {
      */
     std::cout << "Combined filtering and parsing..." << std::endl;
     
-    std::shared_ptr<arrow::RecordBatchReader> reader4;
-    ARROW_ASSIGN_OR_RAISE(reader4, CreateRecordBatchReader());
+    /* The batches are created and parsed by one task per partition instead of one reader */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions4;
+    ARROW_ASSIGN_OR_RAISE(partitions4, CreatePartitionReaders(4, 3));
     
-    ac::Declaration sourceNode4 = RecordBatchSourceNode(reader4);
+    PartitionedSourceOptions partitionOptions;
+    partitionOptions.executor = planExecutor.get();
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration sourceNode4, PartitionedSourceNode(partitions4, partitionOptions));
     
     ac::Declaration projectNode41 = ProjectNode("replace_substring_regex",
                                                 sourceNode4,
@@ -178,12 +284,141 @@ arrow::Status RunMain() {
    
 
     
+    /*
+     * Collapse the chain of projects before running it, the struct is
+     * only needed for its fields
+     */
+    std::vector<std::string> parsedColumns = {"group", "date", "dateParsed", "value", "url"};
+    parsedColumns.insert(parsedColumns.end(), fields.begin(), fields.end());
+    
+    OptimizerStats optimizerStats;
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration parsedNode, OptimizeDeclaration(*lastNode, parsedColumns, &optimizerStats));
+    std::cout << "Optimizer: " << optimizerStats.ToString() << std::endl;
+    
     std::shared_ptr<arrow::Table> table4;
-    ARROW_ASSIGN_OR_RAISE(table4, ExecutePlanToTable(*lastNode));
+    ARROW_ASSIGN_OR_RAISE(table4, ExecutePlanToTable(parsedNode, planExecutor.get()));
     
     std::cout << "Final results" << std::endl;
     std::cout << table4->ToString() << std::endl;
     
+    /*
+     * The excluded groups, regex and comparison filters over the parsed
+     * rows run as one adaptive filter, cheap and selective conjuncts first
+     * and the regex only on the rows they keep
+     */
+    ac::Declaration adaptiveNode = AdaptiveFilterNode(FilterGreaterEqualNode(FilterByRegexNode(FilterNotInValueSet(TableSourceNode(table4),
+                                                                                                                   "group",
+                                                                                                                   array),
+                                                                                               "url",
+                                                                                               "^https?://[^/]+/"),
+                                                                             "value",
+                                                                             10));
+    
+    std::shared_ptr<arrow::Table> adaptiveTable;
+    ARROW_ASSIGN_OR_RAISE(adaptiveTable, ExecutePlanToTable(adaptiveNode, planExecutor.get()));
+    
+    std::cout << "Rows left by the adaptive filter: " << adaptiveTable->num_rows() << " of " << table4->num_rows() << std::endl;
+    
+    /*
+     * Hourly counts per group over the parsed dates
+     */
+    WindowOptions windowOptions;
+    windowOptions.size = 1;
+    windowOptions.unit = cp::CalendarUnit::HOUR;
+    
+    auto countOptions = std::make_shared<cp::CountOptions>(cp::CountOptions::ONLY_VALID);
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration windowNode, WindowAggregateNode(TableSourceNode(table4),
+                                                                          {"group"},
+                                                                          {{"hash_count", countOptions, "value", "count"}},
+                                                                          windowOptions));
+    
+    std::shared_ptr<arrow::Table> windowTable;
+    ARROW_ASSIGN_OR_RAISE(windowTable, ExecutePlanToTable(windowNode, planExecutor.get()));
+    
+    std::cout << "Hourly counts" << std::endl;
+    std::cout << windowTable->ToString() << std::endl;
+    
+    /*
+     * Unique hosts per group, estimated from a few KB of sketch per group
+     */
+    std::shared_ptr<arrow::Table> uniqueHosts;
+    ARROW_ASSIGN_OR_RAISE(uniqueHosts, ExecutePlanToTable(GroupApproxCountDistinctNode(TableSourceNode(table4), "group", "host", "unique_hosts"),
+                                                          planExecutor.get()));
+    
+    std::cout << "Unique hosts" << std::endl;
+    std::cout << uniqueHosts->ToString() << std::endl;
+
+    /*
+     * Visits per host, requests less than 30 minutes apart are one visit
+     */
+    std::shared_ptr<arrow::Table> hostSessions;
+    ARROW_ASSIGN_OR_RAISE(hostSessions, ExecutePlanToTable(GroupSessionCountNode(TableSourceNode(table4), "host", "dateParsed", "sessions"),
+                                                           planExecutor.get()));
+    
+    std::cout << "Sessions per host" << std::endl;
+    std::cout << hostSessions->ToString() << std::endl;
+
+    /*
+     * Rows per host category from a lookup file, its hash table is built
+     * by the first plan and reused by every later plan and Flight request
+     */
+    arrow::StringBuilder categoryHostBuilder;
+    arrow::StringBuilder categoryBuilder;
+    ARROW_RETURN_NOT_OK(categoryHostBuilder.AppendValues({"www.test.d2te", "www.example.com"}));
+    ARROW_RETURN_NOT_OK(categoryBuilder.AppendValues({"test", "example"}));
+    
+    std::shared_ptr<arrow::Array> categoryHosts;
+    ARROW_ASSIGN_OR_RAISE(categoryHosts, categoryHostBuilder.Finish());
+    std::shared_ptr<arrow::Array> categories;
+    ARROW_ASSIGN_OR_RAISE(categories, categoryBuilder.Finish());
+    
+    auto categoryTable = arrow::Table::Make(arrow::schema({arrow::field("host", arrow::utf8()), arrow::field("category", arrow::utf8())}),
+                                            {categoryHosts, categories});
+    
+    std::string categoryPath = "file:///tmp/acero-host-categories.arrow";
+    ARROW_RETURN_NOT_OK(ExecutePlanToIpcCache(TableSourceNode(categoryTable), categoryPath));
+    LookupTableCache::Global()->Invalidate(categoryPath);
+    
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration categoryNode, LookupJoinNode(TableSourceNode(table4), "host", categoryPath, "host", {"category"}));
+    
+    std::shared_ptr<arrow::Table> categoryCounts;
+    ARROW_ASSIGN_OR_RAISE(categoryCounts, ExecutePlanToTable(GroupCountNode(categoryNode, "category", "count"), planExecutor.get()));
+    
+    std::cout << "Rows per host category" << std::endl;
+    std::cout << categoryCounts->ToString() << std::endl;
+    std::cout << "Lookup tables: " << LookupTableCache::Global()->stats().ToString() << std::endl;
+
+    /*
+     * Rows per registrable domain, e.g. shop.example.co.uk counts for example.co.uk
+     */
+    ac::Declaration domainNode = ProjectNode("registrable_domain",
+                                             TableSourceNode(table4),
+                                             {"value"},
+                                             "host",
+                                             "domain",
+                                             nullptr);
+
+    std::shared_ptr<arrow::Table> domainCounts;
+    ARROW_ASSIGN_OR_RAISE(domainCounts, ExecutePlanToTable(GroupCountNode(domainNode, "domain", "count"), planExecutor.get()));
+
+    std::cout << "Rows per domain" << std::endl;
+    std::cout << domainCounts->ToString() << std::endl;
+
+    /* Measure timing */
+    endTime = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    std::cout << "-- Execution duration: " << duration.count() << "ms\n";
+    /* Measure timing */
+    
+    /*
+     * Filter and write dataset, the prepared plan is bound again to the
+     * cached rows
+     */
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration sourceNode5, OpenIpcCacheNode(filteredCache));
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration filteredNode5, valueSetPlan->Bind({{"excluded", array}}, sourceNode5));
+    
+    ARROW_RETURN_NOT_OK(ExecutePlanToDataset(filteredNode5, "file:///Users/herold/Desktop/test/parquet"));
+    
     /* Measure timing */
     endTime = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
@@ -191,15 +426,20 @@ arrow::Status RunMain() {
     /* Measure timing */
     
     /*
-     * Filter and write dataset
+     * Scan the written dataset back with tuned readahead and pre-buffering
      */
-    std::shared_ptr<arrow::RecordBatchReader> reader5;
-    ARROW_ASSIGN_OR_RAISE(reader5, CreateRecordBatchReader());
+    startTime = std::chrono::high_resolution_clock::now();
     
-    ac::Declaration sourceNode5 = RecordBatchSourceNode(reader5);
-    ac::Declaration valueSetFilter3 = FilterNotInValueSet(sourceNode5, "group", array);
+    ScanTuningOptions scanTuning;
+    scanTuning.io_stats = std::make_shared<IOStats>();
     
-    ARROW_RETURN_NOT_OK(ExecutePlanToDataset(valueSetFilter3, "file:///Users/herold/Desktop/test/parquet"));
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration scanNode, OpenDatasetNode("file:///Users/herold/Desktop/test/parquet", scanTuning));
+    
+    std::shared_ptr<arrow::Table> table6;
+    ARROW_ASSIGN_OR_RAISE(table6, ExecutePlanToTable(scanNode, planExecutor.get()));
+    
+    std::cout << "Scanned rows: " << table6->num_rows() << std::endl;
+    std::cout << "Scan I/O: " << scanTuning.io_stats->ToString() << std::endl;
     
     /* Measure timing */
     endTime = std::chrono::high_resolution_clock::now();
@@ -207,14 +447,54 @@ arrow::Status RunMain() {
     std::cout << "-- Execution duration: " << duration.count() << "ms\n";
     /* Measure timing */
     
+    /*
+     * Merge partitions that are each sorted by value into one ordered stream
+     */
+    startTime = std::chrono::high_resolution_clock::now();
+    
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> sortedPartitions;
+    ARROW_ASSIGN_OR_RAISE(sortedPartitions, CreatePartitionReaders(4, 1));
+    
+    ARROW_ASSIGN_OR_RAISE(ac::Declaration mergeNode, SortedMergeNode(sortedPartitions, {cp::SortKey("value")}, 64 * 1024, planExecutor.get()));
+    
+    std::shared_ptr<arrow::Table> merged;
+    ARROW_ASSIGN_OR_RAISE(merged, ExecutePlanToTable(mergeNode, planExecutor.get()));
+    
+    std::cout << "Merged rows: " << merged->num_rows() << std::endl;
+    std::cout << merged->Slice(0, 8)->ToString() << std::endl;
+    
+    /* Measure timing */
+    endTime = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(endTime - startTime);
+    std::cout << "-- Execution duration: " << duration.count() << "ms\n";
+    /* Measure timing */
+    
+    /*
+     * What the custom kernels did over all plans above
+     */
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Table> kernelMetrics, MetricsRegistry::Global()->SnapshotTable());
+    std::cout << "Kernel metrics" << std::endl;
+    std::cout << kernelMetrics->ToString() << std::endl;
+    
     return arrow::Status::OK();
 }
 
-int main() {
+int main(int argc, char** argv) {
+    arrow::Result<ExecutorOptions> executorOptions = ParseExecutorOptions(argc, argv);
+    arrow::Status st = executorOptions.status();
+    if (st.ok()) {
+        st = ConfigureExecutors(*executorOptions);
+    }
+    if (!st.ok()) {
+        std::cerr << st << std::endl;
+        return 1;
+    }
+    
+    std::cout << "Executor options: " << executorOptions->ToString() << std::endl;
     std::cout << "Thread CPU Pool capacity: " << arrow::GetCpuThreadPoolCapacity() << std::endl;
     std::cout << "Thread I/O Pool capacity: " << arrow::io::GetIOThreadPoolCapacity() << std::endl;
     arrow::dataset::internal::Initialize();
-    arrow::Status st = RunMain();
+    st = RunMain(*executorOptions);
     if (!st.ok()) {
         std::cerr << st << std::endl;
         return 1;
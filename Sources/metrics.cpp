@@ -0,0 +1,154 @@
+//
+//  metrics.cpp
+//  ArrowAcero
+//
+#import "metrics.h"
+
+void KernelMetrics::Merge(const KernelMetrics& other) {
+    invocations += other.invocations;
+    rows += other.rows;
+    bytes_in += other.bytes_in;
+    bytes_out += other.bytes_out;
+    parse_failures += other.parse_failures;
+    null_outputs += other.null_outputs;
+    nanos += other.nanos;
+}
+
+MetricsRegistry* MetricsRegistry::Global() {
+    /* Never destroyed, threads exiting after main still retire their counters into it */
+    static MetricsRegistry* registry = new MetricsRegistry();
+    return registry;
+}
+
+int MetricsRegistry::Register(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = std::find(names_.begin(), names_.end(), name);
+    if (found != names_.end()) {
+        return static_cast<int>(found - names_.begin());
+    }
+    if (names_.size() >= kMaxKernels) {
+        return -1;
+    }
+    names_.push_back(name);
+    return static_cast<int>(names_.size() - 1);
+}
+
+class MetricsRegistry::LocalCounters {
+public:
+    explicit LocalCounters(MetricsRegistry* registry) : registry_(registry), counters_(std::make_unique<ThreadCounters>()) {
+        std::lock_guard<std::mutex> lock(registry_->mutex_);
+        registry_->threads_.push_back(counters_.get());
+    }
+
+    ~LocalCounters() { registry_->Retire(counters_.get()); }
+
+    ThreadCounters* counters() const { return counters_.get(); }
+
+private:
+    MetricsRegistry* registry_;
+    std::unique_ptr<ThreadCounters> counters_;
+};
+
+MetricsRegistry::ThreadCounters* MetricsRegistry::Local() {
+    static thread_local LocalCounters local(this);
+    return local.counters();
+}
+
+KernelMetrics MetricsRegistry::Load(const Counters& counters) {
+    KernelMetrics metrics;
+    metrics.invocations = counters.invocations.load(std::memory_order_relaxed);
+    metrics.rows = counters.rows.load(std::memory_order_relaxed);
+    metrics.bytes_in = counters.bytes_in.load(std::memory_order_relaxed);
+    metrics.bytes_out = counters.bytes_out.load(std::memory_order_relaxed);
+    metrics.parse_failures = counters.parse_failures.load(std::memory_order_relaxed);
+    metrics.null_outputs = counters.null_outputs.load(std::memory_order_relaxed);
+    metrics.nanos = counters.nanos.load(std::memory_order_relaxed);
+    return metrics;
+}
+
+void MetricsRegistry::Retire(ThreadCounters* counters) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int id = 0; id < kMaxKernels; id++) {
+        retired_[id].Merge(Load((*counters)[id]));
+    }
+    threads_.erase(std::find(threads_.begin(), threads_.end(), counters));
+}
+
+/* Only the owning thread writes, a plain load and store is enough */
+static void Add(std::atomic<int64_t>& counter, int64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+void MetricsRegistry::Record(int id, const KernelMetrics& delta) {
+    if (id < 0 || id >= kMaxKernels) {
+        return;
+    }
+    Counters& counters = (*Local())[id];
+    Add(counters.invocations, delta.invocations);
+    Add(counters.rows, delta.rows);
+    Add(counters.bytes_in, delta.bytes_in);
+    Add(counters.bytes_out, delta.bytes_out);
+    Add(counters.parse_failures, delta.parse_failures);
+    Add(counters.null_outputs, delta.null_outputs);
+    Add(counters.nanos, delta.nanos);
+}
+
+std::vector<std::pair<std::string, KernelMetrics>> MetricsRegistry::Snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    std::vector<std::pair<std::string, KernelMetrics>> snapshot;
+    for (size_t id = 0; id < names_.size(); id++) {
+        KernelMetrics metrics = retired_[id];
+        for (const ThreadCounters* thread : threads_) {
+            metrics.Merge(Load((*thread)[id]));
+        }
+        snapshot.emplace_back(names_[id], metrics);
+    }
+    return snapshot;
+}
+
+std::shared_ptr<arrow::Schema> MetricsRegistry::SnapshotSchema() {
+    return arrow::schema({
+        arrow::field("kernel", arrow::utf8()),
+        arrow::field("invocations", arrow::int64()),
+        arrow::field("rows", arrow::int64()),
+        arrow::field("bytes_in", arrow::int64()),
+        arrow::field("bytes_out", arrow::int64()),
+        arrow::field("parse_failures", arrow::int64()),
+        arrow::field("null_outputs", arrow::int64()),
+        arrow::field("time_ns", arrow::int64())
+    });
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> MetricsRegistry::SnapshotTable() const {
+    arrow::StringBuilder kernel;
+    std::vector<arrow::Int64Builder> counters(7);
+    
+    for (const auto& [name, metrics] : Snapshot()) {
+        ARROW_RETURN_NOT_OK(kernel.Append(name));
+        int64_t values[] = {metrics.invocations, metrics.rows, metrics.bytes_in, metrics.bytes_out,
+                            metrics.parse_failures, metrics.null_outputs, metrics.nanos};
+        for (size_t i = 0; i < counters.size(); i++) {
+            ARROW_RETURN_NOT_OK(counters[i].Append(values[i]));
+        }
+    }
+    
+    std::vector<std::shared_ptr<arrow::Array>> columns(1 + counters.size());
+    ARROW_RETURN_NOT_OK(kernel.Finish(&columns[0]));
+    for (size_t i = 0; i < counters.size(); i++) {
+        ARROW_RETURN_NOT_OK(counters[i].Finish(&columns[i + 1]));
+    }
+    return arrow::Table::Make(SnapshotSchema(), columns);
+}
+
+std::shared_ptr<cp::KernelState> MakeKernelMetricsData(const std::string& name) {
+    return std::make_shared<KernelMetricsData>(MetricsRegistry::Global()->Register(name));
+}
+
+int KernelMetricsId(const cp::Kernel* kernel) {
+    if (kernel == nullptr || !kernel->data) {
+        return -1;
+    }
+    const auto* data = dynamic_cast<const KernelMetricsData*>(kernel->data.get());
+    return data ? data->id : -1;
+}
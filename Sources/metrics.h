@@ -0,0 +1,134 @@
+//
+//  metrics.h
+//  ArrowAcero
+//
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Counters of one kernel, summed over its invocations
+ */
+struct KernelMetrics {
+    int64_t invocations = 0;
+    int64_t rows = 0;
+    int64_t bytes_in = 0;
+    int64_t bytes_out = 0;
+    int64_t parse_failures = 0;
+    int64_t null_outputs = 0;
+    int64_t nanos = 0;
+
+    void Merge(const KernelMetrics& other);
+};
+
+/*
+ * Process wide kernel counters. Every thread writes its own counters
+ * without locking or atomic read-modify-write, a snapshot sums the
+ * counters of all threads. The counters of a thread are folded into
+ * retired totals and freed when the thread exits.
+ */
+class MetricsRegistry {
+public:
+    static constexpr int kMaxKernels = 64;
+
+    static MetricsRegistry* Global();
+
+    // Id of the counters named `name`, -1 once kMaxKernels are in use
+    int Register(const std::string& name);
+
+    // Adds `delta` to the calling thread's counters of `id`
+    void Record(int id, const KernelMetrics& delta);
+
+    std::vector<std::pair<std::string, KernelMetrics>> Snapshot() const;
+
+    // One row per kernel
+    arrow::Result<std::shared_ptr<arrow::Table>> SnapshotTable() const;
+    static std::shared_ptr<arrow::Schema> SnapshotSchema();
+
+private:
+    MetricsRegistry() = default;
+
+    struct Counters {
+        std::atomic<int64_t> invocations{0};
+        std::atomic<int64_t> rows{0};
+        std::atomic<int64_t> bytes_in{0};
+        std::atomic<int64_t> bytes_out{0};
+        std::atomic<int64_t> parse_failures{0};
+        std::atomic<int64_t> null_outputs{0};
+        std::atomic<int64_t> nanos{0};
+    };
+    using ThreadCounters = std::array<Counters, kMaxKernels>;
+    // Owns the counters of one thread, retires them when the thread exits
+    class LocalCounters;
+
+    static KernelMetrics Load(const Counters& counters);
+    ThreadCounters* Local();
+    // Adds the counters of an exiting thread to retired_, its LocalCounters frees them
+    void Retire(ThreadCounters* counters);
+
+    mutable std::mutex mutex_;
+    std::vector<std::string> names_;
+    // Counters of the running threads
+    std::vector<ThreadCounters*> threads_;
+    // Sums of the threads that exited
+    std::array<KernelMetrics, kMaxKernels> retired_;
+};
+
+/*
+ * Times one kernel invocation and records it with the counts added
+ * while it is alive. An id of -1 records nothing.
+ */
+class KernelMetricsScope {
+public:
+    KernelMetricsScope(int id, int64_t rows, int64_t bytes_in) : id_(id), start_(std::chrono::steady_clock::now()) {
+        metrics_.invocations = 1;
+        metrics_.rows = rows;
+        metrics_.bytes_in = bytes_in;
+    }
+
+    ~KernelMetricsScope() {
+        if (id_ >= 0) {
+            metrics_.nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+            MetricsRegistry::Global()->Record(id_, metrics_);
+        }
+    }
+
+    KernelMetrics& metrics() { return metrics_; }
+
+private:
+    int id_;
+    std::chrono::steady_clock::time_point start_;
+    KernelMetrics metrics_;
+};
+
+/*
+ * Kernel data naming the counters of a kernel, set on Kernel::data at
+ * registration so the kernel finds its counters through the context
+ */
+struct KernelMetricsData : public cp::KernelState {
+    explicit KernelMetricsData(int id) : id(id) {}
+
+    int id;
+};
+
+std::shared_ptr<cp::KernelState> MakeKernelMetricsData(const std::string& name);
+
+// Counters of a kernel registered with MakeKernelMetricsData, -1 otherwise
+int KernelMetricsId(const cp::Kernel* kernel);
@@ -1,12 +1,29 @@
 #import "nodes.h"
 #import "udf.h"
+#import "custom_nodes.h"
+#import "io_stats.h"
+#import "lookup.h"
+#import "sorted_merge.h"
+#import "sinks.h"
 
-arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path) {
+#include <arrow/io/interfaces.h>
+#include <arrow/ipc/api.h>
+#include <arrow/util/async_generator.h>
+#include <arrow/util/hashing.h>
+#include <arrow/util/thread_pool.h>
+#include <parquet/properties.h>
+
+static arrow::Result<std::shared_ptr<arrow::dataset::Dataset>> OpenParquetDataset(std::string dataset_path,
+                                                                                  std::shared_ptr<IOStats> io_stats) {
     std::string root_path;
     
     ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
                           arrow::fs::FileSystemFromUri(dataset_path, &root_path));
     
+    if (io_stats) {
+        filesystem = std::make_shared<CountingFileSystem>(filesystem, io_stats);
+    }
+    
     auto set_path = root_path;
     std::cout << "Opening dataset from " << set_path << std::endl;
     
@@ -33,6 +50,12 @@ arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path) {
         std::cout << "Found fragment: " << (*fragment)->ToString() << std::endl;
     }
     
+    return dataset;
+}
+
+arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path) {
+    ARROW_ASSIGN_OR_RAISE(auto dataset, OpenParquetDataset(dataset_path, nullptr));
+    
     auto scan_options = std::make_shared<arrow::dataset::ScanOptions>();
     scan_options->projection = cp::project({}, {});  // create empty projection
     
@@ -44,6 +67,130 @@ arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path) {
     return scan;
 }
 
+arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path, const ScanTuningOptions& tuning) {
+    ARROW_ASSIGN_OR_RAISE(auto dataset, OpenParquetDataset(dataset_path, tuning.io_stats));
+    
+    auto scan_options = std::make_shared<arrow::dataset::ScanOptions>();
+    scan_options->projection = cp::project({}, {});  // create empty projection
+    scan_options->use_threads = true;
+    scan_options->fragment_readahead = tuning.fragment_readahead;
+    scan_options->batch_readahead = tuning.batch_readahead;
+    scan_options->batch_size = tuning.batch_size;
+    if (tuning.io_executor != nullptr) {
+        scan_options->io_context = arrow::io::IOContext(arrow::default_memory_pool(), tuning.io_executor);
+    }
+    
+    /*
+     * Pre-buffering fetches the column chunks of a row group with few,
+     * coalesced reads instead of one read per page
+     */
+    auto cache_options = tuning.lazy_pre_buffer ? arrow::io::CacheOptions::LazyDefaults() : arrow::io::CacheOptions::Defaults();
+    cache_options.hole_size_limit = tuning.hole_size_limit;
+    cache_options.range_size_limit = tuning.range_size_limit;
+    
+    auto parquet_scan_options = std::make_shared<arrow::dataset::ParquetFragmentScanOptions>();
+    parquet_scan_options->arrow_reader_properties->set_pre_buffer(tuning.pre_buffer);
+    parquet_scan_options->arrow_reader_properties->set_cache_options(cache_options);
+    scan_options->fragment_scan_options = parquet_scan_options;
+    
+    auto scan_node_options = arrow::dataset::ScanNodeOptions{dataset, scan_options};
+    
+    ac::Declaration scan{"scan", std::move(scan_node_options)};
+    
+    return scan;
+}
+
+arrow::Result<ac::Declaration> OpenSampledDatasetNode(std::string dataset_path, double fraction, uint64_t seed) {
+    if (!(fraction > 0.0 && fraction <= 1.0)) {
+        return arrow::Status::Invalid("Sample fraction must be in (0, 1], got ", fraction);
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(auto dataset, OpenParquetDataset(dataset_path, nullptr));
+    auto file_dataset = std::static_pointer_cast<arrow::dataset::FileSystemDataset>(dataset);
+    
+    /* One fragment per row group, only the sampled ones go into the scanned dataset */
+    std::vector<std::shared_ptr<arrow::dataset::FileFragment>> sampled;
+    ARROW_ASSIGN_OR_RAISE(auto fragments, file_dataset->GetFragments());
+    for (auto fragment_result : fragments) {
+        ARROW_ASSIGN_OR_RAISE(auto fragment, std::move(fragment_result));
+        auto parquet_fragment = std::static_pointer_cast<arrow::dataset::ParquetFileFragment>(fragment);
+        ARROW_ASSIGN_OR_RAISE(auto row_group_fragments, parquet_fragment->SplitByRowGroup(cp::literal(true)));
+        
+        for (const auto& row_group_fragment : row_group_fragments) {
+            auto row_group = std::static_pointer_cast<arrow::dataset::ParquetFileFragment>(row_group_fragment);
+            
+            std::string key = row_group->source().path() + "#" + std::to_string(row_group->row_groups()[0]);
+            // Same on every platform and standard library, unlike std::hash
+            uint64_t hash = arrow::internal::ComputeStringHash<0>(key.data(), static_cast<int64_t>(key.size())) ^ seed;
+            hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33;
+            if (static_cast<double>(hash >> 11) * 0x1.0p-53 < fraction) {
+                sampled.push_back(row_group);
+            }
+        }
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(auto sampled_dataset,
+                          arrow::dataset::FileSystemDataset::Make(file_dataset->schema(),
+                                                                  file_dataset->partition_expression(),
+                                                                  file_dataset->format(),
+                                                                  file_dataset->filesystem(),
+                                                                  std::move(sampled)));
+    
+    auto scan_options = std::make_shared<arrow::dataset::ScanOptions>();
+    scan_options->projection = cp::project({}, {});  // create empty projection
+    
+    auto scan_node_options = arrow::dataset::ScanNodeOptions{sampled_dataset, scan_options};
+    
+    ac::Declaration scan{"scan", std::move(scan_node_options)};
+    
+    return scan;
+}
+
+/*
+ * Hands out the batches of an IPC file one after another. Buffers of
+ * a memory mapped file are slices of the mapping, so nothing is copied.
+ */
+class IpcFileBatchReader : public arrow::RecordBatchReader {
+public:
+    explicit IpcFileBatchReader(std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader) :
+        reader_(std::move(reader)) {}
+    
+    std::shared_ptr<arrow::Schema> schema() const override { return reader_->schema(); }
+    
+    arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override {
+        if (index_ >= reader_->num_record_batches()) {
+            *batch = nullptr;
+            return arrow::Status::OK();
+        }
+        ARROW_ASSIGN_OR_RAISE(*batch, reader_->ReadRecordBatch(index_++));
+        return arrow::Status::OK();
+    }
+    
+private:
+    std::shared_ptr<arrow::ipc::RecordBatchFileReader> reader_;
+    int index_ = 0;
+};
+
+arrow::Result<ac::Declaration> OpenIpcCacheNode(std::string cache_path) {
+    std::string path;
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
+                          arrow::fs::FileSystemFromUri(cache_path, &path));
+    if (filesystem->type_name() != "local") {
+        return arrow::Status::Invalid("IPC caches are memory mapped and must be local files, got ", cache_path);
+    }
+    
+    std::cout << "Mapping IPC cache " << path << std::endl;
+    
+    ARROW_ASSIGN_OR_RAISE(auto file, arrow::io::MemoryMappedFile::Open(path, arrow::io::FileMode::READ));
+    
+    /* Threads are only used to decompress the buffers of LZ4 caches */
+    ARROW_ASSIGN_OR_RAISE(auto reader, arrow::ipc::RecordBatchFileReader::Open(file, arrow::ipc::IpcReadOptions::Defaults()));
+    
+    return RecordBatchSourceNode(std::make_shared<IpcFileBatchReader>(std::move(reader)));
+}
+
 ac::Declaration CalcQuantileNode(ac::Declaration previousNode, double quantile) {
     auto options = std::make_shared<cp::CountOptions>(cp::CountOptions::ONLY_VALID);
     auto group_aggregate_options =
@@ -52,11 +199,53 @@ ac::Declaration CalcQuantileNode(ac::Declaration previousNode, double quantile)
     ac::Declaration group_aggregate{
         "aggregate", {std::move(previousNode)}, std::move(group_aggregate_options)};
     
+    return QuantileNode(std::move(group_aggregate), "Count(value)", quantile);
+}
+
+/* Counts of "value" per group of columnName, spilled to disk above the memory threshold */
+static arrow::Result<std::shared_ptr<arrow::Table>> SpillingGroupCount(ac::Declaration previousNode,
+                                                                      std::string columnName,
+                                                                      std::string countName,
+                                                                      const SpillOptions& spillOptions,
+                                                                      SpillStats* spillStats) {
+    auto count_options = std::make_shared<cp::CountOptions>(cp::CountOptions::ONLY_VALID);
+    return ExecutePlanToSpillingAggregate(std::move(previousNode),
+                                          {{"hash_count", count_options, "value", countName}},
+                                          {columnName},
+                                          spillOptions,
+                                          spillStats);
+}
+
+arrow::Result<ac::Declaration> CalcQuantileNode(ac::Declaration previousNode,
+                                                double quantile,
+                                                const SpillOptions& spillOptions,
+                                                SpillStats* spillStats) {
+    std::shared_ptr<arrow::Table> counts;
+    ARROW_ASSIGN_OR_RAISE(counts, SpillingGroupCount(std::move(previousNode), "group", "Count(value)", spillOptions, spillStats));
+    
+    return QuantileNode(TableSourceNode(std::move(counts)), "Count(value)", quantile);
+}
+
+ac::Declaration SampledGroupCountNode(ac::Declaration previousNode, double fraction, uint64_t seed) {
+    auto options = std::make_shared<cp::CountOptions>(cp::CountOptions::ONLY_VALID);
+    auto group_aggregate_options =
+    ac::AggregateNodeOptions{{{"hash_count", options, "value", "Count(value)"}},
+        {"group"}};
+    ac::Declaration group_aggregate{
+        "aggregate", {SampleNode(std::move(previousNode), SampleNodeOptions(SampleMethod::HASH, fraction, 0, {"group"}, seed))},
+        std::move(group_aggregate_options)};
+    
+    return group_aggregate;
+}
+
+ac::Declaration QuantileNode(ac::Declaration previousNode,
+                             std::string columnName,
+                             double quantile) {
     auto quantile_options = std::make_shared<cp::TDigestOptions>(quantile);
     auto aggregate_options =
-    ac::AggregateNodeOptions{/*aggregates=*/{{"tdigest", quantile_options, "Count(value)", "tdigest"}}};
+    ac::AggregateNodeOptions{/*aggregates=*/{{"tdigest", quantile_options, columnName, "tdigest"}}};
     ac::Declaration aggregate{
-        "aggregate", {std::move(group_aggregate)}, std::move(aggregate_options)};
+        "aggregate", {std::move(previousNode)}, std::move(aggregate_options)};
     
     return aggregate;
 }
@@ -65,20 +254,150 @@ ac::Declaration CalcQuantileNode(ac::Declaration previousNode, double quantile)
 ac::Declaration AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
                                                     std::string columnName,
                                                     double value) {
+    return AggregateValuesGreaterEqualThanNode(std::move(previousNode), columnName, cp::literal(value));
+}
+
+ac::Declaration AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
+                                                    std::string columnName,
+                                                    cp::Expression value) {
     /*
      * Aggregate values and count to a table
      */
+    ac::Declaration group_aggregate = GroupCountNode(std::move(previousNode), columnName, "count");
+    
+    return FilterGreaterEqualNode(std::move(group_aggregate), "count", value);
+}
+
+arrow::Result<ac::Declaration> AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
+                                                                std::string columnName,
+                                                                double value,
+                                                                const SpillOptions& spillOptions,
+                                                                SpillStats* spillStats) {
+    std::shared_ptr<arrow::Table> counts;
+    ARROW_ASSIGN_OR_RAISE(counts, SpillingGroupCount(std::move(previousNode), columnName, "count", spillOptions, spillStats));
+    
+    return FilterGreaterEqualNode(TableSourceNode(std::move(counts)), "count", value);
+}
+
+ac::Declaration SampleNode(ac::Declaration previousNode, SampleNodeOptions options) {
+    ac::Declaration sample{
+        "sample", {std::move(previousNode)}, std::move(options)};
+    
+    return sample;
+}
+
+ac::Declaration GroupCountNode(ac::Declaration previousNode,
+                               std::string columnName,
+                               std::string countName) {
     auto count_options = std::make_shared<cp::CountOptions>(cp::CountOptions::ONLY_VALID);
     auto group_aggregate_options =
-    ac::AggregateNodeOptions{{{"hash_count", count_options, "value", "count"}},
-        {"group"}};
+    ac::AggregateNodeOptions{{{"hash_count", count_options, "value", countName}},
+        {columnName}};
     
     ac::Declaration group_aggregate{
         "aggregate", {std::move(previousNode)}, std::move(group_aggregate_options)};
     
-    cp::Expression filter_expr = cp::greater_equal(cp::field_ref("count"), cp::literal(value));
+    return group_aggregate;
+}
+
+ac::Declaration GroupApproxCountDistinctNode(ac::Declaration previousNode,
+                                             std::string keyColumn,
+                                             std::string valueColumn,
+                                             std::string countName,
+                                             int precision) {
+    auto distinct_options = std::make_shared<ApproxCountDistinctOptions>(precision);
+    auto group_aggregate_options =
+    ac::AggregateNodeOptions{{{"hash_approx_count_distinct", distinct_options, valueColumn, countName}},
+        {keyColumn}};
+    
+    ac::Declaration group_aggregate{
+        "aggregate", {std::move(previousNode)}, std::move(group_aggregate_options)};
+    
+    return group_aggregate;
+}
+
+ac::Declaration GroupSessionCountNode(ac::Declaration previousNode,
+                                      std::string keyColumn,
+                                      std::string timeColumn,
+                                      std::string countName,
+                                      std::chrono::seconds gap) {
+    auto session_options = std::make_shared<SessionCountOptions>(gap);
+    auto group_aggregate_options =
+    ac::AggregateNodeOptions{{{"hash_session_count", session_options, timeColumn, countName}},
+        {keyColumn}};
+    
+    ac::Declaration group_aggregate{
+        "aggregate", {std::move(previousNode)}, std::move(group_aggregate_options)};
+    
+    return group_aggregate;
+}
+
+ac::Declaration TopKNode(ac::Declaration previousNode,
+                         std::string columnName,
+                         int64_t k,
+                         std::vector<std::string> partitionKeys) {
+    auto topk_options = TopKNodeOptions{columnName, k, cp::SortOrder::Descending, std::move(partitionKeys)};
+    
+    ac::Declaration topk{"topk", {std::move(previousNode)}, std::move(topk_options)};
+    
+    return topk;
+}
+
+ac::Declaration AdaptiveFilterNode(ac::Declaration filterChain) {
+    std::vector<cp::Expression> conjuncts;
+    ac::Declaration* input = &filterChain;
+    
+    while (input->factory_name == "filter" && input->inputs.size() == 1 &&
+           std::holds_alternative<ac::Declaration>(input->inputs[0])) {
+        const auto& options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*input->options);
+        conjuncts.push_back(options.filter_expression);
+        input = &std::get<ac::Declaration>(input->inputs[0]);
+    }
+    
+    if (conjuncts.empty()) {
+        return filterChain;
+    }
+    
+    // Declaration order, innermost filter first
+    std::reverse(conjuncts.begin(), conjuncts.end());
+    return AdaptiveFilterNode(*input, std::move(conjuncts));
+}
+
+ac::Declaration AdaptiveFilterNode(ac::Declaration previousNode,
+                                   std::vector<cp::Expression> conjuncts) {
+    ac::Declaration adaptive_filter{
+        "adaptive_filter", {std::move(previousNode)}, AdaptiveFilterNodeOptions(std::move(conjuncts))};
+    
+    return adaptive_filter;
+}
+
+arrow::Result<ac::Declaration> LookupJoinNode(ac::Declaration previousNode,
+                                              std::string keyColumn,
+                                              std::string lookupPath,
+                                              std::string lookupKey,
+                                              std::vector<std::string> valueColumns,
+                                              std::string prefix) {
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<const LookupTable> table, LookupTableCache::Global()->Get(lookupPath, lookupKey));
+    
+    ac::Declaration lookup_join{
+        "lookup_join", {std::move(previousNode)},
+        LookupJoinNodeOptions(std::move(table), std::move(keyColumn), std::move(valueColumns), std::move(prefix))};
+    
+    return lookup_join;
+}
+
+ac::Declaration FilterGreaterEqualNode(ac::Declaration previousNode,
+                                       std::string columnName,
+                                       double value) {
+    return FilterGreaterEqualNode(std::move(previousNode), columnName, cp::literal(value));
+}
+
+ac::Declaration FilterGreaterEqualNode(ac::Declaration previousNode,
+                                       std::string columnName,
+                                       cp::Expression value) {
+    cp::Expression filter_expr = cp::greater_equal(cp::field_ref(columnName), std::move(value));
     ac::Declaration filter_node{
-        "filter", {std::move(group_aggregate)}, ac::FilterNodeOptions(std::move(filter_expr))};
+        "filter", {std::move(previousNode)}, ac::FilterNodeOptions(std::move(filter_expr))};
     
     return filter_node;
 }
@@ -166,3 +485,243 @@ ac::Declaration RecordBatchSourceNode(std::shared_ptr<arrow::RecordBatchReader>
     
     return source;
 }
+
+arrow::Result<ac::Declaration> PartitionedSourceNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions) {
+    return PartitionedSourceNode(std::move(partitions), PartitionedSourceOptions());
+}
+
+arrow::Result<ac::Declaration> PartitionedSourceNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                                     const PartitionedSourceOptions& options) {
+    if (partitions.empty()) {
+        return arrow::Status::Invalid("A partitioned source needs at least one partition");
+    }
+    if (options.batch_readahead < 1 || options.partition_readahead < 0) {
+        return arrow::Status::Invalid("Partition readahead must not be negative and batch readahead at least 1");
+    }
+    
+    std::shared_ptr<arrow::Schema> schema = partitions[0]->schema();
+    arrow::internal::Executor* io_executor = options.io_executor ? options.io_executor : arrow::io::default_io_context().executor();
+    arrow::internal::Executor* executor = options.executor ? options.executor : arrow::internal::GetCpuThreadPool();
+    
+    /*
+     * Each partition is pulled by a background I/O task that stays up to
+     * batch_readahead batches ahead, batches are handed on from a CPU task
+     * so downstream work never runs on the reading task
+     */
+    using BatchGenerator = arrow::AsyncGenerator<std::shared_ptr<arrow::RecordBatch>>;
+    std::vector<BatchGenerator> partition_generators;
+    partition_generators.reserve(partitions.size());
+    for (auto& partition : partitions) {
+        if (!partition->schema()->Equals(*schema)) {
+            return arrow::Status::Invalid("Partition schema ", partition->schema()->ToString(),
+                                          " differs from ", schema->ToString());
+        }
+        auto batches = arrow::MakeFunctionIterator([partition]() { return partition->Next(); });
+        ARROW_ASSIGN_OR_RAISE(BatchGenerator background,
+                              arrow::MakeBackgroundGenerator(std::move(batches), io_executor, options.batch_readahead,
+                                                             std::max(1, options.batch_readahead / 2)));
+        partition_generators.push_back(arrow::MakeTransferredGenerator(std::move(background), executor));
+    }
+    
+    int concurrent = static_cast<int>(partitions.size());
+    if (options.partition_readahead > 0) {
+        concurrent = std::min(concurrent, options.partition_readahead);
+    }
+    
+    auto partition_source = arrow::MakeVectorGenerator(std::move(partition_generators));
+    BatchGenerator merged;
+    if (!options.preserve_order) {
+        merged = arrow::MakeMergedGenerator(std::move(partition_source), concurrent);
+    } else if (concurrent > 1) {
+        /* Later partitions are read ahead while the earlier ones are emitted */
+        ARROW_ASSIGN_OR_RAISE(merged, arrow::MakeSequencedMergedGenerator(std::move(partition_source), concurrent));
+    } else {
+        merged = arrow::MakeConcatenatedGenerator(std::move(partition_source));
+    }
+    
+    auto generator = arrow::MakeMappedGenerator(std::move(merged), [](const std::shared_ptr<arrow::RecordBatch>& batch) {
+        return std::optional<cp::ExecBatch>(cp::ExecBatch(*batch));
+    });
+    
+    auto source_node_options = ac::SourceNodeOptions{schema, std::move(generator),
+        options.preserve_order ? cp::Ordering::Implicit() : cp::Ordering::Unordered()};
+    
+    ac::Declaration source{"source", std::move(source_node_options)};
+    
+    return source;
+}
+
+arrow::Result<ac::Declaration> SortedMergeNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                               std::vector<cp::SortKey> keys,
+                                               int64_t batchSize,
+                                               arrow::internal::Executor* executor) {
+    ARROW_ASSIGN_OR_RAISE(auto merge, SortedMergeReader::Make(std::move(partitions), keys, batchSize));
+    
+    /* Partitions may block on reads, so the merge runs on the I/O pool and hands its batches to the executor */
+    arrow::internal::Executor* io_executor = arrow::io::default_io_context().executor();
+    if (executor == nullptr) {
+        executor = arrow::internal::GetCpuThreadPool();
+    }
+    auto batches = arrow::MakeFunctionIterator([merge]() { return merge->Next(); });
+    ARROW_ASSIGN_OR_RAISE(auto background, arrow::MakeBackgroundGenerator(std::move(batches), io_executor, 1, 1));
+    auto transferred = arrow::MakeTransferredGenerator(std::move(background), executor);
+    
+    auto generator = arrow::MakeMappedGenerator(std::move(transferred), [](const std::shared_ptr<arrow::RecordBatch>& batch) {
+        return std::optional<cp::ExecBatch>(cp::ExecBatch(*batch));
+    });
+    
+    auto source_node_options = ac::SourceNodeOptions{merge->schema(), std::move(generator), cp::Ordering(std::move(keys))};
+    
+    ac::Declaration source{"source", std::move(source_node_options)};
+    
+    return source;
+}
+
+arrow::Result<ac::Declaration> OpenSortedDatasetNode(std::string dataset_path,
+                                                     std::vector<cp::SortKey> keys,
+                                                     arrow::internal::Executor* executor) {
+    ARROW_ASSIGN_OR_RAISE(auto dataset, OpenParquetDataset(dataset_path, nullptr));
+    auto file_dataset = std::static_pointer_cast<arrow::dataset::FileSystemDataset>(dataset);
+    
+    /*
+     * One ordered scanner per file, each reads at most two batches ahead
+     * so memory stays bounded by the number of files
+     */
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions;
+    ARROW_ASSIGN_OR_RAISE(auto fragments, file_dataset->GetFragments());
+    for (auto fragment_result : fragments) {
+        ARROW_ASSIGN_OR_RAISE(auto fragment, std::move(fragment_result));
+        auto file_fragment = std::static_pointer_cast<arrow::dataset::FileFragment>(fragment);
+        
+        ARROW_ASSIGN_OR_RAISE(auto file_only,
+                              arrow::dataset::FileSystemDataset::Make(file_dataset->schema(),
+                                                                      file_dataset->partition_expression(),
+                                                                      file_dataset->format(),
+                                                                      file_dataset->filesystem(),
+                                                                      {file_fragment}));
+        ARROW_ASSIGN_OR_RAISE(auto scanner_builder, file_only->NewScan());
+        ARROW_RETURN_NOT_OK(scanner_builder->UseThreads(true));
+        ARROW_RETURN_NOT_OK(scanner_builder->BatchReadahead(2));
+        ARROW_RETURN_NOT_OK(scanner_builder->FragmentReadahead(1));
+        ARROW_ASSIGN_OR_RAISE(auto scanner, scanner_builder->Finish());
+        ARROW_ASSIGN_OR_RAISE(auto reader, scanner->ToRecordBatchReader());
+        partitions.push_back(std::move(reader));
+    }
+    
+    return SortedMergeNode(std::move(partitions), std::move(keys), 64 * 1024, executor);
+}
+
+ac::Declaration TableSourceNode(std::shared_ptr<arrow::Table> table) {
+    auto source_node_options = ac::TableSourceNodeOptions{table};
+    
+    ac::Declaration source{"table_source", std::move(source_node_options)};
+    
+    return source;
+}
+
+static arrow::Result<std::chrono::nanoseconds> CalendarUnitDuration(cp::CalendarUnit unit) {
+    switch (unit) {
+        case cp::CalendarUnit::NANOSECOND: return std::chrono::nanoseconds(1);
+        case cp::CalendarUnit::MICROSECOND: return std::chrono::microseconds(1);
+        case cp::CalendarUnit::MILLISECOND: return std::chrono::milliseconds(1);
+        case cp::CalendarUnit::SECOND: return std::chrono::seconds(1);
+        case cp::CalendarUnit::MINUTE: return std::chrono::minutes(1);
+        case cp::CalendarUnit::HOUR: return std::chrono::hours(1);
+        case cp::CalendarUnit::DAY: return std::chrono::hours(24);
+        case cp::CalendarUnit::WEEK: return std::chrono::hours(24 * 7);
+        default:
+            return arrow::Status::NotImplemented("Sliding windows need a fixed length unit");
+    }
+}
+
+/*
+ * Aggregate that combines partial results of the same aggregate
+ */
+static arrow::Result<cp::Aggregate> MergeAggregate(const cp::Aggregate& aggregate) {
+    std::string function;
+    if (aggregate.function == "hash_count" || aggregate.function == "hash_count_all" ||
+        aggregate.function == "hash_sum") {
+        function = "hash_sum";
+    } else if (aggregate.function == "hash_min" || aggregate.function == "hash_max") {
+        function = aggregate.function;
+    } else {
+        return arrow::Status::NotImplemented("Sliding windows cannot merge ", aggregate.function);
+    }
+    return cp::Aggregate{function, std::make_shared<cp::ScalarAggregateOptions>(), aggregate.name, aggregate.name};
+}
+
+arrow::Result<ac::Declaration> WindowAggregateNode(ac::Declaration previousNode,
+                                                   std::vector<std::string> keys,
+                                                   std::vector<cp::Aggregate> aggregates,
+                                                   WindowOptions options) {
+    if (options.slide == 0) {
+        options.slide = options.size;
+    }
+    if (options.size <= 0 || options.slide <= 0 || options.size % options.slide != 0) {
+        return arrow::Status::Invalid("Window size must be a positive multiple of the slide");
+    }
+    const bool tumbling = options.size == options.slide;
+    
+    /*
+     * Assign each row to its pane, for tumbling windows the pane is the window
+     */
+    std::string paneColumn = tumbling ? options.windowColumn : "__pane_start";
+    
+    std::vector<cp::Expression> expressions;
+    std::vector<std::string> names;
+    for (const auto& key : keys) {
+        expressions.push_back(cp::field_ref(key));
+        names.push_back(key);
+    }
+    for (const auto& aggregate : aggregates) {
+        for (const auto& target : aggregate.target) {
+            const std::string* name = target.name();
+            if (name == nullptr) {
+                return arrow::Status::Invalid("Window aggregates must target columns by name");
+            }
+            if (std::find(names.begin(), names.end(), *name) == names.end()) {
+                expressions.push_back(cp::field_ref(*name));
+                names.push_back(*name);
+            }
+        }
+    }
+    expressions.push_back(cp::call("floor_temporal", {cp::field_ref(options.timeColumn)},
+                                   cp::RoundTemporalOptions(options.slide, options.unit)));
+    names.push_back(paneColumn);
+    
+    ac::Declaration pane_node{
+        "project", {std::move(previousNode)}, ac::ProjectNodeOptions(std::move(expressions), std::move(names))};
+    
+    /*
+     * Ordered input is segmented by pane, every pane is emitted
+     * as soon as the next one starts
+     */
+    std::vector<arrow::FieldRef> key_refs(keys.begin(), keys.end());
+    std::vector<arrow::FieldRef> segment_keys;
+    if (options.ordered) {
+        segment_keys.push_back(paneColumn);
+    } else {
+        key_refs.push_back(paneColumn);
+    }
+    
+    ac::Declaration pane_aggregate{
+        "aggregate", {std::move(pane_node)}, ac::AggregateNodeOptions{aggregates, key_refs, segment_keys}};
+    
+    if (tumbling) {
+        return pane_aggregate;
+    }
+    
+    std::vector<cp::Aggregate> merges;
+    for (const auto& aggregate : aggregates) {
+        ARROW_ASSIGN_OR_RAISE(auto merge, MergeAggregate(aggregate));
+        merges.push_back(std::move(merge));
+    }
+    ARROW_ASSIGN_OR_RAISE(auto unit, CalendarUnitDuration(options.unit));
+    
+    ac::Declaration window_node{
+        "window_combine", {std::move(pane_aggregate)},
+        WindowCombineNodeOptions{keys, paneColumn, options.windowColumn, unit * options.slide,
+            options.size / options.slide, std::move(merges), options.ordered}};
+    
+    return window_node;
+}
@@ -16,24 +16,221 @@
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
 
+struct IOStats;
+struct SpillOptions;
+struct SpillStats;
+class SampleNodeOptions;
+
+/*
+ * Scan settings for latency bound storage. Many fragments and batches are
+ * kept in flight and Parquet column chunks of a row group are pre-buffered
+ * with nearby ranges coalesced into a single read.
+ */
+struct ScanTuningOptions {
+    // Fragments (files) scanned concurrently
+    int fragment_readahead = 16;
+    // Batches read ahead within each fragment
+    int batch_readahead = 32;
+    // Maximum rows per batch
+    int64_t batch_size = 64 * 1024;
+    
+    // Read all needed column chunks of a row group up front
+    bool pre_buffer = true;
+    // Issue pre-buffered reads when a row group is decoded instead of when the file is opened
+    bool lazy_pre_buffer = true;
+    // Ranges closer than this are coalesced into one read
+    int64_t hole_size_limit = 8 * 1024;
+    // Coalesced reads are not grown beyond this size
+    int64_t range_size_limit = 32 * 1024 * 1024;
+    
+    // Executor for reads, nullptr uses the global I/O pool
+    arrow::internal::Executor* io_executor = nullptr;
+    // Counts files, reads, bytes and wait time of the scan when set
+    std::shared_ptr<IOStats> io_stats;
+};
+
 arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path);
+arrow::Result<ac::Declaration> OpenDatasetNode(std::string dataset_path, const ScanTuningOptions& tuning);
+
+/*
+ * Scans about `fraction` of the row groups of a Parquet dataset, the
+ * others are never read. Row groups are picked by a hash of file and
+ * row group, the same ones for the same seed.
+ */
+arrow::Result<ac::Declaration> OpenSampledDatasetNode(std::string dataset_path,
+                                                      double fraction,
+                                                      uint64_t seed = 42);
+
+/*
+ * Reads an IPC file written by ExecutePlanToIpcCache through a memory
+ * map. Uncompressed batches point directly into the mapped pages.
+ */
+arrow::Result<ac::Declaration> OpenIpcCacheNode(std::string cache_path);
 
 ac::Declaration CalcQuantileNode(ac::Declaration previousNode, double quantile);
 
+/*
+ * CalcQuantileNode for group keys whose hash table does not fit into
+ * memory. The counts per group are computed here by
+ * ExecutePlanToSpillingAggregate, the returned node only computes the
+ * quantile over them.
+ */
+arrow::Result<ac::Declaration> CalcQuantileNode(ac::Declaration previousNode,
+                                                double quantile,
+                                                const SpillOptions& spillOptions,
+                                                SpillStats* spillStats = nullptr);
+
+/*
+ * The "Count(value)" per group of CalcQuantileNode for a hash sample of
+ * about `fraction` of the groups. Counts of sampled groups are exact,
+ * pass the result to EstimateQuantile for the quantile and its interval.
+ */
+ac::Declaration SampledGroupCountNode(ac::Declaration previousNode, double fraction, uint64_t seed = 42);
+
+ac::Declaration QuantileNode(ac::Declaration previousNode,
+                             std::string columnName,
+                             double quantile);
+
 ac::Declaration AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
                                                  std::string columnName,
                                                  double value);
 
+ac::Declaration AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
+                                                 std::string columnName,
+                                                 cp::Expression value);
+
+/*
+ * AggregateValuesGreaterEqualThanNode with the counts per group computed
+ * here by ExecutePlanToSpillingAggregate, the returned node only filters them
+ */
+arrow::Result<ac::Declaration> AggregateValuesGreaterEqualThanNode(ac::Declaration previousNode,
+                                                                std::string columnName,
+                                                                double value,
+                                                                const SpillOptions& spillOptions,
+                                                                SpillStats* spillStats = nullptr);
+
+/*
+ * The k rows with the largest values of columnName, per partition if
+ * partitionKeys are given
+ */
+ac::Declaration TopKNode(ac::Declaration previousNode,
+                         std::string columnName,
+                         int64_t k,
+                         std::vector<std::string> partitionKeys = {});
+
+ac::Declaration SampleNode(ac::Declaration previousNode, SampleNodeOptions options);
+
+ac::Declaration GroupCountNode(ac::Declaration previousNode,
+                               std::string columnName,
+                               std::string countName);
+
+/*
+ * Estimated distinct values of valueColumn per keyColumn group, see
+ * ApproxCountDistinctOptions for the precision
+ */
+ac::Declaration GroupApproxCountDistinctNode(ac::Declaration previousNode,
+                                             std::string keyColumn,
+                                             std::string valueColumn,
+                                             std::string countName,
+                                             int precision = 12);
+
+/*
+ * Sessions per keyColumn group, a new session starts where the group's
+ * timeColumn jumps by more than gap, see SessionCountOptions
+ */
+ac::Declaration GroupSessionCountNode(ac::Declaration previousNode,
+                                      std::string keyColumn,
+                                      std::string timeColumn,
+                                      std::string countName,
+                                      std::chrono::seconds gap = std::chrono::minutes(30));
+
+/*
+ * Replaces the chain of filter nodes at the top of filterChain by one
+ * adaptive_filter node over their conjuncts, see AdaptiveFilterNodeOptions
+ */
+ac::Declaration AdaptiveFilterNode(ac::Declaration filterChain);
+
+ac::Declaration AdaptiveFilterNode(ac::Declaration previousNode,
+                                   std::vector<cp::Expression> conjuncts);
+
+/*
+ * Adds valueColumns of the lookup file (Parquet or IPC) for the row whose
+ * lookupKey equals keyColumn. The lookup table is built on first use and
+ * cached for later plans, see LookupTableCache.
+ */
+arrow::Result<ac::Declaration> LookupJoinNode(ac::Declaration previousNode,
+                                              std::string keyColumn,
+                                              std::string lookupPath,
+                                              std::string lookupKey,
+                                              std::vector<std::string> valueColumns = {},
+                                              std::string prefix = "");
+
+ac::Declaration FilterGreaterEqualNode(ac::Declaration previousNode,
+                                       std::string columnName,
+                                       double value);
+
+ac::Declaration FilterGreaterEqualNode(ac::Declaration previousNode,
+                                       std::string columnName,
+                                       cp::Expression value);
+
 ac::Declaration FilterNotInValueSet(ac::Declaration previousNode,
                                     std::string columnName,
                                     arrow::Datum valueSet);
 
-ac::Declaration FilterRegexNode(ac::Declaration previousNode,
-                                std::string columnName,
+ac::Declaration FilterByRegexNode(ac::Declaration previousNode,
+                                  std::string columnName,
                                   std::string pattern);
 
 ac::Declaration RecordBatchSourceNode(std::shared_ptr<arrow::RecordBatchReader> reader);
 
+/*
+ * Settings of a source over independent partitions. Every partition is
+ * read by its own task on the I/O executor, so the plan is fed from as many
+ * threads as there are partitions being read.
+ */
+struct PartitionedSourceOptions {
+    // Emit partition 0, then partition 1, ... instead of batches as they are ready
+    bool preserve_order = false;
+    // Batches read ahead within each partition
+    int batch_readahead = 4;
+    // Partitions read concurrently, 0 reads all of them at once
+    int partition_readahead = 0;
+    // Executor the partitions are read on, nullptr uses the global I/O pool
+    arrow::internal::Executor* io_executor = nullptr;
+    // Executor read batches are handed to, nullptr uses the global CPU pool
+    arrow::internal::Executor* executor = nullptr;
+};
+
+/*
+ * Source over readers that all have the same schema, read concurrently
+ * instead of one after another like RecordBatchSourceNode
+ */
+arrow::Result<ac::Declaration> PartitionedSourceNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions);
+arrow::Result<ac::Declaration> PartitionedSourceNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                                     const PartitionedSourceOptions& options);
+
+/*
+ * Streaming k-way merge of partitions that are each sorted by keys, the
+ * output is sorted by keys and declares that ordering. One batch per
+ * partition is held, the merge runs on the I/O pool one output batch
+ * ahead of the plan. Merged batches are handed to executor, nullptr uses
+ * the global CPU pool.
+ */
+arrow::Result<ac::Declaration> SortedMergeNode(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                               std::vector<cp::SortKey> keys,
+                                               int64_t batchSize = 64 * 1024,
+                                               arrow::internal::Executor* executor = nullptr);
+
+/*
+ * Every file of a Parquet dataset as one partition of SortedMergeNode,
+ * e.g. files written sorted by time merged into one ordered stream
+ */
+arrow::Result<ac::Declaration> OpenSortedDatasetNode(std::string dataset_path,
+                                                     std::vector<cp::SortKey> keys,
+                                                     arrow::internal::Executor* executor = nullptr);
+
+ac::Declaration TableSourceNode(std::shared_ptr<arrow::Table> table);
+
 ac::Declaration ProjectNode(std::string projectName,
                             ac::Declaration previousNode,
                             std::vector<std::string> keepColumns,
@@ -45,3 +242,21 @@ ac::Declaration FilterNode(std::string filterName,
                            ac::Declaration previousNode,
                            std::string columnName,
                            std::shared_ptr<cp::FunctionOptions> options);
+
+struct WindowOptions {
+    std::string timeColumn = "dateParsed";
+    std::string windowColumn = "window_start";
+    // Window length and distance between window starts in `unit`,
+    // a slide of 0 gives tumbling windows
+    int size = 1;
+    int slide = 0;
+    cp::CalendarUnit unit = cp::CalendarUnit::HOUR;
+    // Input is sorted by timeColumn, finished windows are emitted while
+    // streaming. Needs a plan executed without threads.
+    bool ordered = false;
+};
+
+arrow::Result<ac::Declaration> WindowAggregateNode(ac::Declaration previousNode,
+                                                   std::vector<std::string> keys,
+                                                   std::vector<cp::Aggregate> aggregates,
+                                                   WindowOptions options);
@@ -0,0 +1,306 @@
+//
+//  optimizer.cpp
+//  ArrowAcero
+//
+#import "optimizer.h"
+
+#include <sstream>
+
+// Columns of a node's output that the nodes above reference, nullopt for all
+using RequiredColumns = std::optional<std::set<std::string>>;
+
+std::string OptimizerStats::ToString() const {
+    std::stringstream ss;
+    ss << "fused_projects=" << fused_projects
+       << " fused_filters=" << fused_filters
+       << " pruned_columns=" << pruned_columns;
+    return ss.str();
+}
+
+static std::vector<std::string> ProjectNames(const ac::ProjectNodeOptions& options) {
+    std::vector<std::string> names = options.names;
+    for (size_t i = names.size(); i < options.expressions.size(); i++) {
+        names.push_back(options.expressions[i].ToString());
+    }
+    return names;
+}
+
+static bool AnyBound(const std::vector<cp::Expression>& expressions) {
+    return std::any_of(expressions.begin(), expressions.end(), [](const cp::Expression& expression) {
+        return expression.IsBound();
+    });
+}
+
+/* Input column a reference points to, -1 for nested or ambiguous references */
+static int ResolveReference(const arrow::FieldRef& ref, const std::vector<std::string>& names) {
+    if (const std::string* name = ref.name()) {
+        auto found = std::find(names.begin(), names.end(), *name);
+        if (found == names.end() || std::find(found + 1, names.end(), *name) != names.end()) {
+            return -1;
+        }
+        return static_cast<int>(found - names.begin());
+    }
+    if (const arrow::FieldPath* path = ref.field_path()) {
+        if (path->indices().size() == 1 && path->indices()[0] < static_cast<int>(names.size())) {
+            return path->indices()[0];
+        }
+    }
+    return -1;
+}
+
+static bool CountReferences(const cp::Expression& expression,
+                            const std::vector<std::string>& names,
+                            std::vector<int>* counts) {
+    if (const arrow::FieldRef* ref = expression.field_ref()) {
+        int index = ResolveReference(*ref, names);
+        if (index < 0) {
+            return false;
+        }
+        (*counts)[index]++;
+        return true;
+    }
+    if (const cp::Expression::Call* call = expression.call()) {
+        for (const auto& argument : call->arguments) {
+            if (!CountReferences(argument, names, counts)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static cp::Expression Substitute(const cp::Expression& expression,
+                                 const std::vector<std::string>& names,
+                                 const std::vector<cp::Expression>& replacements) {
+    if (const arrow::FieldRef* ref = expression.field_ref()) {
+        return replacements[ResolveReference(*ref, names)];
+    }
+    const cp::Expression::Call* call = expression.call();
+    if (call == nullptr) {
+        return expression;
+    }
+
+    std::vector<cp::Expression> arguments;
+    for (const auto& argument : call->arguments) {
+        arguments.push_back(Substitute(argument, names, replacements));
+    }
+    return cp::call(call->function_name, std::move(arguments), call->options);
+}
+
+/* Named columns an expression reads, false if it references by position */
+static bool CollectColumns(const cp::Expression& expression, std::set<std::string>* columns) {
+    if (const arrow::FieldRef* ref = expression.field_ref()) {
+        if (const std::string* name = ref->name()) {
+            columns->insert(*name);
+            return true;
+        }
+        return false;
+    }
+    if (const cp::Expression::Call* call = expression.call()) {
+        for (const auto& argument : call->arguments) {
+            if (!CollectColumns(argument, columns)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool CollectColumns(const std::vector<arrow::FieldRef>& refs, std::set<std::string>* columns) {
+    for (const auto& ref : refs) {
+        if (!CollectColumns(cp::field_ref(ref), columns)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static const ac::Declaration* SingleInput(const ac::Declaration& declaration, const std::string& factory_name) {
+    if (declaration.inputs.size() != 1) {
+        return nullptr;
+    }
+    const auto* input = std::get_if<ac::Declaration>(&declaration.inputs[0]);
+    if (input == nullptr || input->factory_name != factory_name) {
+        return nullptr;
+    }
+    return input;
+}
+
+static std::optional<ac::Declaration> FuseProjects(const ac::Declaration& outer) {
+    const ac::Declaration* inner = SingleInput(outer, "project");
+    if (outer.factory_name != "project" || inner == nullptr) {
+        return std::nullopt;
+    }
+
+    const auto& outer_options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*outer.options);
+    const auto& inner_options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*inner->options);
+
+    /* Bound expressions belong to prepared plans and keep their kernels */
+    if (AnyBound(outer_options.expressions) || AnyBound(inner_options.expressions)) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> inner_names = ProjectNames(inner_options);
+    std::vector<int> counts(inner_names.size(), 0);
+    for (const auto& expression : outer_options.expressions) {
+        if (!CountReferences(expression, inner_names, &counts)) {
+            return std::nullopt;
+        }
+    }
+
+    /* Inlining a computed column referenced twice would evaluate it twice */
+    for (size_t i = 0; i < counts.size(); i++) {
+        if (counts[i] > 1 && inner_options.expressions[i].call() != nullptr) {
+            return std::nullopt;
+        }
+    }
+
+    std::vector<cp::Expression> expressions;
+    for (const auto& expression : outer_options.expressions) {
+        expressions.push_back(Substitute(expression, inner_names, inner_options.expressions));
+    }
+
+    ac::Declaration fused = outer;
+    fused.inputs = inner->inputs;
+    fused.options = std::make_shared<ac::ProjectNodeOptions>(std::move(expressions), ProjectNames(outer_options));
+    return fused;
+}
+
+static std::optional<ac::Declaration> FuseFilters(const ac::Declaration& outer) {
+    const ac::Declaration* inner = SingleInput(outer, "filter");
+    if (outer.factory_name != "filter" || inner == nullptr) {
+        return std::nullopt;
+    }
+
+    const auto& outer_options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*outer.options);
+    const auto& inner_options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*inner->options);
+    if (outer_options.filter_expression.IsBound() || inner_options.filter_expression.IsBound()) {
+        return std::nullopt;
+    }
+
+    ac::Declaration fused = outer;
+    fused.inputs = inner->inputs;
+    fused.options = std::make_shared<ac::FilterNodeOptions>(cp::and_(inner_options.filter_expression,
+                                                                     outer_options.filter_expression));
+    return fused;
+}
+
+static ac::Declaration FuseDeclaration(const ac::Declaration& declaration, OptimizerStats* stats) {
+    ac::Declaration fused = declaration;
+
+    for (auto& input : fused.inputs) {
+        if (auto* input_declaration = std::get_if<ac::Declaration>(&input)) {
+            *input_declaration = FuseDeclaration(*input_declaration, stats);
+        }
+    }
+
+    while (true) {
+        if (auto projects = FuseProjects(fused)) {
+            fused = std::move(*projects);
+            stats->fused_projects++;
+        } else if (auto filters = FuseFilters(fused)) {
+            fused = std::move(*filters);
+            stats->fused_filters++;
+        } else {
+            return fused;
+        }
+    }
+}
+
+static ac::Declaration PruneDeclaration(const ac::Declaration& declaration,
+                                        const RequiredColumns& required,
+                                        OptimizerStats* stats) {
+    ac::Declaration pruned = declaration;
+    std::vector<RequiredColumns> input_required(declaration.inputs.size());
+
+    if (declaration.factory_name == "project") {
+        const auto& options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*declaration.options);
+        std::vector<std::string> names = ProjectNames(options);
+
+        std::vector<cp::Expression> expressions;
+        std::vector<std::string> kept_names;
+        for (size_t i = 0; i < names.size(); i++) {
+            if (!required || required->count(names[i]) > 0) {
+                expressions.push_back(options.expressions[i]);
+                kept_names.push_back(names[i]);
+            }
+        }
+
+        /* A project without columns would lose the row count */
+        if (expressions.empty() || AnyBound(options.expressions)) {
+            expressions = options.expressions;
+            kept_names = names;
+        }
+        stats->pruned_columns += names.size() - kept_names.size();
+
+        std::set<std::string> columns;
+        bool named = true;
+        for (const auto& expression : expressions) {
+            named = CollectColumns(expression, &columns) && named;
+        }
+        if (named) {
+            input_required[0] = std::move(columns);
+        }
+
+        pruned.options = std::make_shared<ac::ProjectNodeOptions>(std::move(expressions), std::move(kept_names));
+    } else if (declaration.factory_name == "filter" && required) {
+        const auto& options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*declaration.options);
+        std::set<std::string> columns = *required;
+        if (CollectColumns(options.filter_expression, &columns)) {
+            input_required[0] = std::move(columns);
+        }
+    } else if (declaration.factory_name == "aggregate") {
+        const auto& options = arrow::internal::checked_cast<const ac::AggregateNodeOptions&>(*declaration.options);
+        std::set<std::string> columns;
+        bool named = CollectColumns(options.keys, &columns) && CollectColumns(options.segment_keys, &columns);
+        for (const auto& aggregate : options.aggregates) {
+            named = CollectColumns(aggregate.target, &columns) && named;
+        }
+        if (named) {
+            input_required[0] = std::move(columns);
+        }
+    }
+
+    for (size_t i = 0; i < pruned.inputs.size(); i++) {
+        if (auto* input_declaration = std::get_if<ac::Declaration>(&pruned.inputs[i])) {
+            *input_declaration = PruneDeclaration(*input_declaration, input_required[i], stats);
+        }
+    }
+
+    return pruned;
+}
+
+arrow::Result<ac::Declaration> OptimizeDeclaration(const ac::Declaration& declaration,
+                                                   OptimizerStats* stats) {
+    OptimizerStats local_stats;
+    if (stats == nullptr) {
+        stats = &local_stats;
+    }
+
+    /* Pruning can remove the references that kept projects apart, fuse again after it */
+    ac::Declaration optimized = FuseDeclaration(declaration, stats);
+    optimized = PruneDeclaration(optimized, std::nullopt, stats);
+    optimized = FuseDeclaration(optimized, stats);
+
+    /* The rewritten plan has to produce the same columns */
+    ARROW_ASSIGN_OR_RAISE(auto schema, ac::DeclarationToSchema(declaration));
+    ARROW_ASSIGN_OR_RAISE(auto optimized_schema, ac::DeclarationToSchema(optimized));
+    if (!schema->Equals(*optimized_schema)) {
+        return arrow::Status::Invalid("Optimized plan changed the output schema from ", schema->ToString(),
+                                      " to ", optimized_schema->ToString());
+    }
+
+    return optimized;
+}
+
+arrow::Result<ac::Declaration> OptimizeDeclaration(const ac::Declaration& declaration,
+                                                   const std::vector<std::string>& columns,
+                                                   OptimizerStats* stats) {
+    /* A project selecting the columns on top, pruning works down from it */
+    std::vector<cp::Expression> expressions;
+    for (const auto& column : columns) {
+        expressions.push_back(cp::field_ref(column));
+    }
+    ac::Declaration selected{"project", {declaration}, ac::ProjectNodeOptions(std::move(expressions), columns)};
+    return OptimizeDeclaration(selected, stats);
+}
@@ -0,0 +1,49 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <optional>
+#include <set>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+struct OptimizerStats {
+    int64_t fused_projects = 0;
+    int64_t fused_filters = 0;
+    int64_t pruned_columns = 0;
+
+    std::string ToString() const;
+};
+
+/*
+ * Rewrites a declaration before execution:
+ *  - a project on top of a project becomes one project, field references
+ *    are replaced by the expressions that produced them. Computed
+ *    columns referenced more than once are kept in their own project so
+ *    they are not evaluated twice.
+ *  - a filter on top of a filter becomes one filter on the conjunction
+ *  - project columns that no node above references are dropped
+ *
+ * Only declarations are rewritten, nodes given as ExecNode* stay as is.
+ */
+arrow::Result<ac::Declaration> OptimizeDeclaration(const ac::Declaration& declaration,
+                                                   OptimizerStats* stats = nullptr);
+
+/*
+ * Optimizes a declaration of which only the named columns are used, in
+ * that order. Columns computed only for the others are not computed.
+ */
+arrow::Result<ac::Declaration> OptimizeDeclaration(const ac::Declaration& declaration,
+                                                   const std::vector<std::string>& columns,
+                                                   OptimizerStats* stats = nullptr);
@@ -0,0 +1,368 @@
+//
+//  prepared.cpp
+//  ArrowAcero
+//
+#import "prepared.h"
+
+static const std::string kParameterPrefix = "$";
+static const std::string kPlaceholderSourceLabel = "prepared_source";
+
+cp::Expression PlanParameter(std::string name) {
+    return cp::field_ref(kParameterPrefix + name);
+}
+
+arrow::Datum ValueSetParameter(std::string name) {
+    return arrow::Datum(std::make_shared<arrow::StringScalar>(kParameterPrefix + name));
+}
+
+ac::Declaration PlaceholderSourceNode(std::shared_ptr<arrow::Schema> schema) {
+    auto source_node_options = ac::ExecBatchSourceNodeOptions{std::move(schema), std::vector<cp::ExecBatch>{}};
+    
+    ac::Declaration source{"exec_batch_source", std::move(source_node_options), kPlaceholderSourceLabel};
+    
+    return source;
+}
+
+static const std::string* ParameterName(const arrow::FieldRef& ref) {
+    const std::string* name = ref.name();
+    if (name != nullptr && name->compare(0, kParameterPrefix.size(), kParameterPrefix) == 0) {
+        return name;
+    }
+    return nullptr;
+}
+
+static std::optional<std::string> ValueSetParameterName(const cp::FunctionOptions* options) {
+    if (options == nullptr || std::string(options->type_name()) != cp::SetLookupOptions::kTypeName) {
+        return std::nullopt;
+    }
+    const auto& value_set = arrow::internal::checked_cast<const cp::SetLookupOptions*>(options)->value_set;
+    if (!value_set.is_scalar() || value_set.type()->id() != arrow::Type::STRING) {
+        return std::nullopt;
+    }
+    const auto& scalar = arrow::internal::checked_cast<const arrow::StringScalar&>(*value_set.scalar());
+    std::string value = scalar.ToString();
+    if (!scalar.is_valid || value.compare(0, kParameterPrefix.size(), kParameterPrefix) != 0) {
+        return std::nullopt;
+    }
+    return value.substr(kParameterPrefix.size());
+}
+
+static arrow::Result<arrow::Datum> LookupParameter(const std::string& name,
+                                                   const PlanParameters& parameters,
+                                                   const PlanParameters& defaults) {
+    auto parameter = parameters.find(name);
+    if (parameter != parameters.end()) {
+        return parameter->second;
+    }
+    auto value = defaults.find(name);
+    if (value == defaults.end()) {
+        return arrow::Status::Invalid("No value for plan parameter ", name);
+    }
+    return value->second;
+}
+
+/*
+ * Replaces value set placeholders, and literal placeholders if
+ * substitute_fields is set, by their defaults
+ */
+static arrow::Result<cp::Expression> SubstituteDefaults(const cp::Expression& expression,
+                                                       const PlanParameters& defaults,
+                                                       bool substitute_fields,
+                                                       std::map<const cp::FunctionOptions*, std::string>* value_sets) {
+    if (const arrow::FieldRef* ref = expression.field_ref()) {
+        const std::string* name = ParameterName(*ref);
+        if (name == nullptr || !substitute_fields) {
+            return expression;
+        }
+        ARROW_ASSIGN_OR_RAISE(auto value, LookupParameter(name->substr(kParameterPrefix.size()), {}, defaults));
+        return cp::literal(std::move(value));
+    }
+    
+    const cp::Expression::Call* call = expression.call();
+    if (call == nullptr) {
+        return expression;
+    }
+    
+    std::vector<cp::Expression> arguments;
+    for (const auto& argument : call->arguments) {
+        ARROW_ASSIGN_OR_RAISE(auto substituted, SubstituteDefaults(argument, defaults, substitute_fields, value_sets));
+        arguments.push_back(std::move(substituted));
+    }
+    
+    std::shared_ptr<cp::FunctionOptions> options = call->options;
+    if (auto name = ValueSetParameterName(options.get())) {
+        ARROW_ASSIGN_OR_RAISE(auto value, LookupParameter(*name, {}, defaults));
+        auto behavior = arrow::internal::checked_cast<const cp::SetLookupOptions&>(*options).null_matching_behavior;
+        options = std::make_shared<cp::SetLookupOptions>(std::move(value), behavior);
+        if (value_sets != nullptr) {
+            (*value_sets)[options.get()] = *name;
+        }
+    }
+    
+    return cp::call(call->function_name, std::move(arguments), std::move(options));
+}
+
+static arrow::Result<ac::Declaration> SubstituteDefaults(const ac::Declaration& declaration,
+                                                        const PlanParameters& defaults) {
+    ac::Declaration substituted = declaration;
+    
+    for (auto& input : substituted.inputs) {
+        if (auto* input_declaration = std::get_if<ac::Declaration>(&input)) {
+            ARROW_ASSIGN_OR_RAISE(*input_declaration, SubstituteDefaults(*input_declaration, defaults));
+        }
+    }
+    
+    if (declaration.factory_name == "filter") {
+        const auto& options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*declaration.options);
+        ARROW_ASSIGN_OR_RAISE(auto filter, SubstituteDefaults(options.filter_expression, defaults, true, nullptr));
+        substituted.options = std::make_shared<ac::FilterNodeOptions>(std::move(filter));
+    } else if (declaration.factory_name == "project") {
+        const auto& options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*declaration.options);
+        std::vector<cp::Expression> expressions;
+        for (const auto& expression : options.expressions) {
+            ARROW_ASSIGN_OR_RAISE(auto projected, SubstituteDefaults(expression, defaults, true, nullptr));
+            expressions.push_back(std::move(projected));
+        }
+        substituted.options = std::make_shared<ac::ProjectNodeOptions>(std::move(expressions), options.names);
+    }
+    
+    return substituted;
+}
+
+static void CollectValueSetOptions(const cp::Expression& expression, std::set<const cp::FunctionOptions*>* found) {
+    if (const cp::Expression::Call* call = expression.call()) {
+        found->insert(call->options.get());
+        for (const auto& argument : call->arguments) {
+            CollectValueSetOptions(argument, found);
+        }
+    }
+}
+
+arrow::Result<std::shared_ptr<PreparedPlan>> PreparedPlan::Prepare(ac::Declaration declaration,
+                                                                   PlanParameters defaults) {
+    auto plan = std::make_shared<PreparedPlan>();
+    plan->defaults_ = std::move(defaults);
+    
+    ARROW_ASSIGN_OR_RAISE(auto substituted, SubstituteDefaults(declaration, plan->defaults_));
+    ARROW_ASSIGN_OR_RAISE(plan->output_schema_, ac::DeclarationToSchema(substituted));
+    
+    ARROW_ASSIGN_OR_RAISE(plan->declaration_, plan->PrepareDeclaration(declaration));
+    
+    return plan;
+}
+
+arrow::Result<PreparedPlan::BoundExpression> PreparedPlan::BindTemplate(const cp::Expression& expression,
+                                                                        const std::shared_ptr<arrow::Schema>& input_schema) const {
+    BoundExpression bound;
+    ARROW_ASSIGN_OR_RAISE(auto substituted, SubstituteDefaults(expression, defaults_, false, &bound.value_sets));
+    
+    /*
+     * Literal placeholders are bound as extra input fields with the
+     * type of their default
+     */
+    arrow::FieldVector fields = input_schema->fields();
+    for (const auto& [name, value] : defaults_) {
+        fields.push_back(arrow::field(kParameterPrefix + name, value.type()));
+    }
+    ARROW_ASSIGN_OR_RAISE(bound.expression, substituted.Bind(*arrow::schema(std::move(fields))));
+    
+    std::set<const cp::FunctionOptions*> found;
+    CollectValueSetOptions(bound.expression, &found);
+    for (const auto& [options, name] : bound.value_sets) {
+        if (found.count(options) == 0) {
+            return arrow::Status::Invalid("Value set parameter ", name, " was lost while binding ", expression.ToString());
+        }
+    }
+    
+    return bound;
+}
+
+arrow::Result<ac::Declaration> PreparedPlan::PrepareDeclaration(const ac::Declaration& declaration) {
+    if (declaration.label == kPlaceholderSourceLabel) {
+        source_schema_ = arrow::internal::checked_cast<const ac::ExecBatchSourceNodeOptions&>(*declaration.options).schema;
+        return declaration;
+    }
+    
+    ac::Declaration prepared = declaration;
+    
+    for (auto& input : prepared.inputs) {
+        if (auto* input_declaration = std::get_if<ac::Declaration>(&input)) {
+            ARROW_ASSIGN_OR_RAISE(*input_declaration, PrepareDeclaration(*input_declaration));
+        }
+    }
+    
+    if (declaration.factory_name != "filter" && declaration.factory_name != "project") {
+        return prepared;
+    }
+    
+    const auto* input_declaration = std::get_if<ac::Declaration>(&declaration.inputs[0]);
+    if (input_declaration == nullptr) {
+        return prepared;
+    }
+    ARROW_ASSIGN_OR_RAISE(auto input, SubstituteDefaults(*input_declaration, defaults_));
+    ARROW_ASSIGN_OR_RAISE(auto input_schema, ac::DeclarationToSchema(input));
+    
+    if (declaration.factory_name == "filter") {
+        const auto& options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*declaration.options);
+        ARROW_ASSIGN_OR_RAISE(auto bound, BindTemplate(options.filter_expression, input_schema));
+        
+        prepared.options = std::make_shared<ac::FilterNodeOptions>(bound.expression);
+        value_sets_[prepared.options.get()] = {std::move(bound.value_sets)};
+    } else {
+        const auto& options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*declaration.options);
+        std::vector<cp::Expression> expressions;
+        std::vector<std::string> names = options.names;
+        std::vector<std::map<const cp::FunctionOptions*, std::string>> value_sets;
+        
+        for (size_t i = 0; i < options.expressions.size(); i++) {
+            ARROW_ASSIGN_OR_RAISE(auto bound, BindTemplate(options.expressions[i], input_schema));
+            expressions.push_back(std::move(bound.expression));
+            value_sets.push_back(std::move(bound.value_sets));
+            // Keep the names of the unbound expressions
+            if (names.size() <= i) {
+                names.push_back(options.expressions[i].ToString());
+            }
+        }
+        
+        prepared.options = std::make_shared<ac::ProjectNodeOptions>(std::move(expressions), std::move(names));
+        value_sets_[prepared.options.get()] = std::move(value_sets);
+    }
+    
+    return prepared;
+}
+
+/*
+ * Schema of a source declaration. Sources that carry their schema in
+ * their options are not planned, others are planned once to find it.
+ */
+static arrow::Result<std::shared_ptr<arrow::Schema>> SourceSchema(const ac::Declaration& source) {
+    if (source.factory_name == "record_batch_reader_source") {
+        return arrow::internal::checked_cast<const ac::RecordBatchReaderSourceNodeOptions&>(*source.options).reader->schema();
+    }
+    if (source.factory_name == "table_source") {
+        return arrow::internal::checked_cast<const ac::TableSourceNodeOptions&>(*source.options).table->schema();
+    }
+    if (source.factory_name == "exec_batch_source") {
+        return arrow::internal::checked_cast<const ac::ExecBatchSourceNodeOptions&>(*source.options).schema;
+    }
+    if (source.factory_name == "source") {
+        return arrow::internal::checked_cast<const ac::SourceNodeOptions&>(*source.options).output_schema;
+    }
+    return ac::DeclarationToSchema(source);
+}
+
+arrow::Result<ac::Declaration> PreparedPlan::Bind(const PlanParameters& parameters, ac::Declaration source) const {
+    for (const auto& parameter : parameters) {
+        if (defaults_.count(parameter.first) == 0) {
+            return arrow::Status::Invalid("Unknown plan parameter ", parameter.first);
+        }
+    }
+    
+    /* Field references were bound to positions in the placeholder schema */
+    if (source_schema_) {
+        ARROW_ASSIGN_OR_RAISE(auto schema, SourceSchema(source));
+        if (!schema->Equals(*source_schema_, /*check_metadata=*/false)) {
+            return arrow::Status::Invalid("Source schema ", schema->ToString(), " differs from the prepared schema ",
+                                          source_schema_->ToString());
+        }
+    }
+    return BindDeclaration(declaration_, parameters, source);
+}
+
+arrow::Result<ac::Declaration> PreparedPlan::BindDeclaration(const ac::Declaration& declaration,
+                                                             const PlanParameters& parameters,
+                                                             const ac::Declaration& source) const {
+    if (declaration.label == kPlaceholderSourceLabel) {
+        return source;
+    }
+    
+    ac::Declaration bound = declaration;
+    
+    for (auto& input : bound.inputs) {
+        if (auto* input_declaration = std::get_if<ac::Declaration>(&input)) {
+            ARROW_ASSIGN_OR_RAISE(*input_declaration, BindDeclaration(*input_declaration, parameters, source));
+        }
+    }
+    
+    auto value_sets = value_sets_.find(declaration.options.get());
+    if (value_sets == value_sets_.end()) {
+        return bound;
+    }
+    
+    if (declaration.factory_name == "filter") {
+        const auto& options = arrow::internal::checked_cast<const ac::FilterNodeOptions&>(*declaration.options);
+        ARROW_ASSIGN_OR_RAISE(auto filter, BindExpression(options.filter_expression, value_sets->second[0], parameters));
+        bound.options = std::make_shared<ac::FilterNodeOptions>(std::move(filter));
+    } else {
+        const auto& options = arrow::internal::checked_cast<const ac::ProjectNodeOptions&>(*declaration.options);
+        std::vector<cp::Expression> expressions;
+        for (size_t i = 0; i < options.expressions.size(); i++) {
+            ARROW_ASSIGN_OR_RAISE(auto expression, BindExpression(options.expressions[i], value_sets->second[i], parameters));
+            expressions.push_back(std::move(expression));
+        }
+        bound.options = std::make_shared<ac::ProjectNodeOptions>(std::move(expressions), options.names);
+    }
+    
+    return bound;
+}
+
+/*
+ * Substitutes parameters into a bound expression. Calls keep their
+ * resolved function and kernel, only kernels whose options hold a value
+ * set are initialized again.
+ */
+arrow::Result<cp::Expression> PreparedPlan::BindExpression(const cp::Expression& expression,
+                                                           const std::map<const cp::FunctionOptions*, std::string>& value_sets,
+                                                           const PlanParameters& parameters) const {
+    if (const cp::Expression::Parameter* parameter = expression.parameter()) {
+        const std::string* name = ParameterName(parameter->ref);
+        if (name == nullptr) {
+            return expression;
+        }
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum value, LookupParameter(name->substr(kParameterPrefix.size()), parameters, defaults_));
+        if (!value.type()->Equals(*parameter->type.type)) {
+            ARROW_ASSIGN_OR_RAISE(value, cp::Cast(value, parameter->type.GetSharedPtr()));
+        }
+        return cp::literal(std::move(value));
+    }
+    
+    const cp::Expression::Call* call = expression.call();
+    if (call == nullptr) {
+        return expression;
+    }
+    
+    bool changed = false;
+    std::vector<cp::Expression> arguments;
+    for (const auto& argument : call->arguments) {
+        ARROW_ASSIGN_OR_RAISE(auto bound, BindExpression(argument, value_sets, parameters));
+        changed |= !cp::Expression::Identical(bound, argument);
+        arguments.push_back(std::move(bound));
+    }
+    
+    auto value_set = value_sets.find(call->options.get());
+    if (!changed && value_set == value_sets.end()) {
+        return expression;
+    }
+    
+    cp::Expression::Call bound_call = *call;
+    bound_call.arguments = std::move(arguments);
+    
+    if (value_set != value_sets.end()) {
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum value, LookupParameter(value_set->second, parameters, defaults_));
+        auto behavior = arrow::internal::checked_cast<const cp::SetLookupOptions&>(*call->options).null_matching_behavior;
+        bound_call.options = std::make_shared<cp::SetLookupOptions>(std::move(value), behavior);
+        
+        if (bound_call.kernel->init) {
+            std::vector<arrow::TypeHolder> types;
+            for (const auto& argument : bound_call.arguments) {
+                types.emplace_back(argument.type());
+            }
+            cp::KernelContext ctx(cp::default_exec_context(), bound_call.kernel);
+            ARROW_ASSIGN_OR_RAISE(bound_call.kernel_state,
+                                  bound_call.kernel->init(&ctx, cp::KernelInitArgs{bound_call.kernel, types, bound_call.options.get()}));
+        }
+    }
+    
+    bound_call.ComputeHash();
+    return cp::Expression(std::move(bound_call));
+}
@@ -0,0 +1,79 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <map>
+#include <set>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+using PlanParameters = std::map<std::string, arrow::Datum>;
+
+// Placeholder for a literal in a filter or project expression
+cp::Expression PlanParameter(std::string name);
+
+// Placeholder for the value set of FilterNotInValueSet
+arrow::Datum ValueSetParameter(std::string name);
+
+// Leaf of a prepared plan, replaced by the actual source on every execution
+ac::Declaration PlaceholderSourceNode(std::shared_ptr<arrow::Schema> schema);
+
+/*
+ * A declaration whose filter and project expressions are bound once,
+ * functions and kernels are resolved at Prepare. Executions only
+ * substitute the parameters into the bound expressions.
+ */
+class PreparedPlan {
+public:
+    static arrow::Result<std::shared_ptr<PreparedPlan>> Prepare(ac::Declaration declaration,
+                                                                PlanParameters defaults);
+    
+    /*
+     * Parameters that are not given keep their default, source must have
+     * the schema of the placeholder. Reader, table, batch and generator
+     * sources are checked against the schema kept at Prepare without
+     * planning them.
+     */
+    arrow::Result<ac::Declaration> Bind(const PlanParameters& parameters, ac::Declaration source) const;
+    
+    const std::shared_ptr<arrow::Schema>& output_schema() const { return output_schema_; }
+    
+private:
+    struct BoundExpression {
+        cp::Expression expression;
+        // Calls whose options hold a value set parameter
+        std::map<const cp::FunctionOptions*, std::string> value_sets;
+    };
+    
+    arrow::Result<ac::Declaration> PrepareDeclaration(const ac::Declaration& declaration);
+    
+    arrow::Result<BoundExpression> BindTemplate(const cp::Expression& expression,
+                                                const std::shared_ptr<arrow::Schema>& input_schema) const;
+    
+    arrow::Result<ac::Declaration> BindDeclaration(const ac::Declaration& declaration,
+                                                   const PlanParameters& parameters,
+                                                   const ac::Declaration& source) const;
+    
+    arrow::Result<cp::Expression> BindExpression(const cp::Expression& expression,
+                                                 const std::map<const cp::FunctionOptions*, std::string>& value_sets,
+                                                 const PlanParameters& parameters) const;
+    
+    PlanParameters defaults_;
+    std::shared_ptr<arrow::Schema> output_schema_;
+    // Schema of the placeholder source, nullptr without one
+    std::shared_ptr<arrow::Schema> source_schema_;
+    ac::Declaration declaration_;
+    // Keyed by the options of the prepared filter and project nodes
+    std::map<const ac::ExecNodeOptions*, std::vector<std::map<const cp::FunctionOptions*, std::string>>> value_sets_;
+};
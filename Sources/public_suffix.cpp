@@ -0,0 +1,434 @@
+//
+//  public_suffix.cpp
+//  ArrowAcero
+//
+#import "public_suffix.h"
+
+#include <cstring>
+#include <map>
+
+/*
+ * A selection of the public suffix list: the generic suffixes, the country
+ * codes with their common second level suffixes and the hosting suffixes
+ * that show up in our traffic
+ */
+static const char* kDefaultRules = R"(
+// Generic
+com
+net
+org
+edu
+gov
+mil
+int
+info
+biz
+name
+pro
+mobi
+app
+dev
+io
+ai
+co
+me
+tv
+cc
+ws
+xyz
+online
+site
+shop
+store
+blog
+cloud
+tech
+news
+live
+
+// Country codes
+ac
+at
+co.at
+or.at
+au
+com.au
+net.au
+org.au
+edu.au
+gov.au
+asn.au
+be
+br
+com.br
+net.br
+org.br
+gov.br
+edu.br
+ca
+ch
+cn
+com.cn
+net.cn
+org.cn
+gov.cn
+edu.cn
+de
+dk
+es
+com.es
+org.es
+eu
+fi
+fr
+gr
+hk
+com.hk
+org.hk
+ie
+il
+co.il
+org.il
+in
+co.in
+net.in
+org.in
+gov.in
+ac.in
+it
+jp
+co.jp
+ne.jp
+or.jp
+ac.jp
+go.jp
+ad.jp
+kr
+co.kr
+or.kr
+mx
+com.mx
+org.mx
+gob.mx
+nl
+no
+nz
+co.nz
+net.nz
+org.nz
+govt.nz
+ac.nz
+pl
+com.pl
+net.pl
+org.pl
+pt
+ru
+com.ru
+se
+sg
+com.sg
+edu.sg
+gov.sg
+tr
+com.tr
+org.tr
+gov.tr
+tw
+com.tw
+org.tw
+ua
+com.ua
+uk
+co.uk
+org.uk
+me.uk
+ltd.uk
+plc.uk
+net.uk
+ac.uk
+gov.uk
+nhs.uk
+us
+za
+co.za
+org.za
+*.ck
+!www.ck
+
+// Hosting
+github.io
+gitlab.io
+blogspot.com
+appspot.com
+herokuapp.com
+azurewebsites.net
+cloudfront.net
+netlify.app
+vercel.app
+pages.dev
+workers.dev
+)";
+
+static inline unsigned char ToLower(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static constexpr uint64_t kLabelHashSeed = 0xcbf29ce484222325ULL;
+
+static inline uint64_t MixLabelWord(uint64_t hash, uint64_t word) {
+    hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 32);
+}
+
+/*
+ * Hash of a lower case label, eight bytes at a time. The eight bytes
+ * after the label have to be readable, they are masked off.
+ */
+static inline uint64_t HashPaddedLabel(const char* label, size_t length) {
+    uint64_t hash = kLabelHashSeed ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, label + i, 8);
+        hash = MixLabelWord(hash, word);
+    }
+    if (i < length) {
+        uint64_t word;
+        std::memcpy(&word, label + i, 8);
+        word &= ~uint64_t(0) >> (64 - 8 * (length - i));
+        hash = MixLabelWord(hash, word);
+    }
+    return hash;
+}
+
+/* Lower case labels of the same length, each followed by eight readable bytes */
+static inline bool EqualPaddedLabel(const char* stored, const char* label, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, stored + i, 8);
+        std::memcpy(&b, label + i, 8);
+        if (a != b) {
+            return false;
+        }
+    }
+    if (i < length) {
+        uint64_t a, b;
+        std::memcpy(&a, stored + i, 8);
+        std::memcpy(&b, label + i, 8);
+        return ((a ^ b) & (~uint64_t(0) >> (64 - 8 * (length - i)))) == 0;
+    }
+    return true;
+}
+
+uint64_t PublicSuffixTrie::SlotHash(uint32_t parent, uint64_t label_hash) {
+    uint64_t hash = label_hash ^ (parent * 0x9e3779b97f4a7c15ULL);
+    return hash ^ (hash >> 29);
+}
+
+arrow::Result<std::shared_ptr<PublicSuffixTrie>> PublicSuffixTrie::Make(std::string_view rules) {
+    struct BuildNode {
+        std::map<std::string, BuildNode> children;
+        uint8_t flags = 0;
+    };
+    BuildNode root;
+
+    size_t position = 0;
+    while (position < rules.size()) {
+        size_t line_end = std::min(rules.find('\n', position), rules.size());
+        std::string_view line = rules.substr(position, line_end - position);
+        position = line_end + 1;
+
+        /* A rule ends at the first whitespace */
+        line = line.substr(0, std::min(line.find_first_of(" \t\r"), line.size()));
+        if (line.empty() || line.substr(0, 2) == "//") {
+            continue;
+        }
+
+        uint8_t flag = kRule;
+        if (line.front() == '!') {
+            flag = kException;
+            line.remove_prefix(1);
+        } else if (line.substr(0, 2) == "*.") {
+            flag = kWildcard;
+            line.remove_prefix(2);
+        }
+
+        BuildNode* node = &root;
+        size_t label_end = line.size();
+        while (true) {
+            size_t dot = line.rfind('.', label_end == 0 ? 0 : label_end - 1);
+            size_t label_start = (dot == std::string_view::npos || dot >= label_end) ? 0 : dot + 1;
+            std::string label(line.substr(label_start, label_end - label_start));
+            if (label.empty() || label.size() > 255 || label == "*") {
+                return arrow::Status::Invalid("Unsupported public suffix rule '", line, "'");
+            }
+            std::transform(label.begin(), label.end(), label.begin(), [](unsigned char c) {
+                return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+            });
+            node = &node->children[label];
+
+            if (label_start == 0) {
+                break;
+            }
+            label_end = label_start - 1;
+        }
+        node->flags |= flag;
+    }
+
+    std::shared_ptr<PublicSuffixTrie> trie(new PublicSuffixTrie());
+    trie->nodes_.emplace_back();
+
+    std::vector<std::pair<const BuildNode*, uint32_t>> stack = {{&root, 0}};
+    while (!stack.empty()) {
+        auto [build_node, index] = stack.back();
+        stack.pop_back();
+        trie->nodes_[index].flags = build_node->flags;
+
+        for (const auto& [label, child] : build_node->children) {
+            Node node;
+            node.parent = index;
+            node.label_offset = static_cast<uint32_t>(trie->labels_.size());
+            node.label_length = static_cast<uint8_t>(label.size());
+            trie->labels_ += label;
+
+            stack.emplace_back(&child, static_cast<uint32_t>(trie->nodes_.size()));
+            trie->nodes_.push_back(node);
+        }
+    }
+
+    /* Labels are read eight bytes at a time */
+    trie->labels_.append(8, '\0');
+
+    /* At most a quarter of the slots are used, most probes end at the first slot */
+    size_t num_slots = 16;
+    while (num_slots < trie->nodes_.size() * 4) {
+        num_slots *= 2;
+    }
+    trie->slots_.assign(num_slots, 0);
+    trie->slot_mask_ = num_slots - 1;
+
+    for (uint32_t index = 1; index < trie->nodes_.size(); index++) {
+        const Node& node = trie->nodes_[index];
+        uint64_t label_hash = HashPaddedLabel(trie->labels_.data() + node.label_offset, node.label_length);
+        uint64_t slot = SlotHash(node.parent, label_hash) & trie->slot_mask_;
+        while (trie->slots_[slot] != 0) {
+            slot = (slot + 1) & trie->slot_mask_;
+        }
+        trie->slots_[slot] = index;
+    }
+
+    return trie;
+}
+
+const PublicSuffixTrie& PublicSuffixTrie::Default() {
+    static const std::shared_ptr<PublicSuffixTrie> trie = Make(kDefaultRules).ValueOrDie();
+    return *trie;
+}
+
+const PublicSuffixTrie::Node* PublicSuffixTrie::FindChild(uint32_t parent, std::string_view label, uint64_t label_hash) const {
+    uint64_t slot = SlotHash(parent, label_hash) & slot_mask_;
+    while (slots_[slot] != 0) {
+        const Node& child = nodes_[slots_[slot]];
+        if (child.parent == parent && child.label_length == label.size() &&
+            EqualPaddedLabel(labels_.data() + child.label_offset, label.data(), label.size())) {
+            return &child;
+        }
+        slot = (slot + 1) & slot_mask_;
+    }
+    return nullptr;
+}
+
+PublicSuffixTrie::Match PublicSuffixTrie::RegistrableDomain(std::string_view host) const {
+    if (!host.empty() && host.back() == '.') {
+        host.remove_suffix(1);
+    }
+    if (host.empty() || host.front() == '[' || host.size() > kMaxHostLength ||
+        host.find(':') != std::string_view::npos) {
+        return {};
+    }
+
+    /*
+     * Labels matched against the trie are lowered into lower once, then
+     * hashed and compared a word at a time. The eight bytes after the
+     * host keep the last word of every label readable.
+     */
+    char lower[kMaxHostLength + 8];
+    std::memset(lower + host.size(), 0, 8);
+
+    /*
+     * Walks the labels from the right. suffix_labels is the length of the
+     * prevailing rule so far, "*" when nothing matches. Only the start of
+     * the label before the public suffix is needed in the end.
+     */
+    const Node* node = &nodes_[0];
+    int suffix_labels = 1;
+    int labels = 0;
+    size_t label_end = host.size();
+    size_t registrable_start = 0;
+    bool found = false;
+
+    while (true) {
+        size_t label_start = label_end;
+        bool digits = true;
+        if (node != nullptr) {
+            while (label_start > 0 && host[label_start - 1] != '.') {
+                unsigned char c = host[label_start - 1];
+                lower[label_start - 1] = static_cast<char>(ToLower(c));
+                digits = digits && c >= '0' && c <= '9';
+                label_start--;
+            }
+            if (label_start > 0) {
+                lower[label_start - 1] = '.';
+            }
+        } else {
+            while (label_start > 0 && host[label_start - 1] != '.') {
+                label_start--;
+            }
+        }
+        std::string_view label(lower + label_start, label_end - label_start);
+        if (label.empty()) {
+            return {};
+        }
+        labels++;
+
+        /* No suffix is all digits, an IPv4 address */
+        if (labels == 1 && digits) {
+            return {};
+        }
+
+        if (node != nullptr) {
+            uint32_t parent = static_cast<uint32_t>(node - nodes_.data());
+            const Node* child = FindChild(parent, label, HashPaddedLabel(label.data(), label.size()));
+            if (child != nullptr && (child->flags & kException)) {
+                suffix_labels = labels - 1;
+                node = nullptr;
+            } else {
+                if ((child != nullptr && (child->flags & kRule)) || (node->flags & kWildcard)) {
+                    suffix_labels = labels;
+                }
+                node = child;
+            }
+        }
+
+        if (labels == suffix_labels + 1) {
+            registrable_start = label_start;
+            found = true;
+        }
+        /* Nothing longer can match and the label before the suffix is known */
+        if ((node == nullptr && labels > suffix_labels) || label_start == 0) {
+            break;
+        }
+        label_end = label_start - 1;
+    }
+
+    if (!found || labels <= suffix_labels) {
+        return {};
+    }
+
+    Match match;
+    match.offset = static_cast<int32_t>(registrable_start);
+    match.length = static_cast<int32_t>(host.size() - registrable_start);
+    return match;
+}
@@ -0,0 +1,82 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <string_view>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Public suffix rules (https://publicsuffix.org/list/) compiled into a
+ * trie over the labels of a domain, last label first. The nodes sit in
+ * one flat array with their labels in one string, the child of a node
+ * for a label is found with a single probe of an open addressing table
+ * keyed by parent and label hash. Immutable once built and safe to share
+ * between threads.
+ */
+class PublicSuffixTrie {
+public:
+    // Registrable domain of a host as a slice of it, length 0 if there is none
+    struct Match {
+        int32_t offset = 0;
+        int32_t length = 0;
+    };
+
+    /*
+     * Rules in the format of the public suffix list: one rule per line,
+     * "*." wildcards, "!" exceptions and "//" comments
+     */
+    static arrow::Result<std::shared_ptr<PublicSuffixTrie>> Make(std::string_view rules);
+
+    // Built in rules for the common generic and country code suffixes
+    static const PublicSuffixTrie& Default();
+
+    // Longer hosts are not DNS names and have no registrable domain
+    static constexpr size_t kMaxHostLength = 255;
+
+    /*
+     * The public suffix of host plus one label, matched without regard
+     * to ASCII case. Hosts that are a public suffix themselves, IP
+     * addresses and empty hosts have no registrable domain.
+     */
+    Match RegistrableDomain(std::string_view host) const;
+
+    size_t num_nodes() const { return nodes_.size(); }
+
+private:
+    struct Node {
+        uint32_t parent = 0;
+        uint32_t label_offset = 0;
+        uint8_t label_length = 0;
+        // kRule, kException, kWildcard
+        uint8_t flags = 0;
+    };
+
+    // The labels down to this node are a rule
+    static constexpr uint8_t kRule = 1;
+    // ... an exception, its parent is the public suffix
+    static constexpr uint8_t kException = 2;
+    // "*." followed by the labels down to this node is a rule
+    static constexpr uint8_t kWildcard = 4;
+
+    static uint64_t SlotHash(uint32_t parent, uint64_t label_hash);
+
+    const Node* FindChild(uint32_t parent, std::string_view label, uint64_t label_hash) const;
+
+    std::vector<Node> nodes_;
+    std::string labels_;
+    // Node indexes by SlotHash, 0 (the root) marks an empty slot
+    std::vector<uint32_t> slots_;
+    uint64_t slot_mask_ = 0;
+};
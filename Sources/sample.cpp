@@ -24,17 +24,16 @@ std::shared_ptr<arrow::Schema> CreateSampleSchema() {
     return schema;
 }
 
-arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch() {
+/* pickGroup returns the index into groups of the next row */
+template <typename PickGroup>
+static arrow::Result<std::shared_ptr<arrow::RecordBatch>> MakeSampleBatch(PickGroup&& pickGroup) {
     arrow::StringBuilder stringBuilder;
     arrow::UInt64Builder intBuilder;
     arrow::StringBuilder dateBuilder;
     arrow::StringBuilder urlBuilder;
-
-    std::mt19937 g;
-    std::uniform_int_distribution<unsigned> distr;
     
     for (int i = 0; i < 100; i++) {
-        ARROW_RETURN_NOT_OK(stringBuilder.Append(groups[rand() % std::size(groups)]));
+        ARROW_RETURN_NOT_OK(stringBuilder.Append(groups[pickGroup()]));
         ARROW_RETURN_NOT_OK(intBuilder.Append(i));
         ARROW_RETURN_NOT_OK(dateBuilder.Append("2025-01-01T00:10:00 CET"));
         
@@ -69,6 +68,15 @@ arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch() {
     return arrow::Result<std::shared_ptr<arrow::RecordBatch>>(rbatch);
 }
 
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch() {
+    return MakeSampleBatch([]() { return rand() % std::size(groups); });
+}
+
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch(std::mt19937& engine) {
+    std::uniform_int_distribution<size_t> distr(0, std::size(groups) - 1);
+    return MakeSampleBatch([&]() { return distr(engine); });
+}
+
 arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> CreateRecordBatchReader() {
     std::shared_ptr<arrow::RecordBatchReader> reader;
     std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
@@ -84,6 +92,30 @@ arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> CreateRecordBatchReader
     return arrow::Result<std::shared_ptr<arrow::RecordBatchReader>>(reader);
 }
 
+arrow::Result<std::vector<std::shared_ptr<arrow::RecordBatchReader>>> CreatePartitionReaders(int numPartitions,
+                                                                                            int batchesPerPartition) {
+    std::vector<std::shared_ptr<arrow::RecordBatchReader>> readers;
+    
+    for (int i = 0; i < numPartitions; i++) {
+        auto remaining = std::make_shared<int>(batchesPerPartition);
+        // Partitions are read concurrently, each one draws from its own engine instead of rand()
+        auto engine = std::make_shared<std::mt19937>(i);
+        auto batches = arrow::MakeFunctionIterator([remaining, engine]() -> arrow::Result<std::shared_ptr<arrow::RecordBatch>> {
+            if (*remaining <= 0) {
+                return nullptr;
+            }
+            (*remaining)--;
+            return CreateSampleBatch(*engine);
+        });
+        
+        std::shared_ptr<arrow::RecordBatchReader> reader;
+        ARROW_ASSIGN_OR_RAISE(reader, arrow::RecordBatchReader::MakeFromIterator(std::move(batches), CreateSampleSchema()));
+        readers.push_back(reader);
+    }
+    
+    return readers;
+}
+
 arrow::Status WriteBatches(std::shared_ptr<arrow::RecordBatchReader> reader) {
     while (true) {
         std::shared_ptr<arrow::RecordBatch> batch;
@@ -17,6 +17,11 @@ namespace ac = arrow::acero;
 namespace cp = arrow::compute;
 
 arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch();
+// Groups are drawn from engine, safe to call concurrently with different engines
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> CreateSampleBatch(std::mt19937& engine);
 arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> CreateRecordBatchReader();
+// Readers that create their sample batches when they are read, one per partition
+arrow::Result<std::vector<std::shared_ptr<arrow::RecordBatchReader>>> CreatePartitionReaders(int numPartitions,
+                                                                                            int batchesPerPartition);
 arrow::Status WriteBatches(std::shared_ptr<arrow::RecordBatchReader> reader);
 std::shared_ptr<arrow::Schema> CreateSampleSchema();
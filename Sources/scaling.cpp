@@ -0,0 +1,141 @@
+//
+//  scaling.cpp
+//  ArrowAcero
+//
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+#import "executor.h"
+#import "nodes.h"
+#import "sample.h"
+#import "sinks.h"
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Runs the same plan on executors with 1 to N threads and reports the
+ * throughput of every run. N defaults to the CPU pool capacity and is
+ * set with --plan-threads; pinning options apply to every executor.
+ * --batches=<n> sets the input size (1000 rows per batch).
+ */
+
+static arrow::Result<std::shared_ptr<arrow::Table>> CreateInputTable(int numBatches) {
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    batches.reserve(numBatches);
+
+    for (int i = 0; i < numBatches; i++) {
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::RecordBatchReader> reader, CreateRecordBatchReader());
+        ARROW_ASSIGN_OR_RAISE(auto readerBatches, reader->ToRecordBatches());
+        batches.insert(batches.end(), readerBatches.begin(), readerBatches.end());
+    }
+
+    return arrow::Table::FromRecordBatches(CreateSampleSchema(), batches);
+}
+
+/*
+ * String clean up of the urls and a grouped count, the CPU bound part of
+ * the sample pipeline
+ */
+static ac::Declaration BenchmarkPlan(std::shared_ptr<arrow::Table> table) {
+    ac::Declaration cleanNode = ProjectNode("replace_substring",
+                                            TableSourceNode(table),
+                                            { "group", "date", "value" },
+                                            "url",
+                                            "url",
+                                            std::make_shared<cp::ReplaceSubstringOptions>("%20", " "));
+
+    return GroupCountNode(cleanNode, "group", "count");
+}
+
+static std::vector<int> ThreadCounts(int maxThreads) {
+    std::vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(maxThreads);
+    return counts;
+}
+
+arrow::Status RunScaling(int argc, char** argv) {
+    int numBatches = 200;
+    std::vector<char*> executorArguments;
+    for (int i = 0; i < argc; i++) {
+        std::string argument = argv[i];
+        if (argument.rfind("--batches=", 0) == 0) {
+            std::string value = argument.substr(10);
+            char* end = nullptr;
+            long batches = std::strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || batches < 1 || batches > std::numeric_limits<int>::max()) {
+                return arrow::Status::Invalid("Invalid value for batches: '", value, "'");
+            }
+            numBatches = static_cast<int>(batches);
+        } else {
+            executorArguments.push_back(argv[i]);
+        }
+    }
+
+    ARROW_ASSIGN_OR_RAISE(ExecutorOptions executorOptions,
+                          ParseExecutorOptions(static_cast<int>(executorArguments.size()), executorArguments.data()));
+    ARROW_RETURN_NOT_OK(ConfigureExecutors(executorOptions));
+    int maxThreads = executorOptions.plan_threads > 0 ? executorOptions.plan_threads : arrow::GetCpuThreadPoolCapacity();
+
+    std::cout << "Executor options: " << executorOptions.ToString() << std::endl;
+    std::cout << "Thread CPU Pool capacity: " << arrow::GetCpuThreadPoolCapacity() << std::endl;
+    std::cout << "Thread I/O Pool capacity: " << arrow::io::GetIOThreadPoolCapacity() << std::endl;
+
+    std::shared_ptr<arrow::Table> table;
+    ARROW_ASSIGN_OR_RAISE(table, CreateInputTable(numBatches));
+    std::cout << "Input rows: " << table->num_rows() << std::endl;
+
+    /* Warm up, so the first run does not pay for allocations */
+    ARROW_RETURN_NOT_OK(ExecutePlanToTable(BenchmarkPlan(table)).status());
+
+    double baseline = 0;
+    for (int threads : ThreadCounts(maxThreads)) {
+        std::shared_ptr<arrow::internal::ThreadPool> executor;
+        ARROW_ASSIGN_OR_RAISE(executor, MakePlanExecutor(threads, executorOptions));
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        ARROW_RETURN_NOT_OK(ExecutePlanToTable(BenchmarkPlan(table), executor.get()).status());
+        auto endTime = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(endTime - startTime).count();
+        double rowsPerSecond = table->num_rows() / seconds;
+        if (baseline == 0) {
+            baseline = rowsPerSecond;
+        }
+
+        std::cout << "threads=" << threads
+                  << " duration=" << static_cast<int64_t>(seconds * 1000) << "ms"
+                  << " rows/s=" << static_cast<int64_t>(rowsPerSecond)
+                  << " speedup=" << rowsPerSecond / baseline
+                  << " efficiency=" << rowsPerSecond / baseline / threads << std::endl;
+    }
+
+    return arrow::Status::OK();
+}
+
+int main(int argc, char** argv) {
+    arrow::dataset::internal::Initialize();
+    arrow::Status st = RunScaling(argc, argv);
+    if (!st.ok()) {
+        std::cerr << st << std::endl;
+        return 1;
+    }
+    return 0;
+}
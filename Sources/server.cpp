@@ -5,6 +5,7 @@
 #include <string>
 
 #include <chrono>
+#include <csignal>
 
 #include <arrow/api.h>
 
@@ -20,65 +21,28 @@
 #import "sinks.h"
 #import "sample.h"
 #import "udf.h"
+#import "flight_server.h"
+#import "custom_nodes.h"
 
-class SampleFlightServer : public arrow::flight::FlightServerBase {
-    arrow::Status ListFlights(const arrow::flight::ServerCallContext& context,
-                              const arrow::flight::Criteria* criteria,
-                              std::unique_ptr<arrow::flight::FlightListing>* listings) override {
-        
-        std::vector<arrow::flight::FlightInfo> flights;
-        
-        ARROW_ASSIGN_OR_RAISE(auto flight, MakeFlightInfo("SAMPLE CMD"));
-        flights.push_back(flight);
-        
-        *listings = std::unique_ptr<arrow::flight::FlightListing>(new arrow::flight::SimpleFlightListing(flights));
-        
-        return arrow::Status::OK();
-    }
+/*
+ * --lookup-table=<name>=<path> makes a local lookup file joinable by
+ * tickets as "lookup=<column>:<lookup key>:<name>", repeat for more
+ */
+arrow::Status RunMain(int argc, char** argv) {
+    ARROW_RETURN_NOT_OK(RegisterCustomFunctions());
+    ARROW_RETURN_NOT_OK(RegisterCustomNodes());
     
-    arrow::Status GetFlightInfo(const arrow::flight::ServerCallContext&,
-                                const arrow::flight::FlightDescriptor& descriptor,
-                                std::unique_ptr<arrow::flight::FlightInfo>* info) override {
-        
-        ARROW_ASSIGN_OR_RAISE(auto flight_info, MakeFlightInfo(descriptor.cmd));
-        
-        *info = std::unique_ptr<arrow::flight::FlightInfo>(new arrow::flight::FlightInfo(std::move(flight_info)));
-        
-        return arrow::Status::OK();
-    }
+    std::unique_ptr<SampleFlightServer> server = std::make_unique<SampleFlightServer>();
     
-    arrow::Status DoGet(const arrow::flight::ServerCallContext&,
-                        const arrow::flight::Ticket& request,
-                        std::unique_ptr<arrow::flight::FlightDataStream>* stream) override {
-        
-        ARROW_ASSIGN_OR_RAISE(auto reader, CreateRecordBatchReader());
-        
-        *stream = std::unique_ptr<arrow::flight::FlightDataStream>(new arrow::flight::RecordBatchStream(reader));
-        
-        return arrow::Status::OK();
+    for (int i = 1; i < argc; i++) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=', 15);
+        if (argument.rfind("--lookup-table=", 0) != 0 || separator == std::string::npos) {
+            return arrow::Status::Invalid("Expected --lookup-table=<name>=<path>, got ", argument);
+        }
+        ARROW_RETURN_NOT_OK(server->AddLookupTable(argument.substr(15, separator - 15), argument.substr(separator + 1)));
     }
     
-private:
-    arrow::Result<arrow::flight::FlightInfo> MakeFlightInfo(const std::string& command) {
-        std::shared_ptr<arrow::Schema> schema = CreateSampleSchema();
-                        
-        arrow::flight::FlightEndpoint endpoint;
-        endpoint.ticket.ticket = command;
-        arrow::flight::Location location;
-        
-        ARROW_ASSIGN_OR_RAISE(location,
-                              arrow::flight::Location::ForGrpcTcp("localhost", port()));
-        endpoint.locations.push_back(location);
-                
-        auto descriptor = arrow::flight::FlightDescriptor::Path({command});
-
-        return arrow::flight::FlightInfo::Make(*schema, descriptor, {endpoint}, 0, 0);
-    }
-};
-
-arrow::Status RunMain() {
-    std::unique_ptr<arrow::flight::FlightServerBase> server = std::make_unique<SampleFlightServer>();
-    
     ARROW_ASSIGN_OR_RAISE(arrow::flight::Location location, arrow::flight::Location::ForGrpcTcp("0.0.0.0", 4500));
     
     arrow::flight::FlightServerOptions options(location);
@@ -92,11 +56,13 @@ arrow::Status RunMain() {
     
     std::cout << "Server listening on localhost:" << server->port() << std::endl;
     ARROW_RETURN_NOT_OK(server->Serve());
+    
+    return arrow::Status::OK();
 }
 
-int main() {
+int main(int argc, char** argv) {
     arrow::dataset::internal::Initialize();
-    arrow::Status st = RunMain();
+    arrow::Status st = RunMain(argc, argv);
     if (!st.ok()) {
         std::cerr << st << std::endl;
         return 1;
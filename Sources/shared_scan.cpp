@@ -0,0 +1,406 @@
+//
+//  shared_scan.cpp
+//  ArrowAcero
+//
+#import "shared_scan.h"
+
+#include <sstream>
+#include <system_error>
+
+arrow::Result<SharedScanRequest> SharedScanRequest::Parse(const std::string& ticket) {
+    SharedScanRequest request;
+
+    std::stringstream ss(ticket);
+    std::string part;
+
+    std::getline(ss, request.source, ';');
+    if (request.source.empty()) {
+        return arrow::Status::Invalid("Ticket '", ticket, "' names no source");
+    }
+
+    while (std::getline(ss, part, ';')) {
+        auto separator = part.find('=');
+        if (separator == std::string::npos || separator == 0) {
+            return arrow::Status::Invalid("Expected <column>=<value> in ticket, got '", part, "'");
+        }
+        std::string key = part.substr(0, separator);
+        std::string value = part.substr(separator + 1);
+
+        if (key == "columns") {
+            std::stringstream columns(value);
+            std::string column;
+            while (std::getline(columns, column, ',')) {
+                request.columns.push_back(column);
+            }
+        } else if (key == "lookup") {
+            size_t first = value.find(':');
+            size_t second = first == std::string::npos ? first : value.find(':', first + 1);
+            if (second == std::string::npos || first == 0 || second == first + 1 || second + 1 == value.size() ||
+                value.find(':', second + 1) != std::string::npos) {
+                return arrow::Status::Invalid("Expected lookup=<column>:<lookup key>:<table> in ticket, got '", part, "'");
+            }
+            request.lookup_column = value.substr(0, first);
+            request.lookup_key = value.substr(first + 1, second - first - 1);
+            request.lookup_table = value.substr(second + 1);
+        } else {
+            request.equals.emplace_back(key, value);
+        }
+    }
+
+    return request;
+}
+
+arrow::Result<std::shared_ptr<arrow::Schema>> SharedScanRequest::OutputSchema(const std::shared_ptr<arrow::Schema>& sourceSchema) const {
+    if (columns.empty()) {
+        return sourceSchema;
+    }
+
+    arrow::FieldVector fields;
+    for (const auto& column : columns) {
+        auto field = sourceSchema->GetFieldByName(column);
+        if (!field) {
+            return arrow::Status::KeyError("No column '", column, "' in source");
+        }
+        fields.push_back(field);
+    }
+    return arrow::schema(fields);
+}
+
+std::string SharedScanStats::ToString() const {
+    std::stringstream ss;
+    ss << "scans=" << scans << " requests=" << requests;
+    return ss.str();
+}
+
+/*
+ * The batches of one request. The scan pushes shared batches, the
+ * request's filter and column selection run on the reading thread.
+ */
+class SharedScanConsumer : public arrow::RecordBatchReader {
+public:
+    SharedScanConsumer(std::shared_ptr<arrow::Schema> schema,
+                       cp::Expression filter,
+                       std::vector<int> columns,
+                       size_t capacity) :
+        schema_(std::move(schema)), filter_(std::move(filter)), columns_(std::move(columns)), capacity_(capacity) {}
+
+    ~SharedScanConsumer() override { Cancel(); }
+
+    std::shared_ptr<arrow::Schema> schema() const override { return schema_; }
+
+    arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override {
+        while (true) {
+            std::shared_ptr<arrow::RecordBatch> shared;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [&] { return !queue_.empty() || finished_; });
+                if (queue_.empty()) {
+                    *batch = nullptr;
+                    return status_;
+                }
+                shared = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            cv_.notify_all();
+
+            ARROW_ASSIGN_OR_RAISE(*batch, Apply(shared));
+            if ((*batch)->num_rows() > 0) {
+                return arrow::Status::OK();
+            }
+        }
+    }
+
+    arrow::Status Close() override {
+        Cancel();
+        return arrow::Status::OK();
+    }
+
+    /* Blocks while the queue is full, false once the request is gone */
+    bool Push(std::shared_ptr<arrow::RecordBatch> batch) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [&] { return queue_.size() < capacity_ || cancelled_; });
+            if (cancelled_) {
+                return false;
+            }
+            queue_.push_back(std::move(batch));
+        }
+        cv_.notify_all();
+        return true;
+    }
+
+    void Finish(arrow::Status status) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_) {
+                return;
+            }
+            finished_ = true;
+            status_ = std::move(status);
+        }
+        cv_.notify_all();
+    }
+
+    /* Fails the request, batches not yet read are dropped */
+    void Abort(arrow::Status status) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancelled_ = true;
+            finished_ = true;
+            status_ = std::move(status);
+            queue_.clear();
+        }
+        cv_.notify_all();
+    }
+
+private:
+    void Cancel() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancelled_ = true;
+            queue_.clear();
+        }
+        cv_.notify_all();
+    }
+
+    arrow::Result<std::shared_ptr<arrow::RecordBatch>> Apply(const std::shared_ptr<arrow::RecordBatch>& batch) {
+        std::shared_ptr<arrow::RecordBatch> filtered = batch;
+
+        if (filter_ != cp::literal(true)) {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum mask, cp::ExecuteScalarExpression(filter_, cp::ExecBatch(*batch)));
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum result, cp::Filter(batch, mask));
+            filtered = result.record_batch();
+        }
+
+        if (columns_.empty()) {
+            return filtered;
+        }
+        return filtered->SelectColumns(columns_);
+    }
+
+    std::shared_ptr<arrow::Schema> schema_;
+    cp::Expression filter_;
+    std::vector<int> columns_;
+    size_t capacity_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<arrow::RecordBatch>> queue_;
+    bool finished_ = false;
+    bool cancelled_ = false;
+    arrow::Status status_;
+};
+
+/*
+ * One pass over a source, fanned out to every attached request
+ */
+class SharedScan {
+public:
+    explicit SharedScan(std::shared_ptr<arrow::RecordBatchReader> reader) : reader_(std::move(reader)) {}
+
+    std::shared_ptr<arrow::Schema> schema() const { return reader_->schema(); }
+
+    void Attach(std::weak_ptr<SharedScanConsumer> consumer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        consumers_.push_back(std::move(consumer));
+    }
+
+    /* Runs once no more requests can attach */
+    void Run() {
+        arrow::Status status = Pump();
+
+        for (auto& consumer : Consumers()) {
+            consumer->Finish(status);
+        }
+        ARROW_UNUSED(reader_->Close());
+    }
+
+    /* Fails every request, a running scan stops after its current batch */
+    void Cancel(const arrow::Status& status) {
+        cancelled_ = true;
+        for (auto& consumer : Consumers()) {
+            consumer->Abort(status);
+        }
+    }
+
+private:
+    std::vector<std::shared_ptr<SharedScanConsumer>> Consumers() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<std::shared_ptr<SharedScanConsumer>> consumers;
+        for (auto& weak : consumers_) {
+            if (auto consumer = weak.lock()) {
+                consumers.push_back(std::move(consumer));
+            }
+        }
+        return consumers;
+    }
+
+    arrow::Status Pump() {
+        while (!cancelled_) {
+            std::shared_ptr<arrow::RecordBatch> batch;
+            ARROW_RETURN_NOT_OK(reader_->ReadNext(&batch));
+            if (!batch) {
+                return arrow::Status::OK();
+            }
+
+            /* Every request went away, no need to finish the scan */
+            bool anyConsumer = false;
+            for (auto& consumer : Consumers()) {
+                anyConsumer = consumer->Push(batch) || anyConsumer;
+            }
+            if (!anyConsumer) {
+                return arrow::Status::OK();
+            }
+        }
+        return arrow::Status::OK();
+    }
+
+    std::shared_ptr<arrow::RecordBatchReader> reader_;
+    std::atomic<bool> cancelled_{false};
+
+    std::mutex mutex_;
+    std::vector<std::weak_ptr<SharedScanConsumer>> consumers_;
+};
+
+SharedScanRegistry::SharedScanRegistry(BatchReaderFactory factory, SharedScanOptions options) :
+    factory_(std::move(factory)), options_(options) {
+    timer_ = std::thread([this] { RunTimer(); });
+}
+
+SharedScanRegistry::~SharedScanRegistry() {
+    std::vector<arrow::Future<>> running;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_ = true;
+
+        arrow::Status status = arrow::Status::Cancelled("Shared scans were shut down");
+        for (auto& delayed : delayed_) {
+            delayed.scan->Cancel(status);
+        }
+        for (auto& [scan, future] : running_) {
+            scan->Cancel(status);
+            running.push_back(future);
+        }
+        delayed_.clear();
+        pending_.clear();
+    }
+    timer_cv_.notify_all();
+    timer_.join();
+
+    for (auto& future : running) {
+        future.Wait();
+    }
+}
+
+SharedScanStats SharedScanRegistry::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+arrow::Result<arrow::Future<>> SharedScanRegistry::StartScan(std::shared_ptr<SharedScan> scan) {
+    if (options_.executor != nullptr) {
+        return options_.executor->Submit([scan] { scan->Run(); });
+    }
+    
+    /*
+     * Its own thread never waits for a pool the factory's reader needs,
+     * the destructor waits for the future instead of joining
+     */
+    arrow::Future<> future = arrow::Future<>::Make();
+    try {
+        std::thread([scan, future]() mutable {
+            scan->Run();
+            future.MarkFinished();
+        }).detach();
+    } catch (const std::system_error& error) {
+        return arrow::Status::IOError("Cannot start a scan thread: ", error.what());
+    }
+    return future;
+}
+
+void SharedScanRegistry::RunTimer() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!shutdown_) {
+        if (delayed_.empty()) {
+            timer_cv_.wait(lock);
+            continue;
+        }
+        if (std::chrono::steady_clock::now() < delayed_.front().start) {
+            timer_cv_.wait_until(lock, delayed_.front().start);
+            continue;
+        }
+
+        DelayedScan delayed = std::move(delayed_.front());
+        delayed_.pop_front();
+        pending_.erase(delayed.source);
+
+        /* Scans that are done no longer need to be stopped */
+        running_.erase(std::remove_if(running_.begin(), running_.end(),
+                                      [](const auto& running) { return running.second.is_finished(); }),
+                       running_.end());
+
+        auto scan = delayed.scan;
+        arrow::Result<arrow::Future<>> future = StartScan(scan);
+        if (future.ok()) {
+            running_.emplace_back(std::move(delayed.scan), std::move(*future));
+        } else {
+            delayed.scan->Cancel(future.status());
+        }
+    }
+}
+
+arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> SharedScanRegistry::Open(const SharedScanRequest& request) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (shutdown_) {
+        return arrow::Status::Cancelled("Shared scans were shut down");
+    }
+
+    std::shared_ptr<SharedScan> scan;
+    bool startScan = false;
+
+    auto pending = options_.share ? pending_.find(request.source) : pending_.end();
+    if (pending != pending_.end()) {
+        scan = pending->second;
+    } else {
+        /* Opening a source only fetches its schema, reading starts after the window */
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::RecordBatchReader> reader, factory_(request.source));
+        scan = std::make_shared<SharedScan>(std::move(reader));
+        startScan = true;
+    }
+
+    std::shared_ptr<arrow::Schema> sourceSchema = scan->schema();
+    ARROW_ASSIGN_OR_RAISE(auto outputSchema, request.OutputSchema(sourceSchema));
+
+    std::vector<int> columns;
+    for (const auto& column : request.columns) {
+        columns.push_back(sourceSchema->GetFieldIndex(column));
+    }
+
+    std::vector<cp::Expression> conditions;
+    for (const auto& equal : request.equals) {
+        auto field = sourceSchema->GetFieldByName(equal.first);
+        if (!field) {
+            return arrow::Status::KeyError("No column '", equal.first, "' to filter on");
+        }
+        ARROW_ASSIGN_OR_RAISE(auto value, arrow::Scalar::Parse(field->type(), equal.second));
+        conditions.push_back(cp::equal(cp::field_ref(equal.first), cp::literal(value)));
+    }
+    ARROW_ASSIGN_OR_RAISE(cp::Expression filter, cp::and_(conditions).Bind(*sourceSchema));
+
+    auto consumer = std::make_shared<SharedScanConsumer>(outputSchema, std::move(filter), std::move(columns), options_.queue_capacity);
+    scan->Attach(consumer);
+    stats_.requests++;
+
+    if (startScan && !options_.share) {
+        delayed_.push_back({std::chrono::steady_clock::now(), request.source, scan});
+        stats_.scans++;
+        timer_cv_.notify_all();
+    } else if (startScan) {
+        pending_[request.source] = scan;
+        delayed_.push_back({std::chrono::steady_clock::now() + options_.coalesce_window, request.source, scan});
+        stats_.scans++;
+        timer_cv_.notify_all();
+    }
+
+    return consumer;
+}
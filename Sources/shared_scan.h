@@ -0,0 +1,115 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * A ticket of the form "<source>;<column>=<value>;columns=<column>,<column>".
+ * Requests for the same source share one scan, the equality filters and
+ * the column selection are applied per request. A part
+ * "lookup=<column>:<lookup key>:<table>" joins the rows with a lookup
+ * table the server knows by that name.
+ */
+struct SharedScanRequest {
+    std::string source;
+    std::vector<std::pair<std::string, std::string>> equals;
+    // Empty keeps all columns
+    std::vector<std::string> columns;
+    // Empty lookup_table joins nothing
+    std::string lookup_column;
+    std::string lookup_key;
+    std::string lookup_table;
+
+    static arrow::Result<SharedScanRequest> Parse(const std::string& ticket);
+
+    // Schema of the batches returned for this request
+    arrow::Result<std::shared_ptr<arrow::Schema>> OutputSchema(const std::shared_ptr<arrow::Schema>& sourceSchema) const;
+};
+
+struct SharedScanOptions {
+    // Requests arriving this long after the first one still join its scan
+    std::chrono::milliseconds coalesce_window{20};
+    // False gives every request its own scan, started without a window
+    bool share = true;
+    // Batches buffered per request, a full queue pauses the shared scan
+    size_t queue_capacity = 8;
+    /*
+     * Runs the scans, nullptr gives every scan a thread of its own. A scan
+     * blocks its thread while request queues are full, on a shared pool it
+     * can starve the readers of the factory, e.g. the I/O of a dataset scan.
+     */
+    arrow::internal::Executor* executor = nullptr;
+};
+
+struct SharedScanStats {
+    int64_t scans = 0;
+    int64_t requests = 0;
+
+    std::string ToString() const;
+};
+
+using BatchReaderFactory = std::function<arrow::Result<std::shared_ptr<arrow::RecordBatchReader>>(const std::string& source)>;
+
+class SharedScan;
+
+/*
+ * Attaches concurrent requests for the same source to one scan. A scan
+ * starts reading on the executor once its coalescing window is over,
+ * later requests start a new scan.
+ */
+class SharedScanRegistry {
+public:
+    SharedScanRegistry(BatchReaderFactory factory, SharedScanOptions options = {});
+
+    // Requests of scans that are waiting or running fail with Cancelled
+    ~SharedScanRegistry();
+
+    arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> Open(const SharedScanRequest& request);
+
+    SharedScanStats stats();
+
+private:
+    struct DelayedScan {
+        std::chrono::steady_clock::time_point start;
+        std::string source;
+        std::shared_ptr<SharedScan> scan;
+    };
+
+    // Starts the delayed scans when their window is over
+    void RunTimer();
+    arrow::Result<arrow::Future<>> StartScan(std::shared_ptr<SharedScan> scan);
+
+    BatchReaderFactory factory_;
+    SharedScanOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable timer_cv_;
+    // Scans still accepting requests, by source
+    std::map<std::string, std::shared_ptr<SharedScan>> pending_;
+    // Pending scans by start time, the window is the same for all
+    std::deque<DelayedScan> delayed_;
+    std::vector<std::pair<std::shared_ptr<SharedScan>, arrow::Future<>>> running_;
+    bool shutdown_ = false;
+    SharedScanStats stats_;
+    std::thread timer_;
+};
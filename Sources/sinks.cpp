@@ -1,4 +1,7 @@
 #import "sinks.h"
+#import "nodes.h"
+
+#include <cmath>
 
 arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToTable(ac::Declaration previousNode) {
     std::shared_ptr<arrow::Table> table;
@@ -7,6 +10,23 @@ arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToTable(ac::Declaration
     return table;
 }
 
+arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToTable(ac::Declaration previousNode,
+                                                               arrow::internal::Executor* executor) {
+    if (executor == nullptr) {
+        return ExecutePlanToTable(std::move(previousNode));
+    }
+    
+    /* Synchronous execution is not allowed with a custom executor, wait on the future instead */
+    cp::ExecContext execContext(arrow::default_memory_pool(), executor);
+    
+    arrow::Future<std::shared_ptr<arrow::Table>> future = ac::DeclarationToTableAsync(std::move(previousNode), execContext);
+    
+    std::shared_ptr<arrow::Table> table;
+    ARROW_ASSIGN_OR_RAISE(table, future.result());
+    
+    return table;
+}
+
 arrow::Status ExecutePlanToDataset(ac::Declaration previousNode, std::string dataset_path) {
     std::string root_path;
     
@@ -46,6 +66,67 @@ arrow::Status ExecutePlanToDataset(ac::Declaration previousNode, std::string dat
     return arrow::Status::OK();
 }
 
+/* Writes all batches of reader as an IPC file to path, the output is closed on return */
+static arrow::Status WriteIpcCacheFile(arrow::fs::FileSystem* filesystem,
+                                       const std::string& path,
+                                       arrow::RecordBatchReader* reader,
+                                       const arrow::ipc::IpcWriteOptions& write_options,
+                                       int64_t* rows) {
+    ARROW_ASSIGN_OR_RAISE(auto output, filesystem->OpenOutputStream(path));
+    ARROW_ASSIGN_OR_RAISE(auto writer, arrow::ipc::MakeFileWriter(output, reader->schema(), write_options));
+    
+    while (true) {
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::RecordBatch> batch, reader->Next());
+        if (!batch) {
+            break;
+        }
+        ARROW_RETURN_NOT_OK(writer->WriteRecordBatch(*batch));
+        *rows += batch->num_rows();
+    }
+    ARROW_RETURN_NOT_OK(writer->Close());
+    ARROW_RETURN_NOT_OK(output->Close());
+    return reader->Close();
+}
+
+arrow::Status ExecutePlanToIpcCache(ac::Declaration previousNode,
+                                    std::string cache_path,
+                                    IpcCacheCompression compression) {
+    std::string path;
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
+                          arrow::fs::FileSystemFromUri(cache_path, &path));
+    
+    std::cout << "Writing IPC cache to " << path << std::endl;
+    
+    auto write_options = arrow::ipc::IpcWriteOptions::Defaults();
+    if (compression == IpcCacheCompression::LZ4) {
+        ARROW_ASSIGN_OR_RAISE(write_options.codec, arrow::util::Codec::Create(arrow::Compression::LZ4_FRAME));
+    }
+    
+    /*
+     * Batches are streamed into the file, readers never see a partial
+     * cache because it is moved into place at the end
+     */
+    std::string temp_path = path + ".tmp";
+    
+    ARROW_ASSIGN_OR_RAISE(std::unique_ptr<arrow::RecordBatchReader> reader, ac::DeclarationToReader(std::move(previousNode)));
+    
+    int64_t rows = 0;
+    arrow::Status status = WriteIpcCacheFile(filesystem.get(), temp_path, reader.get(), write_options, &rows);
+    if (status.ok()) {
+        status = filesystem->Move(temp_path, path);
+    }
+    if (!status.ok()) {
+        /* Nothing reads a partial file, it would only be left behind */
+        ARROW_UNUSED(filesystem->DeleteFile(temp_path));
+        return status;
+    }
+    
+    std::cout << "IPC cache written to " << path << " (" << rows << " rows)" << std::endl;
+    
+    return arrow::Status::OK();
+}
+
 arrow::Result<std::shared_ptr<arrow::DoubleScalar>> TableToDoubleScalar(std::shared_ptr<arrow::Table> table) {
     // Access the first column (index 0) from the Table
     std::shared_ptr<arrow::ChunkedArray> column = table->column(0);  // First column (int_column)
@@ -63,3 +144,545 @@ arrow::Result<std::shared_ptr<arrow::ChunkedArray>> TableToArray(std::shared_ptr
     
     return valuesColumn;
 }
+
+
+std::string QuantileEstimate::ToString() const {
+    std::stringstream ss;
+    ss << "q" << quantile << ": " << value
+       << ", " << confidence * 100 << "% interval [" << lower << ", " << upper << "]"
+       << ", sample size " << sample_size;
+    return ss.str();
+}
+
+/* Inverse of the standard normal distribution, Acklam's rational approximation */
+static double NormalQuantile(double p) {
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    
+    if (p < 0.02425) {
+        double q = std::sqrt(-2 * std::log(p));
+        return (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+    }
+    if (p > 1 - 0.02425) {
+        return -NormalQuantile(1 - p);
+    }
+    double q = p - 0.5;
+    double r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+        (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+arrow::Result<QuantileEstimate> EstimateQuantile(std::shared_ptr<arrow::Table> table,
+                                                 std::string columnName,
+                                                 double quantile,
+                                                 double confidence) {
+    if (!(quantile >= 0 && quantile <= 1) || !(confidence > 0 && confidence < 1)) {
+        return arrow::Status::Invalid("Quantile must be in [0, 1] and confidence in (0, 1)");
+    }
+    std::shared_ptr<arrow::ChunkedArray> column = table->GetColumnByName(columnName);
+    if (!column) {
+        return arrow::Status::KeyError("No column '", columnName, "' to estimate the quantile of");
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(arrow::Datum values, cp::Cast(column, arrow::float64()));
+    ARROW_ASSIGN_OR_RAISE(arrow::Datum valid, cp::DropNull(values));
+    if (valid.length() == 0) {
+        return arrow::Status::Invalid("No values in the sample to estimate the quantile from");
+    }
+    ARROW_ASSIGN_OR_RAISE(auto valid_array, arrow::Concatenate(valid.chunked_array()->chunks()));
+    ARROW_ASSIGN_OR_RAISE(auto sorted_indices, cp::SortIndices(*valid_array));
+    ARROW_ASSIGN_OR_RAISE(auto sorted_array, cp::Take(*valid_array, *sorted_indices));
+    
+    const auto& doubles = static_cast<const arrow::DoubleArray&>(*sorted_array);
+    const int64_t n = doubles.length();
+    
+    QuantileEstimate estimate;
+    estimate.quantile = quantile;
+    estimate.confidence = confidence;
+    estimate.sample_size = n;
+    
+    /* Linear interpolation between the closest ranks, as the quantile kernel does */
+    double rank = quantile * (n - 1);
+    int64_t below = static_cast<int64_t>(std::floor(rank));
+    int64_t above = std::min(below + 1, n - 1);
+    estimate.value = doubles.Value(below) + (rank - below) * (doubles.Value(above) - doubles.Value(below));
+    
+    /*
+     * The number of sampled values below the true quantile is binomial(n, q),
+     * its normal approximation gives the ranks that bound the interval
+     */
+    double z = NormalQuantile(0.5 + confidence / 2);
+    double spread = z * std::sqrt(n * quantile * (1 - quantile));
+    int64_t lower = std::max<int64_t>(0, static_cast<int64_t>(std::floor(n * quantile - spread)) - 1);
+    int64_t upper = std::min<int64_t>(n - 1, static_cast<int64_t>(std::ceil(n * quantile + spread)) - 1);
+    lower = std::min(lower, below);
+    upper = std::max(upper, above);
+    estimate.lower = doubles.Value(lower);
+    estimate.upper = doubles.Value(upper);
+    
+    return estimate;
+}
+
+std::string SpillStats::ToString() const {
+    std::stringstream ss;
+    ss << "spills: " << spill_count
+       << ", spilled rows: " << spilled_rows
+       << ", spilled bytes: " << spilled_bytes
+       << ", repartitions: " << repartitions
+       << ", partitions merged: " << partitions_merged;
+    return ss.str();
+}
+
+std::shared_ptr<arrow::KeyValueMetadata> SpillStats::ToMetadata() const {
+    return arrow::key_value_metadata({"spill_count", "spilled_rows", "spilled_bytes", "repartitions", "partitions_merged"},
+                                     {std::to_string(spill_count), std::to_string(spilled_rows), std::to_string(spilled_bytes),
+                                      std::to_string(repartitions), std::to_string(partitions_merged)});
+}
+
+static void CombineHash(uint64_t* hash, uint64_t value) {
+    *hash ^= value + 0x9e3779b97f4a7c15ULL + (*hash << 6) + (*hash >> 2);
+}
+
+/*
+ * Mixes the values of one key column into the per row hashes
+ */
+static arrow::Status HashKeyColumn(const arrow::Array& column, std::vector<uint64_t>* hashes) {
+    const arrow::ArraySpan span(*column.data());
+    int64_t i = 0;
+    
+    auto visit_null = [&]() {
+        CombineHash(&(*hashes)[i++], 0);
+        return arrow::Status::OK();
+    };
+    auto visit_value = [&](std::string_view value) {
+        CombineHash(&(*hashes)[i++], arrow::internal::ComputeStringHash<0>(value.data(), value.size()));
+        return arrow::Status::OK();
+    };
+    
+    switch (column.type_id()) {
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            return arrow::VisitArraySpanInline<arrow::StringType>(span, visit_value, visit_null);
+        case arrow::Type::LARGE_STRING:
+        case arrow::Type::LARGE_BINARY:
+            return arrow::VisitArraySpanInline<arrow::LargeStringType>(span, visit_value, visit_null);
+        default:
+            break;
+    }
+    
+    /* Dictionaries are decoded before, their indices do not identify a group */
+    if (!arrow::is_fixed_width(column.type_id()) || column.type_id() == arrow::Type::BOOL ||
+        column.type_id() == arrow::Type::DICTIONARY) {
+        return arrow::Status::NotImplemented("Cannot spill on key of type ", column.type()->ToString());
+    }
+    
+    const int byte_width = column.type()->byte_width();
+    const uint8_t* values = span.buffers[1].data + span.offset * byte_width;
+    for (; i < span.length; i++) {
+        if (span.IsNull(i)) {
+            CombineHash(&(*hashes)[i], 0);
+        } else {
+            CombineHash(&(*hashes)[i], arrow::internal::ComputeStringHash<0>(values + i * byte_width, byte_width));
+        }
+    }
+    return arrow::Status::OK();
+}
+
+/*
+ * Partition of a row hash on a spill level. Every level mixes the hash
+ * differently, so the rows of one partition spread over all partitions
+ * of the next level.
+ */
+static int PartitionOf(uint64_t hash, int level, int num_partitions) {
+    hash += static_cast<uint64_t>(level) * 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return static_cast<int>(hash % num_partitions);
+}
+
+/*
+ * Splits a batch into num_partitions batches by the hash of the key columns,
+ * all rows of a group end up in the same partition
+ */
+static arrow::Result<std::vector<std::shared_ptr<arrow::RecordBatch>>> PartitionBatch(const std::shared_ptr<arrow::RecordBatch>& batch,
+                                                                                     const std::vector<std::string>& keys,
+                                                                                     int num_partitions,
+                                                                                     int level) {
+    std::vector<uint64_t> hashes(batch->num_rows(), 0);
+    for (const auto& key : keys) {
+        std::shared_ptr<arrow::Array> column = batch->GetColumnByName(key);
+        if (!column) {
+            return arrow::Status::Invalid("Key column ", key, " not found in ", batch->schema()->ToString());
+        }
+        ARROW_RETURN_NOT_OK(HashKeyColumn(*column, &hashes));
+    }
+    
+    std::vector<std::vector<int32_t>> partition_rows(num_partitions);
+    for (int64_t i = 0; i < batch->num_rows(); i++) {
+        partition_rows[PartitionOf(hashes[i], level, num_partitions)].push_back(static_cast<int32_t>(i));
+    }
+    
+    std::vector<std::shared_ptr<arrow::RecordBatch>> partitions(num_partitions);
+    for (int p = 0; p < num_partitions; p++) {
+        if (partition_rows[p].empty()) {
+            continue;
+        }
+        arrow::Int32Builder indices_builder;
+        ARROW_RETURN_NOT_OK(indices_builder.AppendValues(partition_rows[p]));
+        ARROW_ASSIGN_OR_RAISE(auto indices, indices_builder.Finish());
+        
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(batch, indices));
+        partitions[p] = taken.record_batch();
+    }
+    return partitions;
+}
+
+/*
+ * Spill files of one aggregation, the directory is removed when done
+ */
+class SpillDirectory {
+public:
+    ~SpillDirectory() {
+        if (filesystem_) {
+            for (auto& writer : writers_) {
+                if (writer) {
+                    (void)writer->Close();
+                }
+            }
+            (void)filesystem_->DeleteDir(path_);
+        }
+    }
+    
+    arrow::Status Open(const SpillOptions& options, std::shared_ptr<arrow::Schema> schema) {
+        std::string root_path;
+        ARROW_ASSIGN_OR_RAISE(filesystem_, arrow::fs::FileSystemFromUri(options.spill_directory, &root_path));
+        
+        std::random_device random;
+        std::stringstream ss;
+        ss << root_path << "/acero-spill-" << std::hex << random() << random();
+        path_ = ss.str();
+        
+        ARROW_RETURN_NOT_OK(filesystem_->CreateDir(path_));
+        
+        schema_ = std::move(schema);
+        writers_.resize(options.num_partitions);
+        sinks_.resize(options.num_partitions);
+        rows_.resize(options.num_partitions, 0);
+        bytes_.resize(options.num_partitions, 0);
+        return arrow::Status::OK();
+    }
+    
+    bool is_open() const { return filesystem_ != nullptr; }
+    
+    int num_partitions() const { return static_cast<int>(writers_.size()); }
+    
+    // Rows and in-memory size of the batches written to partition
+    int64_t partition_rows(int partition) const { return rows_[partition]; }
+    int64_t partition_bytes(int partition) const { return bytes_[partition]; }
+    
+    arrow::Status Write(int partition, const std::shared_ptr<arrow::RecordBatch>& batch) {
+        if (!writers_[partition]) {
+            ARROW_ASSIGN_OR_RAISE(sinks_[partition], filesystem_->OpenOutputStream(PartitionPath(partition)));
+            ARROW_ASSIGN_OR_RAISE(writers_[partition], arrow::ipc::MakeStreamWriter(sinks_[partition], schema_));
+        }
+        rows_[partition] += batch->num_rows();
+        bytes_[partition] += arrow::util::TotalBufferSize(*batch);
+        return writers_[partition]->WriteRecordBatch(*batch);
+    }
+    
+    // Closes all writers and returns the number of bytes on disk
+    arrow::Result<int64_t> Finish() {
+        int64_t bytes = 0;
+        for (int p = 0; p < num_partitions(); p++) {
+            if (writers_[p]) {
+                ARROW_RETURN_NOT_OK(writers_[p]->Close());
+                ARROW_ASSIGN_OR_RAISE(int64_t position, sinks_[p]->Tell());
+                ARROW_RETURN_NOT_OK(sinks_[p]->Close());
+                writers_[p].reset();
+                bytes += position;
+            }
+        }
+        return bytes;
+    }
+    
+    // Reads a spilled partition back, or nullptr if nothing was spilled into it
+    arrow::Result<std::shared_ptr<arrow::RecordBatchReader>> OpenPartition(int partition) {
+        if (!sinks_[partition]) {
+            return nullptr;
+        }
+        ARROW_ASSIGN_OR_RAISE(auto input, filesystem_->OpenInputStream(PartitionPath(partition)));
+        return arrow::ipc::RecordBatchStreamReader::Open(input);
+    }
+    
+private:
+    std::string PartitionPath(int partition) const {
+        return path_ + "/part" + std::to_string(partition) + ".arrows";
+    }
+    
+    std::shared_ptr<arrow::fs::FileSystem> filesystem_;
+    std::string path_;
+    std::shared_ptr<arrow::Schema> schema_;
+    std::vector<std::shared_ptr<arrow::io::OutputStream>> sinks_;
+    std::vector<std::shared_ptr<arrow::ipc::RecordBatchWriter>> writers_;
+    std::vector<int64_t> rows_;
+    std::vector<int64_t> bytes_;
+};
+
+/*
+ * Every batch brings its own dictionaries, spilled partitions would carry
+ * all of them. Dictionary columns are aggregated as their values instead.
+ */
+static std::shared_ptr<arrow::Schema> DecodedSchema(const arrow::Schema& schema) {
+    arrow::FieldVector fields;
+    for (const auto& field : schema.fields()) {
+        if (field->type()->id() == arrow::Type::DICTIONARY) {
+            const auto& type = arrow::internal::checked_cast<const arrow::DictionaryType&>(*field->type());
+            fields.push_back(field->WithType(type.value_type()));
+        } else {
+            fields.push_back(field);
+        }
+    }
+    return arrow::schema(std::move(fields), schema.metadata());
+}
+
+static arrow::Result<std::shared_ptr<arrow::RecordBatch>> DecodeDictionaries(const std::shared_ptr<arrow::RecordBatch>& batch,
+                                                                            const std::shared_ptr<arrow::Schema>& schema) {
+    std::vector<std::shared_ptr<arrow::Array>> columns = batch->columns();
+    for (auto& column : columns) {
+        if (column->type_id() == arrow::Type::DICTIONARY) {
+            const auto& type = arrow::internal::checked_cast<const arrow::DictionaryType&>(*column->type());
+            ARROW_ASSIGN_OR_RAISE(column, cp::Cast(*column, type.value_type()));
+        }
+    }
+    return arrow::RecordBatch::Make(schema, batch->num_rows(), std::move(columns));
+}
+
+static arrow::Result<std::shared_ptr<arrow::Table>> AggregateTable(std::shared_ptr<arrow::Table> table,
+                                                                  const std::vector<cp::Aggregate>& aggregates,
+                                                                  const std::vector<std::string>& keys) {
+    std::vector<arrow::FieldRef> key_refs(keys.begin(), keys.end());
+    
+    ac::Declaration aggregate{
+        "aggregate", {TableSourceNode(std::move(table))}, ac::AggregateNodeOptions{aggregates, key_refs}};
+    
+    return ExecutePlanToTable(std::move(aggregate));
+}
+
+/*
+ * How rows are spilled and aggregated back. Aggregates that can be
+ * combined from partial results are spilled as one row per group and
+ * buffer, all others as their input rows.
+ */
+struct SpillAggregation {
+    // Applied to the buffered rows before they are spilled, empty to spill the rows themselves
+    std::vector<cp::Aggregate> partial;
+    // Applied to the spilled rows of a partition
+    std::vector<cp::Aggregate> merge;
+};
+
+static SpillAggregation MakeSpillAggregation(const std::vector<cp::Aggregate>& aggregates) {
+    static const std::unordered_map<std::string, std::string> combine_functions = {
+        {"hash_count", "hash_sum"},
+        {"hash_count_all", "hash_sum"},
+        {"hash_sum", "hash_sum"},
+        {"hash_product", "hash_product"},
+        {"hash_min", "hash_min"},
+        {"hash_max", "hash_max"},
+        {"hash_any", "hash_any"},
+        {"hash_all", "hash_all"}
+    };
+    
+    SpillAggregation spill;
+    for (const auto& aggregate : aggregates) {
+        auto combine = combine_functions.find(aggregate.function);
+        /* A minimum count per group does not hold for the partial results of a group */
+        const auto* scalar_options = dynamic_cast<const cp::ScalarAggregateOptions*>(aggregate.options.get());
+        if (combine == combine_functions.end() || aggregate.name.empty() || (scalar_options && scalar_options->min_count > 1)) {
+            return {{}, aggregates};
+        }
+        
+        /* Counts are summed with the default options, the others combine with their own */
+        std::shared_ptr<cp::FunctionOptions> options = combine->first == combine->second ? aggregate.options : nullptr;
+        spill.merge.emplace_back(combine->second, std::move(options), arrow::FieldRef(aggregate.name), aggregate.name);
+    }
+    spill.partial = aggregates;
+    return spill;
+}
+
+static constexpr int kMaxSpillLevels = 4;
+
+/*
+ * Aggregates the partitions of spill into results. A partition larger
+ * than the memory threshold is partitioned again on the next level.
+ * unsplit counts the levels above whose repartitioning kept all rows
+ * of the partition together.
+ */
+static arrow::Status AggregateSpilled(SpillDirectory* spill,
+                                      const SpillAggregation& aggregation,
+                                      const std::vector<std::string>& keys,
+                                      const SpillOptions& options,
+                                      int level,
+                                      int unsplit,
+                                      SpillStats* stats,
+                                      std::vector<std::shared_ptr<arrow::Table>>* results) {
+    for (int p = 0; p < spill->num_partitions(); p++) {
+        ARROW_ASSIGN_OR_RAISE(auto reader, spill->OpenPartition(p));
+        if (!reader) {
+            continue;
+        }
+        
+        if (spill->partition_bytes(p) <= options.memory_threshold) {
+            ARROW_ASSIGN_OR_RAISE(auto partition, reader->ToTable());
+            ARROW_ASSIGN_OR_RAISE(auto result, AggregateTable(std::move(partition), aggregation.merge, keys));
+            results->push_back(std::move(result));
+            stats->partitions_merged++;
+            continue;
+        }
+        
+        if (level + 1 >= kMaxSpillLevels) {
+            return arrow::Status::CapacityError("Spilled partition of ", spill->partition_bytes(p), " bytes is still above the memory threshold of ",
+                                                options.memory_threshold, " bytes after ", level, " repartitions");
+        }
+        
+        SpillDirectory repartitioned;
+        ARROW_RETURN_NOT_OK(repartitioned.Open(options, reader->schema()));
+        while (true) {
+            std::shared_ptr<arrow::RecordBatch> batch;
+            ARROW_RETURN_NOT_OK(reader->ReadNext(&batch));
+            if (!batch) {
+                break;
+            }
+            ARROW_ASSIGN_OR_RAISE(auto partitions, PartitionBatch(batch, keys, repartitioned.num_partitions(), level + 1));
+            for (int q = 0; q < repartitioned.num_partitions(); q++) {
+                if (partitions[q]) {
+                    ARROW_RETURN_NOT_OK(repartitioned.Write(q, partitions[q]));
+                }
+            }
+        }
+        ARROW_ASSIGN_OR_RAISE(int64_t spilled_bytes, repartitioned.Finish());
+        stats->spilled_bytes += spilled_bytes;
+        stats->repartitions++;
+        
+        /*
+         * All rows in one partition may still be a few groups whose hashes
+         * met by chance, the next level mixes the hash with another seed.
+         * Rows that stay together under two seeds are taken as one group.
+         */
+        bool split = true;
+        for (int q = 0; q < repartitioned.num_partitions(); q++) {
+            if (repartitioned.partition_rows(q) == spill->partition_rows(p)) {
+                split = false;
+            }
+        }
+        if (!split && unsplit + 1 >= 2) {
+            return arrow::Status::CapacityError("Spilled partition of ", spill->partition_bytes(p), " bytes did not split under ", unsplit + 1,
+                                                " hash seeds, its rows most likely belong to a single group above the memory threshold of ",
+                                                options.memory_threshold, " bytes");
+        }
+        
+        ARROW_RETURN_NOT_OK(AggregateSpilled(&repartitioned, aggregation, keys, options, level + 1, split ? 0 : unsplit + 1, stats, results));
+    }
+    return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToSpillingAggregate(ac::Declaration previousNode,
+                                                                           std::vector<cp::Aggregate> aggregates,
+                                                                           std::vector<std::string> keys,
+                                                                           const SpillOptions& options,
+                                                                           SpillStats* stats) {
+    if (options.num_partitions <= 0) {
+        return arrow::Status::Invalid("SpillOptions::num_partitions must be positive");
+    }
+    SpillStats local_stats;
+    if (stats == nullptr) {
+        stats = &local_stats;
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(std::unique_ptr<arrow::RecordBatchReader> reader, ac::DeclarationToReader(std::move(previousNode)));
+    std::shared_ptr<arrow::Schema> schema = DecodedSchema(*reader->schema());
+    
+    SpillAggregation aggregation = MakeSpillAggregation(aggregates);
+    SpillDirectory spill;
+    std::vector<std::shared_ptr<arrow::RecordBatch>> buffered;
+    int64_t buffered_bytes = 0;
+    
+    auto spill_buffered = [&]() -> arrow::Status {
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(schema, buffered));
+        stats->spilled_rows += table->num_rows();
+        buffered.clear();
+        buffered_bytes = 0;
+        
+        if (!aggregation.partial.empty()) {
+            ARROW_ASSIGN_OR_RAISE(table, AggregateTable(std::move(table), aggregation.partial, keys));
+        }
+        if (!spill.is_open()) {
+            ARROW_RETURN_NOT_OK(spill.Open(options, table->schema()));
+        }
+        
+        arrow::TableBatchReader batches(*table);
+        while (true) {
+            std::shared_ptr<arrow::RecordBatch> batch;
+            ARROW_RETURN_NOT_OK(batches.ReadNext(&batch));
+            if (!batch) {
+                break;
+            }
+            ARROW_ASSIGN_OR_RAISE(auto partitions, PartitionBatch(batch, keys, spill.num_partitions(), 0));
+            for (int p = 0; p < spill.num_partitions(); p++) {
+                if (partitions[p]) {
+                    ARROW_RETURN_NOT_OK(spill.Write(p, partitions[p]));
+                }
+            }
+        }
+        stats->spill_count++;
+        return arrow::Status::OK();
+    };
+    
+    while (true) {
+        std::shared_ptr<arrow::RecordBatch> batch;
+        ARROW_RETURN_NOT_OK(reader->ReadNext(&batch));
+        if (!batch) {
+            break;
+        }
+        ARROW_ASSIGN_OR_RAISE(batch, DecodeDictionaries(batch, schema));
+        buffered_bytes += arrow::util::TotalBufferSize(*batch);
+        buffered.push_back(std::move(batch));
+        
+        if (buffered_bytes >= options.memory_threshold) {
+            ARROW_RETURN_NOT_OK(spill_buffered());
+        }
+    }
+    
+    /*
+     * Everything fit into memory, aggregate directly
+     */
+    if (!spill.is_open()) {
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(schema, buffered));
+        buffered.clear();
+        ARROW_ASSIGN_OR_RAISE(auto result, AggregateTable(std::move(table), aggregates, keys));
+        return result->ReplaceSchemaMetadata(stats->ToMetadata());
+    }
+    
+    /*
+     * Partitions hold disjoint groups, so the aggregated partitions
+     * can simply be concatenated
+     */
+    if (!buffered.empty()) {
+        ARROW_RETURN_NOT_OK(spill_buffered());
+    }
+    ARROW_ASSIGN_OR_RAISE(int64_t spilled_bytes, spill.Finish());
+    stats->spilled_bytes += spilled_bytes;
+    
+    std::vector<std::shared_ptr<arrow::Table>> results;
+    ARROW_RETURN_NOT_OK(AggregateSpilled(&spill, aggregation, keys, options, 0, 0, stats, &results));
+    
+    ARROW_ASSIGN_OR_RAISE(auto result, arrow::ConcatenateTables(results));
+    return result->ReplaceSchemaMetadata(stats->ToMetadata());
+}
@@ -12,11 +12,95 @@
 #include <arrow/acero/api.h>
 #include <arrow/dataset/api.h>
 #include <arrow/dataset/plan.h>
+#include <arrow/ipc/api.h>
+#include <arrow/util/byte_size.h>
+#include <arrow/util/hashing.h>
+#include <arrow/visit_data_inline.h>
 
 namespace ac = arrow::acero;
 namespace cp = arrow::compute;
 
 arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToTable(ac::Declaration previousNode);
+// Runs the plan on `executor` instead of the global CPU pool
+arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToTable(ac::Declaration previousNode,
+                                                               arrow::internal::Executor* executor);
 arrow::Status ExecutePlanToDataset(ac::Declaration previousNode, std::string dataset_path);
+
+enum class IpcCacheCompression {
+    // Batches are mapped without any decoding or copying when read back
+    UNCOMPRESSED,
+    // Smaller files, buffers are decompressed when read back
+    LZ4
+};
+
+/*
+ * Writes the plan output to a single Arrow IPC file, read it back with
+ * OpenIpcCacheNode
+ */
+arrow::Status ExecutePlanToIpcCache(ac::Declaration previousNode,
+                                    std::string cache_path,
+                                    IpcCacheCompression compression = IpcCacheCompression::UNCOMPRESSED);
 arrow::Result<std::shared_ptr<arrow::DoubleScalar>> TableToDoubleScalar(std::shared_ptr<arrow::Table> table);
 arrow::Result<std::shared_ptr<arrow::ChunkedArray>> TableToArray(std::shared_ptr<arrow::Table> table);
+
+/*
+ * A quantile of a sample with a distribution free confidence interval
+ * from the order statistics around its rank
+ */
+struct QuantileEstimate {
+    double quantile = 0;
+    double value = 0;
+    double lower = 0;
+    double upper = 0;
+    double confidence = 0;
+    int64_t sample_size = 0;
+    
+    std::string ToString() const;
+};
+
+/*
+ * Estimates the quantile of columnName from a sampled table. The interval
+ * assumes independently sampled rows, e.g. the groups of a hash sample.
+ */
+arrow::Result<QuantileEstimate> EstimateQuantile(std::shared_ptr<arrow::Table> table,
+                                                 std::string columnName,
+                                                 double quantile,
+                                                 double confidence = 0.95);
+
+struct SpillOptions {
+    // Buffered input size after which the buffer is hash partitioned to disk,
+    // also the largest spilled partition that is aggregated without partitioning it again
+    int64_t memory_threshold = 256LL * 1024 * 1024;
+    int num_partitions = 64;
+    std::string spill_directory = "file:///tmp";
+};
+
+struct SpillStats {
+    int64_t spill_count = 0;
+    int64_t spilled_rows = 0;
+    int64_t spilled_bytes = 0;
+    int64_t repartitions = 0;
+    int64_t partitions_merged = 0;
+    
+    std::string ToString() const;
+    // The counters as schema metadata of the aggregated table
+    std::shared_ptr<arrow::KeyValueMetadata> ToMetadata() const;
+};
+
+/*
+ * Grouped aggregation that hash partitions its input to disk whenever
+ * memory_threshold bytes are buffered. Counts, sums, products, minimums
+ * and maximums are spilled as partial results per group, other aggregates
+ * as input rows. A spilled partition above the threshold is partitioned
+ * again. A partition whose rows stay together under two hash seeds is
+ * taken as a single group above the threshold and fails with
+ * CapacityError. Dictionary
+ * columns are decoded to their values. The returned
+ * table carries the spill counters as schema metadata, `stats` may be
+ * nullptr.
+ */
+arrow::Result<std::shared_ptr<arrow::Table>> ExecutePlanToSpillingAggregate(ac::Declaration previousNode,
+                                                                           std::vector<cp::Aggregate> aggregates,
+                                                                           std::vector<std::string> keys,
+                                                                           const SpillOptions& options,
+                                                                           SpillStats* stats);
@@ -0,0 +1,355 @@
+//
+//  sorted_merge.cpp
+//  ArrowAcero
+//
+#import "sorted_merge.h"
+
+#include <cmath>
+
+static arrow::Result<SortKeyColumn> MakeSortKeyColumn(std::shared_ptr<arrow::Array> array, cp::SortOrder order) {
+    SortKeyColumn column;
+    column.descending = order == cp::SortOrder::Descending;
+
+    /* Dictionary encoded keys are compared by their values */
+    if (array->type_id() == arrow::Type::DICTIONARY) {
+        const auto& type = arrow::internal::checked_cast<const arrow::DictionaryType&>(*array->type());
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum decoded, cp::Cast(array, type.value_type()));
+        array = decoded.make_array();
+    }
+
+    /* Temporal values compare as the integers they are stored as */
+    switch (array->type_id()) {
+        case arrow::Type::DATE32:
+        case arrow::Type::TIME32: {
+            ARROW_ASSIGN_OR_RAISE(array, array->View(arrow::int32()));
+            break;
+        }
+        case arrow::Type::DATE64:
+        case arrow::Type::TIME64:
+        case arrow::Type::TIMESTAMP:
+        case arrow::Type::DURATION: {
+            ARROW_ASSIGN_OR_RAISE(array, array->View(arrow::int64()));
+            break;
+        }
+        default:
+            break;
+    }
+
+    switch (array->type_id()) {
+        case arrow::Type::BOOL:
+        case arrow::Type::INT8:
+        case arrow::Type::INT16:
+        case arrow::Type::INT32: {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum widened, cp::Cast(array, arrow::int64()));
+            array = widened.make_array();
+            column.kind = SortKeyColumn::SIGNED;
+            break;
+        }
+        case arrow::Type::INT64:
+            column.kind = SortKeyColumn::SIGNED;
+            break;
+        case arrow::Type::UINT8:
+        case arrow::Type::UINT16:
+        case arrow::Type::UINT32:
+        case arrow::Type::UINT64: {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum widened, cp::Cast(array, arrow::uint64()));
+            array = widened.make_array();
+            column.kind = SortKeyColumn::UNSIGNED;
+            break;
+        }
+        case arrow::Type::FLOAT:
+        case arrow::Type::DOUBLE: {
+            ARROW_ASSIGN_OR_RAISE(arrow::Datum widened, cp::Cast(array, arrow::float64()));
+            array = widened.make_array();
+            column.kind = SortKeyColumn::FLOATING;
+            break;
+        }
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+        case arrow::Type::LARGE_STRING:
+        case arrow::Type::LARGE_BINARY:
+        case arrow::Type::STRING_VIEW:
+        case arrow::Type::BINARY_VIEW:
+            column.kind = SortKeyColumn::BINARY;
+            break;
+        default:
+            return arrow::Status::NotImplemented("Sorted merge on ", array->type()->ToString(), " keys");
+    }
+
+    column.values = std::move(array);
+    return column;
+}
+
+static std::string_view BinaryValue(const arrow::Array& array, int64_t row) {
+    switch (array.type_id()) {
+        case arrow::Type::STRING:
+        case arrow::Type::BINARY:
+            return static_cast<const arrow::BinaryArray&>(array).GetView(row);
+        case arrow::Type::LARGE_STRING:
+        case arrow::Type::LARGE_BINARY:
+            return static_cast<const arrow::LargeBinaryArray&>(array).GetView(row);
+        default:
+            return static_cast<const arrow::BinaryViewArray&>(array).GetView(row);
+    }
+}
+
+template <typename T> static int CompareValues(T a, T b) {
+    return (a > b) - (a < b);
+}
+
+/* Compares row ra of a with row rb of b, nulls and NaNs are greater than any value */
+static int CompareRows(const std::vector<SortKeyColumn>& a, int64_t ra, const std::vector<SortKeyColumn>& b, int64_t rb) {
+    for (size_t k = 0; k < a.size(); k++) {
+        const arrow::Array& left = *a[k].values;
+        const arrow::Array& right = *b[k].values;
+
+        bool left_null = left.IsNull(ra);
+        bool right_null = right.IsNull(rb);
+        if (left_null || right_null) {
+            if (left_null && right_null) {
+                continue;
+            }
+            return left_null ? 1 : -1;
+        }
+
+        int result = 0;
+        switch (a[k].kind) {
+            case SortKeyColumn::SIGNED:
+                result = CompareValues(static_cast<const arrow::Int64Array&>(left).Value(ra),
+                                       static_cast<const arrow::Int64Array&>(right).Value(rb));
+                break;
+            case SortKeyColumn::UNSIGNED:
+                result = CompareValues(static_cast<const arrow::UInt64Array&>(left).Value(ra),
+                                       static_cast<const arrow::UInt64Array&>(right).Value(rb));
+                break;
+            case SortKeyColumn::FLOATING: {
+                double x = static_cast<const arrow::DoubleArray&>(left).Value(ra);
+                double y = static_cast<const arrow::DoubleArray&>(right).Value(rb);
+                if (std::isnan(x) || std::isnan(y)) {
+                    if (std::isnan(x) && std::isnan(y)) {
+                        continue;
+                    }
+                    return std::isnan(x) ? 1 : -1;
+                }
+                result = CompareValues(x, y);
+                break;
+            }
+            case SortKeyColumn::BINARY:
+                result = BinaryValue(left, ra).compare(BinaryValue(right, rb));
+                result = CompareValues(result, 0);
+                break;
+        }
+
+        if (result != 0) {
+            return a[k].descending ? -result : result;
+        }
+    }
+    return 0;
+}
+
+arrow::Result<std::shared_ptr<SortedMergeReader>> SortedMergeReader::Make(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                                                          std::vector<cp::SortKey> keys,
+                                                                          int64_t batchSize) {
+    if (partitions.empty() || keys.empty()) {
+        return arrow::Status::Invalid("A sorted merge needs at least one partition and one sort key");
+    }
+    if (batchSize < 1) {
+        return arrow::Status::Invalid("Sorted merge batch size must be at least 1");
+    }
+
+    std::shared_ptr<SortedMergeReader> merge(new SortedMergeReader());
+    merge->schema_ = partitions[0]->schema();
+    merge->sort_keys_ = std::move(keys);
+    merge->batch_size_ = batchSize;
+
+    for (const auto& key : merge->sort_keys_) {
+        ARROW_ASSIGN_OR_RAISE(arrow::FieldPath path, key.target.FindOne(*merge->schema_));
+        merge->key_paths_.push_back(std::move(path));
+    }
+
+    merge->cursors_.resize(partitions.size());
+    for (size_t i = 0; i < partitions.size(); i++) {
+        if (!partitions[i]->schema()->Equals(*merge->schema_)) {
+            return arrow::Status::Invalid("Partition schema ", partitions[i]->schema()->ToString(),
+                                          " differs from ", merge->schema_->ToString());
+        }
+        Cursor& cursor = merge->cursors_[i];
+        cursor.reader = std::move(partitions[i]);
+        cursor.index = static_cast<int>(i);
+    }
+
+    return merge;
+}
+
+arrow::Status SortedMergeReader::Start() {
+    auto after = [this](const Cursor* a, const Cursor* b) { return Before(*b, b->row, *a); };
+    for (auto& cursor : cursors_) {
+        ARROW_RETURN_NOT_OK(Advance(&cursor));
+        if (cursor.batch) {
+            heap_.push_back(&cursor);
+            std::push_heap(heap_.begin(), heap_.end(), after);
+        }
+    }
+    started_ = true;
+    return arrow::Status::OK();
+}
+
+arrow::Status SortedMergeReader::Advance(Cursor* cursor) {
+    std::shared_ptr<arrow::RecordBatch> previous = std::move(cursor->batch);
+    std::vector<SortKeyColumn> previous_keys = std::move(cursor->keys);
+
+    cursor->batch = nullptr;
+    cursor->keys.clear();
+    cursor->row = 0;
+    cursor->source = -1;
+
+    std::shared_ptr<arrow::RecordBatch> batch;
+    do {
+        ARROW_RETURN_NOT_OK(cursor->reader->ReadNext(&batch));
+    } while (batch && batch->num_rows() == 0);
+    if (!batch) {
+        return arrow::Status::OK();
+    }
+
+    std::vector<SortKeyColumn> keys;
+    for (size_t k = 0; k < key_paths_.size(); k++) {
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Array> column, key_paths_[k].Get(*batch));
+        ARROW_ASSIGN_OR_RAISE(SortKeyColumn key, MakeSortKeyColumn(std::move(column), sort_keys_[k].order));
+        keys.push_back(std::move(key));
+    }
+
+    /* Batches within a partition are checked at their boundaries only */
+    if (previous && CompareRows(keys, 0, previous_keys, previous->num_rows() - 1) < 0) {
+        return arrow::Status::Invalid("Partition ", cursor->index, " of the sorted merge is not sorted by its keys");
+    }
+
+    cursor->batch = std::move(batch);
+    cursor->keys = std::move(keys);
+    return arrow::Status::OK();
+}
+
+bool SortedMergeReader::Before(const Cursor& a, int64_t row, const Cursor& b) const {
+    int result = CompareRows(a.keys, row, b.keys, b.row);
+    return result < 0 || (result == 0 && a.index < b.index);
+}
+
+int64_t SortedMergeReader::RunEnd(const Cursor& cursor, const Cursor& next, int64_t limit) const {
+    /* The current row comes first, gallop past the rows after it that still do */
+    int64_t known = cursor.row;
+    int64_t step = 1;
+    while (known + step < limit && Before(cursor, known + step, next)) {
+        known += step;
+        step *= 2;
+    }
+
+    /* The end is in (known, min(known + step, limit)] */
+    int64_t low = known + 1;
+    int64_t high = std::min(known + step, limit);
+    while (low < high) {
+        int64_t middle = low + (high - low) / 2;
+        if (Before(cursor, middle, next)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void SortedMergeReader::AddRun(Cursor* cursor, int64_t end) {
+    if (cursor->source < 0) {
+        cursor->source = static_cast<int>(sources_.size());
+        sources_.push_back(cursor->batch);
+    }
+
+    /* Continues the previous run when the same cursor is still the smallest */
+    if (!runs_.empty() && runs_.back().source == cursor->source &&
+        runs_.back().offset + runs_.back().length == cursor->row) {
+        runs_.back().length += end - cursor->row;
+    } else {
+        runs_.push_back({cursor->source, cursor->row, end - cursor->row});
+    }
+    rows_ += end - cursor->row;
+}
+
+arrow::Result<std::shared_ptr<arrow::RecordBatch>> SortedMergeReader::Flush() {
+    std::shared_ptr<arrow::RecordBatch> batch;
+
+    if (runs_.size() == 1) {
+        /* Partitions that do not overlap are passed on without a copy */
+        batch = sources_[runs_[0].source]->Slice(runs_[0].offset, runs_[0].length);
+    } else if (runs_.size() * 32 <= static_cast<size_t>(rows_)) {
+        /* Long runs are concatenated */
+        std::vector<std::shared_ptr<arrow::RecordBatch>> slices;
+        for (const auto& run : runs_) {
+            slices.push_back(sources_[run.source]->Slice(run.offset, run.length));
+        }
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(schema_, slices));
+        ARROW_ASSIGN_OR_RAISE(batch, table->CombineChunksToBatch());
+    } else {
+        /* Short runs are taken row by row from the batches they come from */
+        std::vector<int64_t> source_offsets;
+        int64_t offset = 0;
+        for (const auto& source : sources_) {
+            source_offsets.push_back(offset);
+            offset += source->num_rows();
+        }
+
+        arrow::Int64Builder indices;
+        ARROW_RETURN_NOT_OK(indices.Reserve(rows_));
+        for (const auto& run : runs_) {
+            int64_t first = source_offsets[run.source] + run.offset;
+            for (int64_t i = 0; i < run.length; i++) {
+                indices.UnsafeAppend(first + i);
+            }
+        }
+        ARROW_ASSIGN_OR_RAISE(auto index_array, indices.Finish());
+
+        ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches(schema_, sources_));
+        ARROW_ASSIGN_OR_RAISE(arrow::Datum taken, cp::Take(table, index_array));
+        ARROW_ASSIGN_OR_RAISE(batch, taken.table()->CombineChunksToBatch());
+    }
+
+    sources_.clear();
+    runs_.clear();
+    rows_ = 0;
+    for (auto& cursor : cursors_) {
+        cursor.source = -1;
+    }
+    return batch;
+}
+
+arrow::Status SortedMergeReader::ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) {
+    /* Partitions are opened by the first read, not when the plan is declared */
+    if (!started_) {
+        ARROW_RETURN_NOT_OK(Start());
+    }
+    auto after = [this](const Cursor* a, const Cursor* b) { return Before(*b, b->row, *a); };
+
+    while (rows_ < batch_size_ && !heap_.empty()) {
+        std::pop_heap(heap_.begin(), heap_.end(), after);
+        Cursor* cursor = heap_.back();
+        heap_.pop_back();
+
+        int64_t limit = std::min(cursor->batch->num_rows(), cursor->row + (batch_size_ - rows_));
+        int64_t end = heap_.empty() ? limit : RunEnd(*cursor, *heap_.front(), limit);
+        AddRun(cursor, end);
+        cursor->row = end;
+
+        if (cursor->row == cursor->batch->num_rows()) {
+            ARROW_RETURN_NOT_OK(Advance(cursor));
+            if (!cursor->batch) {
+                continue;
+            }
+        }
+        heap_.push_back(cursor);
+        std::push_heap(heap_.begin(), heap_.end(), after);
+    }
+
+    if (rows_ == 0) {
+        *batch = nullptr;
+        return arrow::Status::OK();
+    }
+    ARROW_ASSIGN_OR_RAISE(*batch, Flush());
+    return arrow::Status::OK();
+}
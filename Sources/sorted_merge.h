@@ -0,0 +1,101 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+
+#include <chrono>
+#include <string_view>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * A sort key column of one batch in a form its rows can be compared in:
+ * integers and temporal values as int64 or uint64, floats as double,
+ * strings and binaries as they are
+ */
+struct SortKeyColumn {
+    enum Kind { SIGNED, UNSIGNED, FLOATING, BINARY };
+
+    Kind kind = SIGNED;
+    bool descending = false;
+    std::shared_ptr<arrow::Array> values;
+};
+
+/*
+ * K-way merge of readers that are each sorted by keys into one stream
+ * sorted by keys. Only the current batch of every reader and the rows
+ * of the output batch being built are held, so memory does not grow
+ * with the input. Runs of rows from one reader are found by galloping
+ * and copied as a whole. Equal rows come from the earlier reader first,
+ * nulls and NaNs sort last in either order.
+ */
+class SortedMergeReader : public arrow::RecordBatchReader {
+public:
+    static arrow::Result<std::shared_ptr<SortedMergeReader>> Make(std::vector<std::shared_ptr<arrow::RecordBatchReader>> partitions,
+                                                                  std::vector<cp::SortKey> keys,
+                                                                  int64_t batchSize);
+
+    std::shared_ptr<arrow::Schema> schema() const override { return schema_; }
+
+    arrow::Status ReadNext(std::shared_ptr<arrow::RecordBatch>* batch) override;
+
+private:
+    struct Cursor {
+        std::shared_ptr<arrow::RecordBatchReader> reader;
+        std::shared_ptr<arrow::RecordBatch> batch;
+        std::vector<SortKeyColumn> keys;
+        int64_t row = 0;
+        // Partition number, breaks ties
+        int index = 0;
+        // Position of batch in sources_, -1 while no row of it is in the output
+        int source = -1;
+    };
+
+    // Rows [offset, offset + length) of sources_[source]
+    struct Run {
+        int source;
+        int64_t offset;
+        int64_t length;
+    };
+
+    SortedMergeReader() = default;
+
+    // Reads the first batch of every partition
+    arrow::Status Start();
+
+    // Reads the next non-empty batch of cursor, batch is nullptr at the end
+    arrow::Status Advance(Cursor* cursor);
+
+    // Row of a comes before the current row of b
+    bool Before(const Cursor& a, int64_t row, const Cursor& b) const;
+
+    // End of the rows of cursor, up to limit, that come before the current row of next
+    int64_t RunEnd(const Cursor& cursor, const Cursor& next, int64_t limit) const;
+
+    void AddRun(Cursor* cursor, int64_t end);
+
+    arrow::Result<std::shared_ptr<arrow::RecordBatch>> Flush();
+
+    std::shared_ptr<arrow::Schema> schema_;
+    std::vector<cp::SortKey> sort_keys_;
+    std::vector<arrow::FieldPath> key_paths_;
+    int64_t batch_size_ = 0;
+
+    std::vector<Cursor> cursors_;
+    bool started_ = false;
+    // Cursors with rows left, ordered by their current row
+    std::vector<Cursor*> heap_;
+
+    std::vector<std::shared_ptr<arrow::RecordBatch>> sources_;
+    std::vector<Run> runs_;
+    int64_t rows_ = 0;
+};
@@ -0,0 +1,173 @@
+//
+//  state.cpp
+//  ArrowAcero
+//
+#import "state.h"
+#import "nodes.h"
+#import "sinks.h"
+
+#include <sstream>
+
+/* Schema metadata key of the merged partition ids, one per line */
+static const char kMergedPartitionsKey[] = "merged_partitions";
+
+arrow::Result<GroupCountState> LoadGroupCountState(std::string state_path) {
+    GroupCountState state;
+    std::string path;
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
+                          arrow::fs::FileSystemFromUri(state_path, &path));
+    
+    ARROW_ASSIGN_OR_RAISE(arrow::fs::FileInfo info, filesystem->GetFileInfo(path));
+    if (info.type() == arrow::fs::FileType::NotFound) {
+        std::cout << "No group count state at " << path << ", starting empty" << std::endl;
+        return state;
+    }
+    
+    ARROW_ASSIGN_OR_RAISE(auto input, filesystem->OpenInputFile(info));
+    ARROW_ASSIGN_OR_RAISE(auto reader, arrow::ipc::RecordBatchFileReader::Open(input));
+    
+    std::vector<std::shared_ptr<arrow::RecordBatch>> batches;
+    for (int i = 0; i < reader->num_record_batches(); i++) {
+        ARROW_ASSIGN_OR_RAISE(auto batch, reader->ReadRecordBatch(i));
+        batches.push_back(std::move(batch));
+    }
+    
+    /*
+     * The ids are kept apart from the schema of the counts, so merging
+     * them never carries the metadata along
+     */
+    std::shared_ptr<arrow::Schema> schema = reader->schema();
+    int idsIndex = schema->metadata() ? schema->metadata()->FindKey(kMergedPartitionsKey) : -1;
+    if (idsIndex >= 0) {
+        std::istringstream lines(schema->metadata()->value(idsIndex));
+        std::string id;
+        while (std::getline(lines, id)) {
+            state.merged_partitions.insert(id);
+        }
+    }
+    schema = schema->RemoveMetadata();
+    
+    ARROW_ASSIGN_OR_RAISE(state.counts, arrow::Table::FromRecordBatches(schema, batches));
+    
+    return state;
+}
+
+arrow::Status SaveGroupCountState(const GroupCountState& state, std::string state_path) {
+    std::string path;
+    
+    ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::fs::FileSystem> filesystem,
+                          arrow::fs::FileSystemFromUri(state_path, &path));
+    
+    std::string ids;
+    for (const std::string& id : state.merged_partitions) {
+        ids += id + "\n";
+    }
+    
+    /*
+     * The ids are written into the same file as the counts, both are
+     * replaced together or not at all
+     */
+    std::shared_ptr<arrow::Table> counts =
+        state.counts->ReplaceSchemaMetadata(arrow::key_value_metadata({kMergedPartitionsKey}, {ids}));
+    
+    /*
+     * Write next to the state and move over it, a crash never leaves
+     * a half written state behind
+     */
+    std::string temp_path = path + ".tmp";
+    
+    ARROW_ASSIGN_OR_RAISE(auto output, filesystem->OpenOutputStream(temp_path));
+    ARROW_ASSIGN_OR_RAISE(auto writer, arrow::ipc::MakeFileWriter(output, counts->schema()));
+    ARROW_RETURN_NOT_OK(writer->WriteTable(*counts));
+    ARROW_RETURN_NOT_OK(writer->Close());
+    ARROW_RETURN_NOT_OK(output->Close());
+    
+    ARROW_RETURN_NOT_OK(filesystem->Move(temp_path, path));
+    
+    std::cout << "Group count state written to " << path << std::endl;
+    
+    return arrow::Status::OK();
+}
+
+arrow::Result<std::shared_ptr<arrow::Table>> MergeGroupCounts(std::shared_ptr<arrow::Table> counts,
+                                                             ac::Declaration newData,
+                                                             std::string columnName) {
+    /*
+     * Count only the new data
+     */
+    std::shared_ptr<arrow::Table> newCounts;
+    ARROW_ASSIGN_OR_RAISE(newCounts, ExecutePlanToTable(GroupCountNode(std::move(newData), columnName, "count")));
+    
+    if (!counts) {
+        return newCounts;
+    }
+    
+    /*
+     * Counts are additive, summing per group merges both states
+     */
+    ARROW_ASSIGN_OR_RAISE(auto combined, arrow::ConcatenateTables({counts, newCounts}));
+    
+    auto sum_options = std::make_shared<cp::ScalarAggregateOptions>();
+    auto group_aggregate_options =
+    ac::AggregateNodeOptions{{{"hash_sum", sum_options, "count", "count"}},
+        {columnName}};
+    
+    ac::Declaration group_aggregate{
+        "aggregate", {TableSourceNode(std::move(combined))}, std::move(group_aggregate_options)};
+    
+    return ExecutePlanToTable(std::move(group_aggregate));
+}
+
+arrow::Result<GroupCountState> UpdateGroupCountState(std::string state_path,
+                                                     std::vector<GroupCountPartition> partitions,
+                                                     std::string columnName,
+                                                     double quantile) {
+    GroupCountState state;
+    ARROW_ASSIGN_OR_RAISE(state, LoadGroupCountState(state_path));
+    
+    /*
+     * Count only partitions the state has not seen, a rerun over the
+     * same partitions leaves the counts as they are
+     */
+    std::vector<ac::Declaration::Input> newData;
+    for (GroupCountPartition& partition : partitions) {
+        if (partition.id.empty() || partition.id.find('\n') != std::string::npos) {
+            return arrow::Status::Invalid("Partition id must be non-empty and a single line: '", partition.id, "'");
+        }
+        if (!state.merged_partitions.insert(partition.id).second) {
+            std::cout << "Partition " << partition.id << " already merged, skipping" << std::endl;
+            continue;
+        }
+        newData.push_back(std::move(partition.data));
+    }
+    
+    if (!newData.empty()) {
+        ac::Declaration newNode = newData.size() == 1
+            ? std::get<ac::Declaration>(std::move(newData[0]))
+            : ac::Declaration{"union", std::move(newData), ac::ExecNodeOptions{}};
+        ARROW_ASSIGN_OR_RAISE(state.counts, MergeGroupCounts(state.counts, std::move(newNode), columnName));
+        ARROW_RETURN_NOT_OK(SaveGroupCountState(state, state_path));
+    }
+    
+    if (!state.counts) {
+        return arrow::Status::Invalid("No group counts at ", state_path, " and no partitions to count");
+    }
+    
+    /*
+     * Threshold and exclusion set only depend on the merged counts,
+     * one row per group instead of the whole history
+     */
+    std::shared_ptr<arrow::Table> quantileTable;
+    ARROW_ASSIGN_OR_RAISE(quantileTable, ExecutePlanToTable(QuantileNode(TableSourceNode(state.counts), "count", quantile)));
+    
+    std::shared_ptr<arrow::DoubleScalar> threshold;
+    ARROW_ASSIGN_OR_RAISE(threshold, TableToDoubleScalar(quantileTable));
+    state.threshold = threshold->value;
+    
+    std::shared_ptr<arrow::Table> excludedTable;
+    ARROW_ASSIGN_OR_RAISE(excludedTable, ExecutePlanToTable(FilterGreaterEqualNode(TableSourceNode(state.counts), "count", state.threshold)));
+    ARROW_ASSIGN_OR_RAISE(state.excluded, TableToArray(excludedTable));
+    
+    return state;
+}
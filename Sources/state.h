@@ -0,0 +1,55 @@
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+
+#include <chrono>
+
+#include <arrow/api.h>
+
+#include <arrow/compute/api.h>
+#include <arrow/acero/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/dataset/plan.h>
+#include <arrow/ipc/api.h>
+
+namespace ac = arrow::acero;
+namespace cp = arrow::compute;
+
+/*
+ * Per group counts that are kept between runs, so appended data only
+ * needs to be counted once and merged into the existing state
+ */
+struct GroupCountState {
+    // Columns: <group column>, "count"; nullptr when nothing was counted yet
+    std::shared_ptr<arrow::Table> counts;
+    // Ids of the partitions already merged into counts, saved with them
+    std::set<std::string> merged_partitions;
+    
+    double threshold = 0;
+    std::shared_ptr<arrow::ChunkedArray> excluded;
+};
+
+// One appended partition, the id must stay the same between runs
+struct GroupCountPartition {
+    std::string id;
+    ac::Declaration data;
+};
+
+arrow::Result<GroupCountState> LoadGroupCountState(std::string state_path);
+arrow::Status SaveGroupCountState(const GroupCountState& state, std::string state_path);
+
+arrow::Result<std::shared_ptr<arrow::Table>> MergeGroupCounts(std::shared_ptr<arrow::Table> counts,
+                                                             ac::Declaration newData,
+                                                             std::string columnName);
+
+/*
+ * Merges the partitions that are not in the saved state yet, partitions
+ * merged by an earlier run are skipped and never counted twice
+ */
+arrow::Result<GroupCountState> UpdateGroupCountState(std::string state_path,
+                                                     std::vector<GroupCountPartition> partitions,
+                                                     std::string columnName,
+                                                     double quantile);
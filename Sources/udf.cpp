@@ -5,12 +5,35 @@
 //  Created by Matt Herold on 12.03.25.
 //
 #import "udf.h"
+#import "metrics.h"
+#import "public_suffix.h"
+
+#include <cmath>
+#include <set>
+
+#include <arrow/util/binary_view_util.h>
+#include <arrow/util/byte_size.h>
+#include <arrow/util/hashing.h>
 
 template <typename offset_type> static int64_t GetVarBinaryValuesLength(const arrow::ArraySpan& span) {
     const offset_type* offsets = span.GetValues<offset_type>(1);
     return span.length > 0 ? offsets[span.length] - offsets[0] : 0;
 }
 
+/* Bytes of the values of a string array, with offsets or views */
+template <typename Type> static int64_t GetStringValuesLength(const arrow::ArraySpan& span) {
+    if constexpr (arrow::is_binary_view_like_type<Type>::value) {
+        const auto* views = span.GetValues<arrow::BinaryViewType::c_type>(1);
+        int64_t length = 0;
+        for (int64_t i = 0; i < span.length; i++) {
+            length += views[i].size();
+        }
+        return length;
+    } else {
+        return GetVarBinaryValuesLength<typename Type::offset_type>(span);
+    }
+}
+
 
 template <typename OptionsType>
 struct OptionsWrapper : public cp::KernelState {
@@ -57,6 +80,9 @@ struct StringTransformBase {
                       uint8_t* output) {
         return 0;
     }
+    
+    // Inputs the transform could not handle, counted into the kernel metrics
+    int64_t parse_failures = 0;
 };
 
 template <typename Type, typename StringTransform, typename Options> struct StringTransformExec {
@@ -65,6 +91,7 @@ template <typename Type, typename StringTransform, typename Options> struct Stri
     static arrow::Status Execute(cp::KernelContext* ctx, const cp::ExecSpan& batch,
                                  cp::ExecResult* out) {
         const auto& options = State::Get(ctx);
+        KernelMetricsScope metrics(KernelMetricsId(ctx->kernel()), batch.length, 0);
         
         StringTransform transform;
         RETURN_NOT_OK(transform.PreExec(ctx, batch, out));
@@ -78,6 +105,7 @@ template <typename Type, typename StringTransform, typename Options> struct Stri
         const int64_t max_output_ncodeunits =
         transform.MaxCodeunits(input.length, input_ncodeunits);
         RETURN_NOT_OK(CheckOutputCapacity(max_output_ncodeunits));
+        metrics.metrics().bytes_in = input_ncodeunits;
         
         arrow::ArrayData* output = out->array_data().get();
         ARROW_ASSIGN_OR_RAISE(auto values_buffer, ctx->Allocate(max_output_ncodeunits));
@@ -106,6 +134,10 @@ template <typename Type, typename StringTransform, typename Options> struct Stri
             output_string_offsets[i + 1] = output_ncodeunits;
         }
         
+        metrics.metrics().bytes_out = output_ncodeunits;
+        metrics.metrics().null_outputs = input.GetNullCount();
+        metrics.metrics().parse_failures = transform.parse_failures;
+        
         return values_buffer->Resize(output_ncodeunits, /*shrink_to_fit=*/true);
     }
     
@@ -118,6 +150,214 @@ template <typename Type, typename StringTransform, typename Options> struct Stri
     }
 };
 
+/*
+ * StringTransformExec for string_view arrays. Views have no offsets to
+ * preallocate, each value is transformed into a scratch buffer and
+ * appended to the output views.
+ */
+template <typename StringTransform, typename Options> struct StringViewTransformExec {
+    using State = OptionsWrapper<Options>;
+    
+    static arrow::Status Execute(cp::KernelContext* ctx, const cp::ExecSpan& batch,
+                                 cp::ExecResult* out) {
+        KernelMetricsScope metrics(KernelMetricsId(ctx->kernel()), batch.length, 0);
+        
+        StringTransform transform;
+        RETURN_NOT_OK(transform.PreExec(ctx, batch, out));
+        
+        const arrow::ArraySpan& input = batch[0].array;
+        
+        arrow::StringViewBuilder builder(ctx->memory_pool());
+        RETURN_NOT_OK(builder.Reserve(input.length));
+        
+        std::string scratch;
+        int64_t input_ncodeunits = 0;
+        int64_t output_ncodeunits = 0;
+        
+        auto visit_value = [&](std::string_view value) {
+            scratch.resize(transform.MaxCodeunits(1, value.size()));
+            int64_t encoded_nbytes = transform.Transform(reinterpret_cast<const uint8_t*>(value.data()), value.size(),
+                                                         reinterpret_cast<uint8_t*>(scratch.data()));
+            if (encoded_nbytes < 0) {
+                return transform.InvalidInputSequence();
+            }
+            
+            input_ncodeunits += value.size();
+            output_ncodeunits += encoded_nbytes;
+            return builder.Append(scratch.data(), encoded_nbytes);
+        };
+        
+        auto visit_null = [&]() {
+            return builder.AppendNull();
+        };
+        
+        RETURN_NOT_OK(arrow::VisitArraySpanInline<arrow::StringViewType>(input, visit_value, visit_null));
+        
+        std::shared_ptr<arrow::Array> output;
+        RETURN_NOT_OK(builder.Finish(&output));
+        
+        metrics.metrics().bytes_in = input_ncodeunits;
+        metrics.metrics().bytes_out = output_ncodeunits;
+        metrics.metrics().null_outputs = output->null_count();
+        metrics.metrics().parse_failures = transform.parse_failures;
+        
+        out->value = std::move(output->data());
+        return arrow::Status::OK();
+    }
+};
+
+/* Bytes of the rows an aggregate consumes, slices count their own rows only */
+static int64_t ExecSpanBytes(const cp::ExecSpan& batch) {
+    int64_t bytes = 0;
+    for (int i = 0; i < batch.num_values(); i++) {
+        if (!batch[i].is_array()) {
+            continue;
+        }
+        const arrow::ArraySpan& span = batch[i].array;
+        if (arrow::is_binary_like(span.type->id())) {
+            bytes += GetVarBinaryValuesLength<int32_t>(span) + span.length * sizeof(int32_t);
+        } else if (arrow::is_large_binary_like(span.type->id())) {
+            bytes += GetVarBinaryValuesLength<int64_t>(span) + span.length * sizeof(int64_t);
+        } else if (arrow::is_binary_view_like(span.type->id())) {
+            bytes += GetStringValuesLength<arrow::StringViewType>(span) + span.length * sizeof(arrow::BinaryViewType::c_type);
+        } else if (span.type->bit_width() > 0) {
+            bytes += span.length * span.type->bit_width() / 8;
+        }
+    }
+    return bytes;
+}
+
+/* Aggregates may receive a scalar argument, broadcast it to the batch length */
+static arrow::Result<std::shared_ptr<arrow::ArrayData>> ArgumentAsArray(cp::KernelContext* ctx, const cp::ExecSpan& batch, int i) {
+    if (batch[i].is_array()) {
+        return batch[i].array.ToArrayData();
+    }
+    ARROW_ASSIGN_OR_RAISE(auto array, arrow::MakeArrayFromScalar(*batch[i].scalar, batch.length, ctx->memory_pool()));
+    return array->data();
+}
+
+/*
+ * Scalar aggregate kernel around an Impl with
+ *
+ *   arrow::Status Init(cp::KernelContext*, const Options&);
+ *   arrow::Status Consume(cp::KernelContext*, const cp::ExecSpan&);
+ *   arrow::Status Merge(cp::KernelContext*, Impl&& other);
+ *   arrow::Status Finalize(cp::KernelContext*, arrow::Datum*);
+ *
+ * Acero creates one state per thread, consumes batches into it without
+ * locking and merges the thread states before finalizing.
+ */
+template <typename Impl, typename Options> struct ScalarAggregateExec {
+    struct State : public cp::KernelState {
+        Impl impl;
+        int metrics_id = -1;
+    };
+    
+    static State& GetState(cp::KernelState* state) {
+        return *::arrow::internal::checked_cast<State*>(state);
+    }
+    
+    static Impl& Get(cp::KernelState* state) {
+        return GetState(state).impl;
+    }
+    
+    static arrow::Result<std::unique_ptr<cp::KernelState>> Init(cp::KernelContext* ctx,
+                                                                const cp::KernelInitArgs& args) {
+        auto state = std::make_unique<State>();
+        state->metrics_id = KernelMetricsId(args.kernel);
+        ARROW_RETURN_NOT_OK(state->impl.Init(ctx, args.options ? static_cast<const Options&>(*args.options) : Options()));
+        return state;
+    }
+    
+    static arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch) {
+        State& state = GetState(ctx->state());
+        KernelMetricsScope metrics(state.metrics_id, batch.length, ExecSpanBytes(batch));
+        return state.impl.Consume(ctx, batch);
+    }
+    
+    static arrow::Status Merge(cp::KernelContext* ctx, cp::KernelState&& src, cp::KernelState* dst) {
+        return Get(dst).Merge(ctx, std::move(Get(&src)));
+    }
+    
+    static arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        State& state = GetState(ctx->state());
+        // Finalizing adds to the time, it is not an invocation of its own
+        KernelMetricsScope metrics(state.metrics_id, 0, 0);
+        metrics.metrics().invocations = 0;
+        return state.impl.Finalize(ctx, out);
+    }
+    
+    static cp::ScalarAggregateKernel MakeKernel(std::vector<cp::InputType> in_types, cp::OutputType out_type,
+                                                bool ordered = false) {
+        return cp::ScalarAggregateKernel(std::move(in_types), std::move(out_type), Init, Consume, Merge, Finalize, ordered);
+    }
+};
+
+/*
+ * Hash (grouped) aggregate kernel around an Impl with
+ *
+ *   arrow::Status Init(cp::KernelContext*, const Options&);
+ *   arrow::Status Resize(cp::KernelContext*, int64_t new_num_groups);
+ *   arrow::Status Consume(cp::KernelContext*, const cp::ExecSpan&, const uint32_t* group_ids);
+ *   arrow::Status Merge(cp::KernelContext*, Impl&& other, const uint32_t* group_id_mapping);
+ *   arrow::Status Finalize(cp::KernelContext*, arrow::Datum*);
+ *
+ * Consume gets the group of every row, Merge maps each group of the other
+ * thread's state to ours and Finalize returns one value per group.
+ */
+template <typename Impl, typename Options> struct HashAggregateExec {
+    struct State : public cp::KernelState {
+        Impl impl;
+        int metrics_id = -1;
+    };
+    
+    static State& GetState(cp::KernelState* state) {
+        return *::arrow::internal::checked_cast<State*>(state);
+    }
+    
+    static Impl& Get(cp::KernelState* state) {
+        return GetState(state).impl;
+    }
+    
+    static arrow::Result<std::unique_ptr<cp::KernelState>> Init(cp::KernelContext* ctx,
+                                                                const cp::KernelInitArgs& args) {
+        auto state = std::make_unique<State>();
+        state->metrics_id = KernelMetricsId(args.kernel);
+        ARROW_RETURN_NOT_OK(state->impl.Init(ctx, args.options ? static_cast<const Options&>(*args.options) : Options()));
+        return state;
+    }
+    
+    static arrow::Status Resize(cp::KernelContext* ctx, int64_t new_num_groups) {
+        return Get(ctx->state()).Resize(ctx, new_num_groups);
+    }
+    
+    static arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch) {
+        // The group ids follow the arguments
+        const uint32_t* group_ids = batch[batch.num_values() - 1].array.GetValues<uint32_t>(1);
+        State& state = GetState(ctx->state());
+        KernelMetricsScope metrics(state.metrics_id, batch.length, ExecSpanBytes(batch));
+        return state.impl.Consume(ctx, batch, group_ids);
+    }
+    
+    static arrow::Status Merge(cp::KernelContext* ctx, cp::KernelState&& src, const arrow::ArrayData& group_id_mapping) {
+        return Get(ctx->state()).Merge(ctx, std::move(Get(&src)), group_id_mapping.GetValues<uint32_t>(1));
+    }
+    
+    static arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        State& state = GetState(ctx->state());
+        KernelMetricsScope metrics(state.metrics_id, 0, 0);
+        metrics.metrics().invocations = 0;
+        return state.impl.Finalize(ctx, out);
+    }
+    
+    /* in_types are the arguments, the group id column is appended */
+    static cp::HashAggregateKernel MakeKernel(std::vector<cp::InputType> in_types, cp::OutputType out_type,
+                                              bool ordered = false) {
+        in_types.push_back(cp::InputType(arrow::uint32()));
+        return cp::HashAggregateKernel(std::move(in_types), std::move(out_type), Init, Consume, Resize, Merge, Finalize, ordered);
+    }
+};
+
 
 struct URLParseTransform : StringTransformBase {
     int64_t Transform(const uint8_t* input, int64_t input_string_ncodeunits,
@@ -136,6 +376,7 @@ struct URLParseTransform : StringTransformBase {
             memcpy(output, host.data(), host.size());
             return host.size();
         } else {
+            parse_failures++;
             return 0;
         }
     }
@@ -148,12 +389,170 @@ const cp::FunctionDoc func_doc{
     {"x"},
     "URLParseOptions"};
 
+/* Fields of url_extract_dict before the query parameters */
+static const std::vector<std::string> kURLComponentFields = {
+    "scheme", "host", "path", "query", "fragment", "combinedPagePath", "pagePath1", "pagePath2", "pagePath3"};
+
+/*
+ * Parameter names of URLParseOptions in an open addressing table, so each
+ * parameter of a query costs one hash and usually one compare
+ */
+class URLParamSet {
+public:
+    explicit URLParamSet(const std::vector<std::string>& names) : names_(names) {
+        size_t num_slots = 8;
+        while (num_slots < names_.size() * 2) {
+            num_slots *= 2;
+        }
+        slots_.assign(num_slots, -1);
+        mask_ = num_slots - 1;
+        
+        for (size_t i = 0; i < names_.size(); i++) {
+            size_t slot = std::hash<std::string_view>()(names_[i]) & mask_;
+            while (slots_[slot] >= 0) {
+                slot = (slot + 1) & mask_;
+            }
+            slots_[slot] = static_cast<int>(i);
+        }
+    }
+    
+    // Index of name in the options, -1 if it is not requested
+    int Find(std::string_view name) const {
+        size_t slot = std::hash<std::string_view>()(name) & mask_;
+        while (slots_[slot] >= 0) {
+            if (names_[slots_[slot]] == name) {
+                return slots_[slot];
+            }
+            slot = (slot + 1) & mask_;
+        }
+        return -1;
+    }
+    
+private:
+    std::vector<std::string> names_;
+    std::vector<int> slots_;
+    size_t mask_;
+};
+
+struct URLParseState : public cp::KernelState {
+    URLParseState(URLParseOptions _options) : options(std::move(_options)), params(options.params) {}
+    
+    static arrow::Result<std::unique_ptr<cp::KernelState>> Init(cp::KernelContext* ctx,
+                                                                const cp::KernelInitArgs& args) {
+        auto options = static_cast<const URLParseOptions*>(args.options);
+        if (options == nullptr) {
+            return arrow::Status::Invalid("Attempted to initialize KernelState from null FunctionOptions");
+        }
+        
+        if (options->paramsOutput == PARAMS_COLUMNS) {
+            std::set<std::string> names(kURLComponentFields.begin(), kURLComponentFields.end());
+            for (const auto& name : options->params) {
+                if (name.empty() || !names.insert(name).second) {
+                    return arrow::Status::Invalid("Query parameter '", name, "' is empty or not unique among the url_extract_dict fields");
+                }
+            }
+        }
+        return std::make_unique<URLParseState>(*options);
+    }
+    
+    URLParseOptions options;
+    URLParamSet params;
+};
+
+static bool NeedsQueryDecoding(std::string_view encoded) {
+    return encoded.find_first_of("%+") != std::string_view::npos;
+}
+
+static int HexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* Percent decoding of a query key or value, '+' is a space */
+static std::string_view DecodeQueryComponent(std::string_view encoded, std::string* scratch) {
+    if (!NeedsQueryDecoding(encoded)) {
+        return encoded;
+    }
+    
+    scratch->clear();
+    for (size_t i = 0; i < encoded.size(); i++) {
+        if (encoded[i] == '+') {
+            scratch->push_back(' ');
+        } else if (encoded[i] == '%' && i + 2 < encoded.size() && HexDigit(encoded[i + 1]) >= 0 && HexDigit(encoded[i + 2]) >= 0) {
+            scratch->push_back(static_cast<char>(HexDigit(encoded[i + 1]) * 16 + HexDigit(encoded[i + 2])));
+            i += 2;
+        } else {
+            scratch->push_back(encoded[i]);
+        }
+    }
+    return *scratch;
+}
+
+/* Calls visit(key, value, has_value) with the encoded parts of every parameter of a query */
+template <typename Visit> static arrow::Status SplitQuery(std::string_view query, Visit&& visit) {
+    size_t position = 0;
+    while (position <= query.size()) {
+        size_t end = std::min(query.find('&', position), query.size());
+        std::string_view param = query.substr(position, end - position);
+        position = end + 1;
+        
+        if (param.empty()) {
+            continue;
+        }
+        size_t equals = param.find('=');
+        if (equals == std::string_view::npos) {
+            ARROW_RETURN_NOT_OK(visit(param, std::string_view(), false));
+        } else {
+            ARROW_RETURN_NOT_OK(visit(param.substr(0, equals), param.substr(equals + 1), true));
+        }
+    }
+    return arrow::Status::OK();
+}
+
+/*
+ * The components of url_extract_dict followed by the query parameters of
+ * the options, all in the string type of the input
+ */
+static std::shared_ptr<arrow::DataType> URLComponentsType(const std::shared_ptr<arrow::DataType>& type,
+                                                          const URLParseOptions& options) {
+    arrow::FieldVector fields;
+    fields.reserve(kURLComponentFields.size() + options.params.size());
+    
+    for (const auto& name : kURLComponentFields) {
+        fields.push_back(arrow::field(name, type));
+    }
+    
+    if (options.paramsOutput == PARAMS_MAP) {
+        fields.push_back(arrow::field("params", arrow::map(type, type)));
+    } else {
+        for (const auto& name : options.params) {
+            fields.push_back(arrow::field(name, type));
+        }
+    }
+    
+    return arrow::struct_(std::move(fields));
+}
+
+static arrow::Result<arrow::TypeHolder> ResolveURLComponentsType(cp::KernelContext* ctx,
+                                                                 const std::vector<arrow::TypeHolder>& types) {
+    const auto& state = arrow::internal::checked_cast<const URLParseState&>(*ctx->state());
+    return URLComponentsType(types[0].GetSharedPtr(), state.options);
+}
+
 template <typename Type> struct DictTransformExec {
     using BuilderType = typename arrow::TypeTraits<Type>::BuilderType;
     
     
     static arrow::Status Execute(cp::KernelContext* ctx, const cp::ExecSpan& batch,
                                  cp::ExecResult* out) {
+        KernelMetricsScope metrics(KernelMetricsId(ctx->kernel()), batch.length,
+                                   GetStringValuesLength<Type>(batch[0].array));
+        
+        const auto& state = arrow::internal::checked_cast<const URLParseState&>(*ctx->state());
+        const size_t num_params = state.options.params.size();
+        const bool params_map = state.options.paramsOutput == PARAMS_MAP;
         
         std::shared_ptr<arrow::DataType> type = out->array_data()->type;
         ARROW_ASSIGN_OR_RAISE(std::unique_ptr<arrow::ArrayBuilder> array_builder,
@@ -162,16 +561,33 @@ template <typename Type> struct DictTransformExec {
         arrow::StructBuilder* struct_builder = arrow::internal::checked_cast<arrow::StructBuilder*>(array_builder.get());
         
         ARROW_RETURN_NOT_OK(struct_builder->Reserve(batch[0].length()));
-        std::cout << batch[0].length() << std::endl;
         std::vector<BuilderType*> field_builders;
         
-        field_builders.reserve(13);
-        for (int i = 0; i < 13; i++) {
+        const int num_components = static_cast<int>(kURLComponentFields.size());
+        const int num_builders = num_components + (params_map ? 0 : static_cast<int>(num_params));
+        field_builders.reserve(num_builders);
+        for (int i = 0; i < num_builders; i++) {
             field_builders.push_back(
                                      dynamic_cast<BuilderType*>(struct_builder->field_builder(i)));
             RETURN_NOT_OK(field_builders.back()->Reserve(batch[0].length()));
         }
         
+        arrow::MapBuilder* map_builder = nullptr;
+        BuilderType* key_builder = nullptr;
+        BuilderType* item_builder = nullptr;
+        if (params_map) {
+            map_builder = arrow::internal::checked_cast<arrow::MapBuilder*>(struct_builder->field_builder(num_components));
+            key_builder = arrow::internal::checked_cast<BuilderType*>(map_builder->key_builder());
+            item_builder = arrow::internal::checked_cast<BuilderType*>(map_builder->item_builder());
+        }
+        
+        /* Encoded values of the requested parameters in the current URL, set where value_row is the row */
+        std::vector<std::string_view> values(num_params);
+        std::vector<int64_t> value_row(num_params, -1);
+        int64_t row = 0;
+        std::string key_scratch;
+        std::string value_scratch;
+        
         auto visit_null = [&]() {
             return struct_builder->AppendNull();
         };
@@ -231,39 +647,42 @@ template <typename Type> struct DictTransformExec {
                     RETURN_NOT_OK(field_builders[8]->AppendNull());
                 }
                 
-                boost::urls::params_view pv = u.params();
+                /* The query is split once, only values of requested names are decoded */
+                std::string_view query = u.has_query() ? std::string_view(u.encoded_query()) : std::string_view();
+                row++;
                 
-                auto utm_campaign = pv.find("utm_campaign");
-                if (utm_campaign != pv.end()) {
-                    RETURN_NOT_OK(field_builders[9]->Append((*utm_campaign).value));
-                } else {
-                    RETURN_NOT_OK(field_builders[9]->AppendNull());
-                }
-
-                auto utm_source = pv.find("utm_source");
-                if (utm_source != pv.end()) {
-                    RETURN_NOT_OK(field_builders[10]->Append((*utm_source).value));
+                if (params_map) {
+                    RETURN_NOT_OK(map_builder->Append());
+                    RETURN_NOT_OK(SplitQuery(query, [&](std::string_view key, std::string_view value, bool has_value) {
+                        RETURN_NOT_OK(key_builder->Append(DecodeQueryComponent(key, &key_scratch)));
+                        if (!has_value) {
+                            return item_builder->AppendNull();
+                        }
+                        return item_builder->Append(DecodeQueryComponent(value, &value_scratch));
+                    }));
                 } else {
-                    RETURN_NOT_OK(field_builders[10]->AppendNull());
-                }
-
-                auto utm_medium = pv.find("utm_medium");
-                if (utm_medium != pv.end()) {
-                    RETURN_NOT_OK(field_builders[11]->Append((*utm_medium).value));
-                } else {
-                    RETURN_NOT_OK(field_builders[11]->AppendNull());
-                }
-
-                auto utm_term = pv.find("utm_term");
-                if (utm_term != pv.end()) {
-                    RETURN_NOT_OK(field_builders[12]->Append((*utm_term).value));
-                } else {
-                    RETURN_NOT_OK(field_builders[12]->AppendNull());
+                    RETURN_NOT_OK(SplitQuery(query, [&](std::string_view key, std::string_view value, bool has_value) {
+                        int index = state.params.Find(DecodeQueryComponent(key, &key_scratch));
+                        if (index >= 0 && value_row[index] != row) {
+                            value_row[index] = row;
+                            values[index] = value;
+                        }
+                        return arrow::Status::OK();
+                    }));
+                    
+                    for (size_t i = 0; i < num_params; i++) {
+                        BuilderType* builder = field_builders[num_components + i];
+                        if (value_row[i] == row) {
+                            RETURN_NOT_OK(builder->Append(DecodeQueryComponent(values[i], &value_scratch)));
+                        } else {
+                            RETURN_NOT_OK(builder->AppendNull());
+                        }
+                    }
                 }
 
-
                 return struct_builder->Append();
             } else {
+                metrics.metrics().parse_failures++;
                 return struct_builder->AppendNull();
             }
         };
@@ -273,6 +692,9 @@ template <typename Type> struct DictTransformExec {
         std::shared_ptr<arrow::Array> out_array;
         RETURN_NOT_OK(struct_builder->Finish(&out_array));
         
+        metrics.metrics().null_outputs = out_array->null_count();
+        metrics.metrics().bytes_out = arrow::util::TotalBufferSize(*out_array);
+        
         out->value = std::move(out_array->data());
         return arrow::Status::OK();
     }
@@ -286,63 +708,730 @@ const cp::FunctionDoc func_struct_doc{
     "URLParseOptions"};
 
 
-std::unique_ptr<cp::FunctionOptions> URLParseOptionsType::Copy(
-                                                               const cp::FunctionOptions&) const {
-                                                                   return std::make_unique<URLParseOptions>();
-                                                               }
+/*
+ * HyperLogLog sketch over 2^precision one byte registers. The first
+ * `precision` bits of a value's hash pick the register, which keeps the
+ * longest run of leading zeros seen in the remaining bits plus one.
+ * Sketches merge by taking the maximum of every register.
+ */
+struct HyperLogLog {
+    static uint64_t Mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+    
+    static uint64_t Hash(std::string_view value) {
+        return Mix(arrow::internal::ComputeStringHash<0>(value.data(), static_cast<int64_t>(value.size())));
+    }
+    
+    template <typename T> static uint64_t Hash(T value) {
+        return Mix(static_cast<uint64_t>(value));
+    }
+    
+    static uint32_t Index(uint64_t hash, int precision) {
+        return static_cast<uint32_t>(hash >> (64 - precision));
+    }
+    
+    static uint8_t Rank(uint64_t hash, int precision) {
+        uint64_t rest = hash << precision;
+        return rest == 0 ? 64 - precision + 1 : __builtin_clzll(rest) + 1;
+    }
+    
+    static void Add(uint8_t* registers, int precision, uint64_t hash) {
+        uint32_t index = Index(hash, precision);
+        registers[index] = std::max(registers[index], Rank(hash, precision));
+    }
+    
+    static void Merge(uint8_t* registers, const uint8_t* other, int precision) {
+        for (int64_t i = 0; i < (int64_t(1) << precision); i++) {
+            registers[i] = std::max(registers[i], other[i]);
+        }
+    }
+    
+    /* sum is the sum of 2^-register over all registers, zeros the number of empty ones */
+    static int64_t Estimate(double sum, int64_t zeros, int precision) {
+        const double m = static_cast<double>(int64_t(1) << precision);
+        double alpha;
+        switch (precision) {
+            case 4: alpha = 0.673; break;
+            case 5: alpha = 0.697; break;
+            case 6: alpha = 0.709; break;
+            default: alpha = 0.7213 / (1.0 + 1.079 / m);
+        }
+        
+        double estimate = alpha * m * m / sum;
+        
+        // Small cardinalities leave registers empty, linear counting is more accurate there
+        if (estimate <= 2.5 * m && zeros > 0) {
+            estimate = m * std::log(m / static_cast<double>(zeros));
+        }
+        return std::llround(estimate);
+    }
+    
+    static int64_t Estimate(const uint8_t* registers, int precision) {
+        double sum = 0;
+        int64_t zeros = 0;
+        for (int64_t i = 0; i < (int64_t(1) << precision); i++) {
+            sum += std::ldexp(1.0, -registers[i]);
+            zeros += registers[i] == 0;
+        }
+        return Estimate(sum, zeros, precision);
+    }
+};
+
+/*
+ * HyperLogLog sketch that starts as a sorted list of its non-empty
+ * registers, each packed as index << 8 | rank, and switches to the dense
+ * registers once the list would take more than a quarter of their size.
+ * Most groups of a grouped count see few values, their sketches stay a
+ * few bytes instead of 2^precision.
+ */
+class SparseHyperLogLog {
+public:
+    bool dense() const { return dense_ >= 0; }
+    
+    // Index of the dense registers in the pool of the owner, -1 while sparse
+    int64_t dense_slot() const { return dense_; }
+    
+    /* Returns true once the list has grown past the threshold, call ToDense then */
+    bool Add(uint32_t index, uint8_t rank, int precision) {
+        uint32_t entry = index << 8 | rank;
+        auto it = std::lower_bound(sparse_.begin(), sparse_.end(), index << 8);
+        if (it != sparse_.end() && (*it >> 8) == index) {
+            *it = std::max(*it, entry);
+            return false;
+        }
+        sparse_.insert(it, entry);
+        return static_cast<int64_t>(sparse_.size() * sizeof(uint32_t)) > (int64_t(1) << precision) / 4;
+    }
+    
+    /* Writes the registers of the list into registers and drops the list */
+    void ToDense(int64_t slot, uint8_t* registers) {
+        for (uint32_t entry : sparse_) {
+            registers[entry >> 8] = std::max(registers[entry >> 8], static_cast<uint8_t>(entry & 0xff));
+        }
+        std::vector<uint32_t>().swap(sparse_);
+        dense_ = slot;
+    }
+    
+    const std::vector<uint32_t>& sparse() const { return sparse_; }
+    
+    int64_t Estimate(int precision) const {
+        double sum = static_cast<double>((int64_t(1) << precision) - static_cast<int64_t>(sparse_.size()));
+        for (uint32_t entry : sparse_) {
+            sum += std::ldexp(1.0, -static_cast<int>(entry & 0xff));
+        }
+        return HyperLogLog::Estimate(sum, (int64_t(1) << precision) - static_cast<int64_t>(sparse_.size()), precision);
+    }
+    
+private:
+    std::vector<uint32_t> sparse_;
+    int64_t dense_ = -1;
+};
 
+static arrow::Result<int> GetApproxCountDistinctPrecision(const ApproxCountDistinctOptions& options) {
+    if (options.precision < ApproxCountDistinctOptions::kMinPrecision || options.precision > ApproxCountDistinctOptions::kMaxPrecision) {
+        return arrow::Status::Invalid("approx_count_distinct precision must be between ",
+                                      ApproxCountDistinctOptions::kMinPrecision, " and ",
+                                      ApproxCountDistinctOptions::kMaxPrecision, ", got ", options.precision);
+    }
+    return options.precision;
+}
 
-void RegisterCustomFunctions() {
-    auto func = std::make_shared<cp::ScalarFunction>("url_extract",
-                                                     cp::Arity::Unary(),
-                                                     func_doc);
+template <typename Type> struct ApproxCountDistinctImpl {
+    arrow::Status Init(cp::KernelContext* ctx, const ApproxCountDistinctOptions& options) {
+        ARROW_ASSIGN_OR_RAISE(precision, GetApproxCountDistinctPrecision(options));
+        registers.resize(size_t(1) << precision, 0);
+        return arrow::Status::OK();
+    }
     
-    cp::ScalarKernel kernel({arrow::utf8()},
-                            arrow::utf8(),
-                            StringTransformExec<arrow::StringType, URLParseTransform, URLParseOptions>::Execute,StringTransformExec<arrow::StringType, URLParseTransform, URLParseOptions>::State::Init);
+    arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch) {
+        ARROW_ASSIGN_OR_RAISE(auto values, ArgumentAsArray(ctx, batch, 0));
+        
+        arrow::VisitArraySpanInline<Type>(arrow::ArraySpan(*values),
+                                          [&](auto value) {
+                                              HyperLogLog::Add(registers.data(), precision, HyperLogLog::Hash(value));
+                                          },
+                                          [] {});
+        return arrow::Status::OK();
+    }
     
-    kernel.mem_allocation = cp::MemAllocation::PREALLOCATE;
-    kernel.null_handling = cp::NullHandling::INTERSECTION;
+    arrow::Status Merge(cp::KernelContext* ctx, ApproxCountDistinctImpl&& other) {
+        HyperLogLog::Merge(registers.data(), other.registers.data(), precision);
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        *out = arrow::Datum(HyperLogLog::Estimate(registers.data(), precision));
+        return arrow::Status::OK();
+    }
+    
+    int precision = 0;
+    std::vector<uint8_t> registers;
+};
+
+/*
+ * One sketch per group, sparse until it fills up. Dense registers of all
+ * groups are laid out back to back in the order groups became dense.
+ */
+template <typename Type> struct GroupedApproxCountDistinctImpl {
+    arrow::Status Init(cp::KernelContext* ctx, const ApproxCountDistinctOptions& options) {
+        ARROW_ASSIGN_OR_RAISE(precision, GetApproxCountDistinctPrecision(options));
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Resize(cp::KernelContext* ctx, int64_t new_num_groups) {
+        num_groups = new_num_groups;
+        sketches.resize(static_cast<size_t>(new_num_groups));
+        return arrow::Status::OK();
+    }
+    
+    uint8_t* Registers(int64_t slot) { return registers.data() + (static_cast<size_t>(slot) << precision); }
     
+    uint8_t* MakeDense(SparseHyperLogLog& sketch) {
+        int64_t slot = num_dense++;
+        registers.resize(static_cast<size_t>(num_dense) << precision, 0);
+        sketch.ToDense(slot, Registers(slot));
+        return Registers(slot);
+    }
+    
+    void Add(SparseHyperLogLog& sketch, uint32_t index, uint8_t rank) {
+        if (sketch.dense()) {
+            uint8_t& reg = Registers(sketch.dense_slot())[index];
+            reg = std::max(reg, rank);
+        } else if (sketch.Add(index, rank, precision)) {
+            MakeDense(sketch);
+        }
+    }
+    
+    arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch, const uint32_t* groups) {
+        ARROW_ASSIGN_OR_RAISE(auto values, ArgumentAsArray(ctx, batch, 0));
+        
+        int64_t i = 0;
+        arrow::VisitArraySpanInline<Type>(arrow::ArraySpan(*values),
+                                          [&](auto value) {
+                                              uint64_t hash = HyperLogLog::Hash(value);
+                                              Add(sketches[groups[i++]], HyperLogLog::Index(hash, precision),
+                                                  HyperLogLog::Rank(hash, precision));
+                                          },
+                                          [&] { i++; });
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Merge(cp::KernelContext* ctx, GroupedApproxCountDistinctImpl&& other, const uint32_t* group_id_mapping) {
+        for (int64_t group = 0; group < other.num_groups; group++) {
+            SparseHyperLogLog& sketch = sketches[group_id_mapping[group]];
+            const SparseHyperLogLog& other_sketch = other.sketches[group];
+            if (other_sketch.dense()) {
+                uint8_t* dense = sketch.dense() ? Registers(sketch.dense_slot()) : MakeDense(sketch);
+                HyperLogLog::Merge(dense, other.Registers(other_sketch.dense_slot()), precision);
+                continue;
+            }
+            for (uint32_t entry : other_sketch.sparse()) {
+                Add(sketch, entry >> 8, static_cast<uint8_t>(entry & 0xff));
+            }
+        }
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        ARROW_ASSIGN_OR_RAISE(auto counts, ctx->Allocate(num_groups * sizeof(int64_t)));
+        int64_t* values = reinterpret_cast<int64_t*>(counts->mutable_data());
+        for (int64_t group = 0; group < num_groups; group++) {
+            const SparseHyperLogLog& sketch = sketches[group];
+            values[group] = sketch.dense() ? HyperLogLog::Estimate(Registers(sketch.dense_slot()), precision)
+                                           : sketch.Estimate(precision);
+        }
+        
+        *out = arrow::ArrayData::Make(arrow::int64(), num_groups, {nullptr, std::move(counts)}, /*null_count=*/0);
+        return arrow::Status::OK();
+    }
+    
+    int precision = 0;
+    int64_t num_groups = 0;
+    std::vector<SparseHyperLogLog> sketches;
+    // Dense registers, 2^precision per dense sketch
+    int64_t num_dense = 0;
+    std::vector<uint8_t> registers;
+};
+
+template <typename Type> static arrow::Status AddApproxCountDistinctKernels(cp::ScalarAggregateFunction* func,
+                                                                            cp::HashAggregateFunction* hash_func,
+                                                                            cp::InputType input_type) {
+    using Exec = ScalarAggregateExec<ApproxCountDistinctImpl<Type>, ApproxCountDistinctOptions>;
+    using HashExec = HashAggregateExec<GroupedApproxCountDistinctImpl<Type>, ApproxCountDistinctOptions>;
+    
+    cp::ScalarAggregateKernel kernel = Exec::MakeKernel({input_type}, arrow::int64());
+    kernel.data = MakeKernelMetricsData(func->name());
     ARROW_RETURN_NOT_OK(func->AddKernel(std::move(kernel)));
     
-    auto registry = cp::GetFunctionRegistry();
+    cp::HashAggregateKernel hash_kernel = HashExec::MakeKernel({input_type}, arrow::int64());
+    hash_kernel.data = MakeKernelMetricsData(hash_func->name());
+    return hash_func->AddKernel(std::move(hash_kernel));
+}
+
+const cp::FunctionDoc approx_count_distinct_doc{
+    "Approximate number of distinct values",
+    "Estimates the distinct non-null values with a HyperLogLog sketch",
+    {"x"},
+    "ApproxCountDistinctOptions"};
+
+const cp::FunctionDoc hash_approx_count_distinct_doc{
+    "Approximate number of distinct values per group",
+    "Estimates the distinct non-null values of each group with a HyperLogLog sketch",
+    {"x", "group_id_array"},
+    "ApproxCountDistinctOptions"};
+
+static arrow::Status RegisterApproxCountDistinct(cp::FunctionRegistry* registry) {
+    static const ApproxCountDistinctOptions default_options;
+    
+    auto func = std::make_shared<cp::ScalarAggregateFunction>("approx_count_distinct",
+                                                              cp::Arity::Unary(),
+                                                              approx_count_distinct_doc,
+                                                              &default_options);
+    auto hash_func = std::make_shared<cp::HashAggregateFunction>("hash_approx_count_distinct",
+                                                                 cp::Arity::Binary(),
+                                                                 hash_approx_count_distinct_doc,
+                                                                 &default_options);
+    
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::StringType>(func.get(), hash_func.get(), arrow::utf8()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::LargeStringType>(func.get(), hash_func.get(), arrow::large_utf8()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::StringViewType>(func.get(), hash_func.get(), arrow::utf8_view()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::BinaryType>(func.get(), hash_func.get(), arrow::binary()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::Int32Type>(func.get(), hash_func.get(), arrow::int32()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::Int64Type>(func.get(), hash_func.get(), arrow::int64()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::UInt32Type>(func.get(), hash_func.get(), arrow::uint32()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::UInt64Type>(func.get(), hash_func.get(), arrow::uint64()));
+    ARROW_RETURN_NOT_OK(AddApproxCountDistinctKernels<arrow::TimestampType>(func.get(), hash_func.get(), cp::InputType(arrow::Type::TIMESTAMP)));
+    
     ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(func)));
-    ARROW_RETURN_NOT_OK(registry->AddFunctionOptionsType(GetURLParseOptionsType()));
+    ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(hash_func)));
+    return registry->AddFunctionOptionsType(GetApproxCountDistinctOptionsType());
+}
+
+std::string ApproxCountDistinctOptionsType::Stringify(const cp::FunctionOptions& options) const {
+    return "ApproxCountDistinctOptions(precision=" +
+        std::to_string(static_cast<const ApproxCountDistinctOptions&>(options).precision) + ")";
+}
+
+bool ApproxCountDistinctOptionsType::Compare(const cp::FunctionOptions& options,
+                                             const cp::FunctionOptions& other) const {
+    return static_cast<const ApproxCountDistinctOptions&>(options).precision ==
+        static_cast<const ApproxCountDistinctOptions&>(other).precision;
+}
+
+std::unique_ptr<cp::FunctionOptions> ApproxCountDistinctOptionsType::Copy(const cp::FunctionOptions& options) const {
+    return std::make_unique<ApproxCountDistinctOptions>(static_cast<const ApproxCountDistinctOptions&>(options));
+}
+
+cp::FunctionOptionsType* GetApproxCountDistinctOptionsType() {
+    static ApproxCountDistinctOptionsType options_type;
+    return &options_type;
+}
+
+
+/* The gap of options in units of a timestamp type */
+static int64_t SessionGap(const SessionCountOptions& options, const arrow::DataType& type) {
+    int64_t seconds = options.gap.count();
+    switch (static_cast<const arrow::TimestampType&>(type).unit()) {
+        case arrow::TimeUnit::SECOND: return seconds;
+        case arrow::TimeUnit::MILLI: return seconds * 1000;
+        case arrow::TimeUnit::MICRO: return seconds * 1000000;
+        case arrow::TimeUnit::NANO: return seconds * 1000000000;
+    }
+    return seconds;
+}
+
+/* Sessions in sorted timestamps */
+static int64_t CountSessions(const int64_t* times, int64_t length, int64_t gap) {
+    int64_t sessions = length > 0;
+    for (int64_t i = 1; i < length; i++) {
+        sessions += times[i] - times[i - 1] > gap;
+    }
+    return sessions;
+}
+
+/*
+ * Timestamps are collected as they come and sorted when finalizing, so
+ * the input needs no order and thread states merge by appending.
+ */
+struct SessionCountImpl {
+    arrow::Status Init(cp::KernelContext* ctx, const SessionCountOptions& options) {
+        this->options = options;
+        return arrow::Status::OK();
+    }
     
-    auto dict_func = std::make_shared<cp::ScalarFunction>("url_extract_dict",
-                                                          cp::Arity::Unary(),
-                                                          func_struct_doc);
-    arrow::FieldVector fields;
-    fields.reserve(13);
+    arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch) {
+        gap = SessionGap(options, *batch[0].type());
+        ARROW_ASSIGN_OR_RAISE(auto values, ArgumentAsArray(ctx, batch, 0));
+        
+        arrow::VisitArraySpanInline<arrow::Int64Type>(arrow::ArraySpan(*values),
+                                                      [&](int64_t time) { times.push_back(time); },
+                                                      [] {});
+        return arrow::Status::OK();
+    }
     
-    fields.push_back(arrow::field("scheme", arrow::utf8()));
+    arrow::Status Merge(cp::KernelContext* ctx, SessionCountImpl&& other) {
+        gap = std::max(gap, other.gap);
+        times.insert(times.end(), other.times.begin(), other.times.end());
+        return arrow::Status::OK();
+    }
     
-    fields.push_back(arrow::field("host", arrow::utf8()));
-    fields.push_back(arrow::field("path", arrow::utf8()));
-    fields.push_back(arrow::field("query", arrow::utf8()));
-    fields.push_back(arrow::field("fragment", arrow::utf8()));
+    arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        std::sort(times.begin(), times.end());
+        *out = arrow::Datum(CountSessions(times.data(), static_cast<int64_t>(times.size()), gap));
+        return arrow::Status::OK();
+    }
+    
+    SessionCountOptions options;
+    // Gap in units of the input, known once a batch was consumed
+    int64_t gap = 0;
+    std::vector<int64_t> times;
+};
+
+/* (group, timestamp) pairs of all groups, sorted by group and time when finalizing */
+struct GroupedSessionCountImpl {
+    arrow::Status Init(cp::KernelContext* ctx, const SessionCountOptions& options) {
+        this->options = options;
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Resize(cp::KernelContext* ctx, int64_t new_num_groups) {
+        num_groups = new_num_groups;
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Consume(cp::KernelContext* ctx, const cp::ExecSpan& batch, const uint32_t* groups) {
+        gap = SessionGap(options, *batch[0].type());
+        ARROW_ASSIGN_OR_RAISE(auto values, ArgumentAsArray(ctx, batch, 0));
+        
+        int64_t i = 0;
+        arrow::VisitArraySpanInline<arrow::Int64Type>(arrow::ArraySpan(*values),
+                                                      [&](int64_t time) { times.emplace_back(groups[i++], time); },
+                                                      [&] { i++; });
+        return arrow::Status::OK();
+    }
+    
+    arrow::Status Merge(cp::KernelContext* ctx, GroupedSessionCountImpl&& other, const uint32_t* group_id_mapping) {
+        gap = std::max(gap, other.gap);
+        times.reserve(times.size() + other.times.size());
+        for (const auto& [group, time] : other.times) {
+            times.emplace_back(group_id_mapping[group], time);
+        }
+        return arrow::Status::OK();
+    }
     
-    fields.push_back(arrow::field("combinedPagePath", arrow::utf8()));
+    arrow::Status Finalize(cp::KernelContext* ctx, arrow::Datum* out) {
+        std::sort(times.begin(), times.end());
+        
+        ARROW_ASSIGN_OR_RAISE(auto counts, ctx->Allocate(num_groups * sizeof(int64_t)));
+        int64_t* values = reinterpret_cast<int64_t*>(counts->mutable_data());
+        std::fill(values, values + num_groups, 0);
+        for (size_t i = 0; i < times.size(); i++) {
+            bool first = i == 0 || times[i].first != times[i - 1].first;
+            values[times[i].first] += first || times[i].second - times[i - 1].second > gap;
+        }
+        
+        *out = arrow::ArrayData::Make(arrow::int64(), num_groups, {nullptr, std::move(counts)}, /*null_count=*/0);
+        return arrow::Status::OK();
+    }
     
-    fields.push_back(arrow::field("pagePath1", arrow::utf8()));
-    fields.push_back(arrow::field("pagePath2", arrow::utf8()));
-    fields.push_back(arrow::field("pagePath3", arrow::utf8()));
+    SessionCountOptions options;
+    int64_t gap = 0;
+    int64_t num_groups = 0;
+    std::vector<std::pair<uint32_t, int64_t>> times;
+};
 
-    fields.push_back(arrow::field("utm_campaign", arrow::utf8()));
-    fields.push_back(arrow::field("utm_source", arrow::utf8()));
-    fields.push_back(arrow::field("utm_medium", arrow::utf8()));
-    fields.push_back(arrow::field("utm_term", arrow::utf8()));
+const cp::FunctionDoc session_count_doc{
+    "Number of sessions",
+    "Counts runs of timestamps where consecutive ones are at most the gap apart",
+    {"time"},
+    "SessionCountOptions"};
 
-    cp::ScalarKernel struct_kernel({arrow::utf8()},
-                                   struct_(std::move(fields)),
-                                   DictTransformExec<arrow::StringType>::Execute);
+const cp::FunctionDoc hash_session_count_doc{
+    "Number of sessions per group",
+    "Counts runs of timestamps of each group where consecutive ones are at most the gap apart",
+    {"time", "group_id_array"},
+    "SessionCountOptions"};
+
+static arrow::Status RegisterSessionCount(cp::FunctionRegistry* registry) {
+    static const SessionCountOptions default_options;
+    
+    auto func = std::make_shared<cp::ScalarAggregateFunction>("session_count",
+                                                              cp::Arity::Unary(),
+                                                              session_count_doc,
+                                                              &default_options);
+    auto hash_func = std::make_shared<cp::HashAggregateFunction>("hash_session_count",
+                                                                 cp::Arity::Binary(),
+                                                                 hash_session_count_doc,
+                                                                 &default_options);
     
-    struct_kernel.null_handling = cp::NullHandling::COMPUTED_NO_PREALLOCATE;
-    struct_kernel.mem_allocation = cp::MemAllocation::NO_PREALLOCATE;
+    using Exec = ScalarAggregateExec<SessionCountImpl, SessionCountOptions>;
+    using HashExec = HashAggregateExec<GroupedSessionCountImpl, SessionCountOptions>;
+    
+    cp::ScalarAggregateKernel kernel = Exec::MakeKernel({cp::InputType(arrow::Type::TIMESTAMP)}, arrow::int64());
+    kernel.data = MakeKernelMetricsData(func->name());
+    ARROW_RETURN_NOT_OK(func->AddKernel(std::move(kernel)));
     
-    ARROW_RETURN_NOT_OK(dict_func->AddKernel(std::move(struct_kernel)));
+    cp::HashAggregateKernel hash_kernel = HashExec::MakeKernel({cp::InputType(arrow::Type::TIMESTAMP)}, arrow::int64());
+    hash_kernel.data = MakeKernelMetricsData(hash_func->name());
+    ARROW_RETURN_NOT_OK(hash_func->AddKernel(std::move(hash_kernel)));
+    
+    ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(func)));
+    ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(hash_func)));
+    return registry->AddFunctionOptionsType(GetSessionCountOptionsType());
+}
+
+std::string SessionCountOptionsType::Stringify(const cp::FunctionOptions& options) const {
+    return "SessionCountOptions(gap=" +
+        std::to_string(static_cast<const SessionCountOptions&>(options).gap.count()) + "s)";
+}
+
+bool SessionCountOptionsType::Compare(const cp::FunctionOptions& options,
+                                      const cp::FunctionOptions& other) const {
+    return static_cast<const SessionCountOptions&>(options).gap ==
+        static_cast<const SessionCountOptions&>(other).gap;
+}
+
+std::unique_ptr<cp::FunctionOptions> SessionCountOptionsType::Copy(const cp::FunctionOptions& options) const {
+    return std::make_unique<SessionCountOptions>(static_cast<const SessionCountOptions&>(options));
+}
+
+cp::FunctionOptionsType* GetSessionCountOptionsType() {
+    static SessionCountOptionsType options_type;
+    return &options_type;
+}
+
+
+std::string URLParseOptionsType::Stringify(const cp::FunctionOptions& options) const {
+    const auto& url_options = static_cast<const URLParseOptions&>(options);
+    std::string params;
+    for (const auto& name : url_options.params) {
+        params += (params.empty() ? "" : ", ") + name;
+    }
+    return "URLParseOptions(extract=" + std::string(url_options.extract == HOST ? "HOST" : "PATH") +
+        ", params=[" + params + "], paramsOutput=" + (url_options.paramsOutput == PARAMS_MAP ? "MAP" : "COLUMNS") + ")";
+}
+
+bool URLParseOptionsType::Compare(const cp::FunctionOptions& options,
+                                  const cp::FunctionOptions& other) const {
+    const auto& url_options = static_cast<const URLParseOptions&>(options);
+    const auto& other_options = static_cast<const URLParseOptions&>(other);
+    return url_options.extract == other_options.extract &&
+        url_options.params == other_options.params &&
+        url_options.paramsOutput == other_options.paramsOutput;
+}
+
+std::unique_ptr<cp::FunctionOptions> URLParseOptionsType::Copy(const cp::FunctionOptions& options) const {
+    return std::make_unique<URLParseOptions>(static_cast<const URLParseOptions&>(options));
+}
+
+
+/*
+ * url_extract keeps the string layout of its input: utf8 and large_utf8
+ * write into preallocated offsets, string_view builds its views
+ */
+template <typename Type> static cp::ScalarKernel MakeURLExtractKernel(std::shared_ptr<arrow::DataType> type) {
+    using Exec = StringTransformExec<Type, URLParseTransform, URLParseOptions>;
+    
+    cp::ScalarKernel kernel({type}, type, Exec::Execute, Exec::State::Init);
+    
+    kernel.mem_allocation = cp::MemAllocation::PREALLOCATE;
+    kernel.null_handling = cp::NullHandling::INTERSECTION;
+    kernel.data = MakeKernelMetricsData("url_extract");
+    
+    return kernel;
+}
+
+static cp::ScalarKernel MakeURLExtractViewKernel() {
+    using Exec = StringViewTransformExec<URLParseTransform, URLParseOptions>;
+    
+    cp::ScalarKernel kernel({arrow::utf8_view()}, arrow::utf8_view(), Exec::Execute, Exec::State::Init);
+    
+    kernel.mem_allocation = cp::MemAllocation::NO_PREALLOCATE;
+    kernel.null_handling = cp::NullHandling::COMPUTED_NO_PREALLOCATE;
+    kernel.data = MakeKernelMetricsData("url_extract");
+    
+    return kernel;
+}
+
+template <typename Type> static cp::ScalarKernel MakeURLExtractDictKernel(std::shared_ptr<arrow::DataType> type) {
+    cp::ScalarKernel kernel({type},
+                            cp::OutputType(ResolveURLComponentsType),
+                            DictTransformExec<Type>::Execute,
+                            URLParseState::Init);
+    
+    kernel.null_handling = cp::NullHandling::COMPUTED_NO_PREALLOCATE;
+    kernel.mem_allocation = cp::MemAllocation::NO_PREALLOCATE;
+    kernel.data = MakeKernelMetricsData("url_extract_dict");
+    
+    return kernel;
+}
+
+const cp::FunctionDoc registrable_domain_doc{
+    "Registrable domain of a host",
+    "Returns the public suffix of the host plus one label, null for hosts without one.\n"
+    "The result is a string_view into the input strings, large_utf8 domains are copied.",
+    {"host"}};
+
+/*
+ * registrable_domain returns string_views of the input hosts. Domains
+ * longer than the inline size of a view point into the buffers of the
+ * input, so the hosts are not copied. large_utf8 offsets do not fit a
+ * view, those domains are copied into a view builder.
+ */
+template <typename Type> struct RegistrableDomainExec {
+    static arrow::Status Execute(cp::KernelContext* ctx, const cp::ExecSpan& batch,
+                                 cp::ExecResult* out) {
+        const arrow::ArraySpan& input = batch[0].array;
+        KernelMetricsScope metrics(KernelMetricsId(ctx->kernel()), input.length,
+                                   GetStringValuesLength<Type>(input));
+        
+        const PublicSuffixTrie& trie = PublicSuffixTrie::Default();
+        
+        /* Views hold 32 bit offsets into large_utf8 data that may not fit, the domains are copied */
+        if constexpr (std::is_same_v<Type, arrow::LargeStringType>) {
+            arrow::StringViewBuilder builder(ctx->memory_pool());
+            ARROW_RETURN_NOT_OK(builder.Reserve(input.length));
+            int64_t bytes_out = 0;
+            
+            arrow::Status status = arrow::VisitArraySpanInline<arrow::LargeStringType>(
+                input,
+                [&](std::string_view host) {
+                    PublicSuffixTrie::Match match = trie.RegistrableDomain(host);
+                    if (match.length == 0) {
+                        return builder.AppendNull();
+                    }
+                    bytes_out += match.length;
+                    return builder.Append(host.substr(match.offset, match.length));
+                },
+                [&] { return builder.AppendNull(); });
+            ARROW_RETURN_NOT_OK(status);
+            
+            std::shared_ptr<arrow::Array> output;
+            ARROW_RETURN_NOT_OK(builder.Finish(&output));
+            
+            metrics.metrics().bytes_out = bytes_out;
+            metrics.metrics().null_outputs = output->null_count();
+            
+            out->value = std::move(output->data());
+            return arrow::Status::OK();
+        }
+        
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> validity, ctx->AllocateBitmap(input.length));
+        ARROW_ASSIGN_OR_RAISE(std::shared_ptr<arrow::Buffer> views,
+                              ctx->Allocate(input.length * sizeof(arrow::BinaryViewType::c_type)));
+        uint8_t* valid_bits = validity->mutable_data();
+        auto* out_views = views->mutable_data_as<arrow::BinaryViewType::c_type>();
+        
+        std::vector<std::shared_ptr<arrow::Buffer>> buffers = {validity, views};
+        int64_t null_count = 0;
+        int64_t bytes_out = 0;
+        
+        auto set = [&](int64_t i, const PublicSuffixTrie::Match& match, arrow::BinaryViewType::c_type view) {
+            arrow::bit_util::SetBitTo(valid_bits, i, match.length > 0);
+            out_views[i] = view;
+            null_count += match.length > 0 ? 0 : 1;
+            bytes_out += match.length;
+        };
+        
+        if constexpr (std::is_same_v<Type, arrow::StringType>) {
+            const int32_t* offsets = input.GetValues<int32_t>(1);
+            const char* data = reinterpret_cast<const char*>(input.buffers[2].data);
+            buffers.push_back(input.GetBuffer(2));
+            
+            for (int64_t i = 0; i < input.length; i++) {
+                PublicSuffixTrie::Match match;
+                if (input.IsValid(i)) {
+                    match = trie.RegistrableDomain(std::string_view(data + offsets[i], offsets[i + 1] - offsets[i]));
+                }
+                set(i, match, arrow::util::ToBinaryView(data + offsets[i] + match.offset, match.length,
+                                                        0, offsets[i] + match.offset));
+            }
+        } else {
+            const auto* in_views = input.GetValues<arrow::BinaryViewType::c_type>(1);
+            auto variadic_buffers = input.GetVariadicBuffers();
+            buffers.insert(buffers.end(), variadic_buffers.begin(), variadic_buffers.end());
+            
+            for (int64_t i = 0; i < input.length; i++) {
+                PublicSuffixTrie::Match match;
+                if (input.IsValid(i)) {
+                    match = trie.RegistrableDomain(arrow::util::FromBinaryView(in_views[i], variadic_buffers.data()));
+                }
+                arrow::BinaryViewType::c_type view{};
+                if (match.length > 0) {
+                    std::string_view host = arrow::util::FromBinaryView(in_views[i], variadic_buffers.data());
+                    int32_t offset = in_views[i].is_inline() ? 0 : in_views[i].ref.offset + match.offset;
+                    view = arrow::util::ToBinaryView(host.data() + match.offset, match.length,
+                                                     in_views[i].is_inline() ? 0 : in_views[i].ref.buffer_index, offset);
+                }
+                set(i, match, view);
+            }
+        }
+        
+        metrics.metrics().bytes_out = bytes_out;
+        metrics.metrics().null_outputs = null_count;
+        
+        out->value = arrow::ArrayData::Make(arrow::utf8_view(), input.length, std::move(buffers), null_count);
+        return arrow::Status::OK();
+    }
+};
+
+template <typename Type> static cp::ScalarKernel MakeRegistrableDomainKernel(std::shared_ptr<arrow::DataType> type) {
+    cp::ScalarKernel kernel({type}, arrow::utf8_view(), RegistrableDomainExec<Type>::Execute);
+    
+    kernel.mem_allocation = cp::MemAllocation::NO_PREALLOCATE;
+    kernel.null_handling = cp::NullHandling::COMPUTED_NO_PREALLOCATE;
+    kernel.data = MakeKernelMetricsData("registrable_domain");
+    
+    return kernel;
+}
+
+static arrow::Status RegisterRegistrableDomain(cp::FunctionRegistry* registry) {
+    auto func = std::make_shared<cp::ScalarFunction>("registrable_domain",
+                                                     cp::Arity::Unary(),
+                                                     registrable_domain_doc);
+    
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeRegistrableDomainKernel<arrow::StringType>(arrow::utf8())));
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeRegistrableDomainKernel<arrow::LargeStringType>(arrow::large_utf8())));
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeRegistrableDomainKernel<arrow::StringViewType>(arrow::utf8_view())));
+    
+    return registry->AddFunction(std::move(func));
+}
+
+arrow::Status RegisterCustomFunctions() {
+    auto func = std::make_shared<cp::ScalarFunction>("url_extract",
+                                                     cp::Arity::Unary(),
+                                                     func_doc);
+    
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeURLExtractKernel<arrow::StringType>(arrow::utf8())));
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeURLExtractKernel<arrow::LargeStringType>(arrow::large_utf8())));
+    ARROW_RETURN_NOT_OK(func->AddKernel(MakeURLExtractViewKernel()));
+    
+    auto registry = cp::GetFunctionRegistry();
+    ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(func)));
+    ARROW_RETURN_NOT_OK(registry->AddFunctionOptionsType(GetURLParseOptionsType()));
+    
+    static const URLParseOptions default_options;
+    auto dict_func = std::make_shared<cp::ScalarFunction>("url_extract_dict",
+                                                          cp::Arity::Unary(),
+                                                          func_struct_doc,
+                                                          &default_options);
+    
+    ARROW_RETURN_NOT_OK(dict_func->AddKernel(MakeURLExtractDictKernel<arrow::StringType>(arrow::utf8())));
+    ARROW_RETURN_NOT_OK(dict_func->AddKernel(MakeURLExtractDictKernel<arrow::LargeStringType>(arrow::large_utf8())));
+    ARROW_RETURN_NOT_OK(dict_func->AddKernel(MakeURLExtractDictKernel<arrow::StringViewType>(arrow::utf8_view())));
     ARROW_RETURN_NOT_OK(registry->AddFunction(std::move(dict_func)));
+    
+    ARROW_RETURN_NOT_OK(RegisterRegistrableDomain(registry));
+    
+    ARROW_RETURN_NOT_OK(RegisterApproxCountDistinct(registry));
+    
+    return RegisterSessionCount(registry);
 }
 
 cp::FunctionOptionsType* GetURLParseOptionsType() {
@@ -23,12 +23,8 @@ namespace cp = arrow::compute;
 
 class URLParseOptionsType : public cp::FunctionOptionsType {
     const char* type_name() const override { return "URLParseOptionsType"; }
-    std::string Stringify(const cp::FunctionOptions&) const override {
-        return "URLParseOptionsType";
-    }
-    bool Compare(const cp::FunctionOptions&, const cp::FunctionOptions&) const override {
-        return true;
-    }
+    std::string Stringify(const cp::FunctionOptions&) const override;
+    bool Compare(const cp::FunctionOptions&, const cp::FunctionOptions&) const override;
     std::unique_ptr<cp::FunctionOptions> Copy(const cp::FunctionOptions&) const override;
 };
 
@@ -39,15 +35,89 @@ enum URLParseOptionsExtract {
   PATH
 };
 
+enum URLParamsOutput {
+  // One struct field per name in URLParseOptions::params
+  PARAMS_COLUMNS,
+  // All parameters of the query in one map<string, string> field "params"
+  PARAMS_MAP
+};
+
 class URLParseOptions : public cp::FunctionOptions {
     
 public:
     URLParseOptionsExtract extract = HOST;
     
+    /*
+     * Query parameters url_extract_dict returns, each as a field named
+     * after it. The query is split once per URL and only the values of
+     * these names are decoded, the first occurrence of a name wins.
+     */
+    std::vector<std::string> params = {"utm_campaign", "utm_source", "utm_medium", "utm_term"};
+    URLParamsOutput paramsOutput = PARAMS_COLUMNS;
+    
     URLParseOptions(URLParseOptionsExtract _extract = HOST) :
         cp::FunctionOptions(GetURLParseOptionsType()) {
         extract = _extract;
     }
+    
+    URLParseOptions(std::vector<std::string> _params,
+                    URLParamsOutput _paramsOutput = PARAMS_COLUMNS) :
+        cp::FunctionOptions(GetURLParseOptionsType()) {
+        params = std::move(_params);
+        paramsOutput = _paramsOutput;
+    }
+};
+
+class ApproxCountDistinctOptionsType : public cp::FunctionOptionsType {
+    const char* type_name() const override { return "ApproxCountDistinctOptionsType"; }
+    std::string Stringify(const cp::FunctionOptions&) const override;
+    bool Compare(const cp::FunctionOptions&, const cp::FunctionOptions&) const override;
+    std::unique_ptr<cp::FunctionOptions> Copy(const cp::FunctionOptions&) const override;
+};
+
+cp::FunctionOptionsType* GetApproxCountDistinctOptionsType();
+
+/*
+ * Options of approx_count_distinct and hash_approx_count_distinct. The
+ * sketch keeps 2^precision one byte registers per group, the standard
+ * error is about 1.04 / sqrt(2^precision): 1.6% at the default of 12.
+ */
+class ApproxCountDistinctOptions : public cp::FunctionOptions {
+
+public:
+    static constexpr int kMinPrecision = 4;
+    static constexpr int kMaxPrecision = 18;
+
+    int precision = 12;
+
+    ApproxCountDistinctOptions(int _precision = 12) :
+        cp::FunctionOptions(GetApproxCountDistinctOptionsType()) {
+        precision = _precision;
+    }
+};
+
+class SessionCountOptionsType : public cp::FunctionOptionsType {
+    const char* type_name() const override { return "SessionCountOptionsType"; }
+    std::string Stringify(const cp::FunctionOptions&) const override;
+    bool Compare(const cp::FunctionOptions&, const cp::FunctionOptions&) const override;
+    std::unique_ptr<cp::FunctionOptions> Copy(const cp::FunctionOptions&) const override;
+};
+
+cp::FunctionOptionsType* GetSessionCountOptionsType();
+
+/*
+ * Options of session_count and hash_session_count. Timestamps of a group
+ * that are more than gap apart start a new session.
+ */
+class SessionCountOptions : public cp::FunctionOptions {
+
+public:
+    std::chrono::seconds gap = std::chrono::minutes(30);
+
+    SessionCountOptions(std::chrono::seconds _gap = std::chrono::minutes(30)) :
+        cp::FunctionOptions(GetSessionCountOptionsType()) {
+        gap = _gap;
+    }
 };
 
-void RegisterCustomFunctions();
+arrow::Status RegisterCustomFunctions();